@@ -0,0 +1,48 @@
+--Lua program (not an sttp -x script) reading an SSR archive through the
+--sttp module, built with "make sttp.dll" in the source directory:
+--  lua archive.lua <archive> [<start> [<end>]]
+--start and end are "YYYY-MM-DD HH:MM:SS" (UTC).  It lists the time
+--correlation packets, then writes the data between start and end to
+--<archive>.bin and counts the bytes logged in each minute.
+
+local sttp = require("sttp")
+
+--ms since 1970 of "YYYY-MM-DD HH:MM:SS", nil if not given
+local function epoch_ms(s)
+  if not s then return nil end
+  local Y,M,D,h,m,sec = s:match("(%d+)-(%d+)-(%d+)%s+(%d+):(%d+):(%d+)")
+  assert(Y, "times are YYYY-MM-DD HH:MM:SS")
+  --os.time takes local time, the module works in UTC
+  local t = os.time{year=Y,month=M,day=D,hour=h,min=m,sec=sec}
+  local utc = os.time(os.date("!*t",t))
+  return (t + (t - utc))*1000
+end
+
+local a = assert(sttp.open(arg[1]))
+for i,t in ipairs(a:tcps()) do
+  print(string.format("TCP %d  runtime %.3f  %s  offset %d", i, t.runtime, t.time, t.offset))
+end
+
+local t0, t1 = epoch_ms(arg[2]), epoch_ms(arg[3])
+if t0 or t1 then a = a:range(t0, t1) end
+
+local out = assert(io.open(arg[1]..".bin","wb"))
+local perminute, minutes = {}, {}
+for ms, data, ends in a:chunks() do
+  out:write(data)
+  local last = 0
+  for i = 1,#ms do
+    local minute = math.floor(ms[i]/60000)
+    if not perminute[minute] then
+      perminute[minute] = 0
+      minutes[#minutes+1] = minute
+    end
+    perminute[minute] = perminute[minute] + ends[i] - last
+    last = ends[i]
+  end
+end
+out:close()
+
+for _,minute in ipairs(minutes) do
+  print(os.date("!%Y-%m-%d %H:%M", minute*60), perminute[minute])
+end
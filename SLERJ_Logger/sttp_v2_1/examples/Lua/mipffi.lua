@@ -0,0 +1,73 @@
+--External Slerj Time Tagged Parser (STTP) Lua script for MicroStrain
+--3DM-GX5-25 MIP packets, for sttp built with LuaJIT (make LUA=luajit).
+--It writes the same <archive>_mip.txt as mip.lua, but lets sttp find and
+--check the MIP packets (sttp_frame) and reads them through FFI pointers
+--(sttp_ffi) instead of Lua strings, so LuaJIT compiles the byte access to
+--machine code.
+
+local ffi = require("ffi")
+
+sttp_setTSFormat("%Y%m%d,%X.",false)
+paths=sttp_getPaths()
+
+local f = assert(io.open(paths.ArchivePath..paths.ArchiveName.."_mip.txt","w"))
+f:write("RunTime,Date,Time,GPSWeek,GPSTOW,Flags,yaw(deg),pitch(deg),roll(deg)\n")
+
+--MIP packets: 0x75 0x65, descriptor, payload length, payload, Fletcher
+--checksum.  sttp calls ParseFrame with each packet whose checksum is valid.
+sttp_frame = { sync="\x75\x65", len_pos=4, len_add=6, max_len=261,
+               checksum="fletcher" }
+
+--ParseFrame gets a const uint8_t* and a length in place of the frame string.
+sttp_ffi = true
+
+--Big endian floats are read by filling the bytes of a union.
+local cvt = ffi.new("union { uint8_t b[8]; float f; double d; }")
+local le = ffi.abi("le")
+local function BEFloat(p, i)
+  for k = 0,3 do cvt.b[le and 3-k or k] = p[i+k] end
+  return cvt.f
+end
+local function BEDouble(p, i)
+  for k = 0,7 do cvt.b[le and 7-k or k] = p[i+k] end
+  return cvt.d
+end
+local function BEU16(p, i)
+  return p[i]*256 + p[i+1]
+end
+
+--========================================================================
+--                          ParseFrame
+--========================================================================
+--p[0..n-1] is the whole packet, the payload starts at p[4].  As in
+--mip.lua, the runtime and timestamp written are those of the subpacket
+--holding the end of the packet.
+function ParseFrame(rt0, ts0, p, n, RT, TS)
+  local descriptor = p[2]
+  local paylen = p[3]
+  if descriptor ~= 0x80 then return end
+
+  --Euler angles (field 0x0C) and GPS time (field 0x12)
+  if paylen >= 28 and p[4] == 0x0E and p[5] == 0x0C and
+     p[18] == 0x0E and p[19] == 0x12 then
+    local r, pitch, y = BEFloat(p,6), BEFloat(p,10), BEFloat(p,14)
+    f:write(string.format("%.3f,%s,",RT,TS))
+    f:write(string.format("%d,%.3f,%04X,",BEU16(p,28),BEDouble(p,20),BEU16(p,30)))
+    f:write(string.format("%.2f,%.2f,%.2f\n",math.deg(y),math.deg(pitch),math.deg(r)))
+  else
+    --Any other 0x80 packet: descriptor and fields as hex.
+    local t = { string.format("%.3f,%s,%02X",RT,TS,descriptor) }
+    local i, e = 4, 4 + paylen
+    while i < e do
+      local len = p[i]
+      if len == 0 then break end
+      t[#t+1] = string.format(" %02X",i+1 < e and p[i+1] or 0)
+      for j = i+2, math.min(i+len,e)-1 do
+        t[#t+1] = string.format("%02X",p[j])
+      end
+      i = i + len
+    end
+    t[#t+1] = "\n"
+    f:write(table.concat(t))
+  end
+end
@@ -0,0 +1,28 @@
+@REM Times the reference plugins against the equivalent Lua scripts and
+@REM checks that they give the same output.
+@REM usage: bench <mip_archive> <brpt_archive>
+@REM Both parsers of a pair write the same file, so the Lua output is
+@REM renamed before the plugin runs.
+
+@set STTP=..\..\sttp.exe
+@set MIPLUA=..\..\..\sttp_v2_0\examples\Lua\mip.lua
+
+@echo MIP Lua      start %time%
+%STTP% -x %MIPLUA% %1
+@echo MIP Lua      end   %time%
+@move /y %~dpn1_mip.txt %~dpn1_mip_lua.txt >nul
+@echo MIP plugin   start %time%
+%STTP% -X mip.dll %1
+@echo MIP plugin   end   %time%
+fc /b %~dpn1_mip.txt %~dpn1_mip_lua.txt >nul && @echo MIP outputs match
+
+@echo BRPT Lua     start %time%
+%STTP% -x brpt.lua %2
+@echo BRPT Lua     end   %time%
+@move /y %~dpn2_brpt.csv %~dpn2_brpt_lua.csv >nul
+@echo BRPT plugin  start %time%
+%STTP% -X brpt.dll %2
+@echo BRPT plugin  end   %time%
+fc /b %~dpn2_brpt.csv %~dpn2_brpt_lua.csv >nul && @echo BRPT outputs match
+
+@pause
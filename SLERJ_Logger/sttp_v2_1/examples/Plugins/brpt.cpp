@@ -0,0 +1,169 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+//sttp parser plugin for the comma separated lines of a BRPT logger
+//(system temperature, barometer temperature and pressure, one line per
+//sample) captured in a SSR-1 time tagged archive.  Writes
+//<archive>_brpt.csv with the SSR runtime and timestamp of the first byte
+//of each well formed line followed by the line.  brpt.lua is the same
+//parser in Lua.  See sttp_plugin.h for the plugin interface.
+//
+//  g++ -O2 -shared -I ../../source -o brpt.dll brpt.cpp
+//  sttp -X brpt.dll archive.dat
+
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include "sttp_plugin.h"
+
+#define MAXLINE 256           //longer lines are dropped
+
+typedef struct
+  {
+  FILE *f;                    //output file
+  std::string line;           //line received so far
+  bool skip;                  //dropping an over long line up to its newline
+  double RT;                  //SSR runtime of the line's first byte
+  std::string TS;             //SSR timestamp of the line's first byte
+  } tBrpt;
+
+//========================================================================
+//                           WellFormed
+//========================================================================
+//A line is three non-empty fields of digits, '.' and '-'.
+static bool WellFormed(const char *p, size_t n)
+  {
+  int fields = 1;
+  size_t len = 0;
+  for(size_t i=0; i<n; ++i)
+    {
+    if(p[i] == ',')
+      {
+      if(!len || ++fields > 3)
+        return(false);
+      len = 0;
+      }
+    else if((p[i] >= '0' && p[i] <= '9') || p[i] == '.' || p[i] == '-')
+      ++len;
+    else
+      return(false);
+    }
+  return(fields == 3 && len);
+  }
+
+//========================================================================
+//                              EndLine
+//========================================================================
+static void EndLine(tBrpt *b)
+  {
+  size_t n = b->line.size();
+  if(n && b->line[n-1] == '\r')
+    --n;
+  if(!b->skip && WellFormed(b->line.data(),n))
+    fprintf(b->f,"%.3f,%s,%.*s\n",b->RT,b->TS.c_str(),(int)n,b->line.data());
+  b->line.clear();
+  b->skip = false;
+  }
+
+//========================================================================
+//                               Parse
+//========================================================================
+static void Parse(tBrpt *b, const sttp_subpacket *s)
+  {
+  const char *p = (const char *)s->data;
+  const char *end = p + s->len;
+  while(p < end)
+    {
+    const char *nl = (const char *)memchr(p,'\n',end-p);
+    const char *stop = nl ? nl : end;
+    if(b->line.empty())
+      {
+      b->RT = s->rt;
+      b->TS = s->ts;
+      }
+    if(!b->skip)
+      {
+      if(b->line.size() + (stop-p) > MAXLINE)
+        {
+        b->line.clear();
+        b->skip = true;
+        }
+      else
+        b->line.append(p,stop-p);
+      }
+    if(!nl)
+      break;
+    EndLine(b);
+    p = nl + 1;
+    }
+  }
+
+//========================================================================
+//                        Plugin interface
+//========================================================================
+STTP_EXPORT int sttp_plugin_init(sttp_plugin_info *info, void **ctx)
+  {
+  if(info->abi != STTP_PLUGIN_ABI)
+    {
+    info->abi = STTP_PLUGIN_ABI;
+    return(0);
+    }
+  info->ts_format = "%Y-%m-%d,%H:%M:%S.";
+  info->suppress_msec = 0;
+
+  std::string path = std::string(info->archive_path) + info->archive_name + "_brpt.csv";
+  FILE *f = fopen(path.c_str(),"w");
+  if(!f)
+    {
+    fprintf(stderr,"brpt plugin: unable to open %s\n",path.c_str());
+    return(1);
+    }
+  setvbuf(f,NULL,_IOFBF,256*1024);
+  fprintf(f,"RunTime,Date,Time,TSYS,TBAR,PBAR\n");
+
+  tBrpt *b = new tBrpt;
+  b->f = f;
+  b->skip = false;
+  b->RT = 0;
+  *ctx = b;
+  return(0);
+  }
+
+STTP_EXPORT int sttp_plugin_parse_batch(void *ctx, const sttp_subpacket *subs, size_t n)
+  {
+  tBrpt *b = (tBrpt *)ctx;
+  for(size_t i=0; i<n; ++i)
+    Parse(b,&subs[i]);
+  return(0);
+  }
+
+STTP_EXPORT int sttp_plugin_finish(void *ctx)
+  {
+  //As in brpt.lua, which has no end of data call, a last line without a
+  //newline is dropped.
+  tBrpt *b = (tBrpt *)ctx;
+  int ret = fclose(b->f) ? 1 : 0;
+  delete b;
+  return(ret);
+  }
@@ -0,0 +1,51 @@
+--External Slerj Time Tagged Parser (STTP) Lua script for the comma
+--separated lines of a BRPT logger (system temperature, barometer
+--temperature and pressure) captured in a SSR-1 time tagged archive.  This
+--is the Lua equivalent of the brpt plugin, for comparison with it (see
+--readme.txt).  Writes <archive>_brpt.csv with the SSR runtime and
+--timestamp of the first byte of each well formed line followed by the
+--line.
+
+sttp_setTSFormat("%Y-%m-%d,%H:%M:%S.",false)
+paths=sttp_getPaths()
+
+local f = assert(io.open(paths.ArchivePath..paths.ArchiveName.."_brpt.csv","w"))
+f:write("RunTime,Date,Time,TSYS,TBAR,PBAR\n")
+
+local MAXLINE = 256     --longer lines are dropped
+local line = ""         --line received so far
+local skip = false      --dropping an over long line up to its newline
+local RT, TS            --SSR runtime and timestamp of the line's first byte
+
+--A line is three non-empty fields of digits, '.' and '-'.
+local function EndLine()
+  if line:byte(-1) == 13 then line = line:sub(1,-2) end
+  if not skip and line:find("^[%d%.%-]+,[%d%.%-]+,[%d%.%-]+$") then
+    f:write(string.format("%.3f,%s,%s\n",RT,TS,line))
+  end
+  line = ""
+  skip = false
+end
+
+function ParseData(runtime, timestamp, buf)
+  local i = 1
+  while i <= #buf do
+    local nl = buf:find("\n",i,true)
+    local stop = nl and nl-1 or #buf
+    if #line == 0 then
+      RT = runtime
+      TS = timestamp
+    end
+    if not skip then
+      if #line + stop-i+1 > MAXLINE then
+        line = ""
+        skip = true
+      else
+        line = line..buf:sub(i,stop)
+      end
+    end
+    if not nl then break end
+    EndLine()
+    i = nl+1
+  end
+end
@@ -0,0 +1,231 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+//sttp parser plugin for MicroStrain 3DM-GX5-25 MIP packet data captured in
+//a SSR-1 time tagged archive.  This is the native equivalent of the Lua
+//example mip.lua and writes the same <archive>_mip.txt file: a line with
+//the SSR runtime, SSR timestamp, GPS time and Euler angles for each packet
+//of Euler angles and GPS time, a hex dump of the fields of any other 0x80
+//packet.  See sttp_plugin.h for the plugin interface.
+//
+//  g++ -O2 -shared -I ../../source -o mip.dll mip.cpp
+//  sttp -X mip.dll archive.dat
+
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include "sttp_plugin.h"
+
+//Parser state, kept across subpackets and batches since a MIP packet can
+//span several of them.
+typedef struct
+  {
+  FILE *f;                    //output file
+  int state;                  //parsing state machine state (see Parse)
+  unsigned char descriptor;   //descriptor of the MIP packet being parsed
+  int paylen;                 //payload bytes still expected
+  unsigned char payload[256]; //payload of the MIP packet as it is received
+  int n;                      //payload bytes received
+  unsigned char cksum1;       //first checksum byte received
+  double RT;                  //SSR runtime during this MIP packet
+  const char *TS;             //SSR timestamp during this MIP packet
+  } tMip;
+
+//========================================================================
+//                          Big endian fields
+//========================================================================
+static unsigned short GetU16(const unsigned char *p)
+  {
+  return((p[0]<<8) | p[1]);
+  }
+
+static float GetFloat(const unsigned char *p)
+  {
+  unsigned long u = ((unsigned long)p[0]<<24) | (p[1]<<16) | (p[2]<<8) | p[3];
+  unsigned int u32 = (unsigned int)u;
+  float f;
+  memcpy(&f,&u32,4);
+  return(f);
+  }
+
+static double GetDouble(const unsigned char *p)
+  {
+  unsigned long long u = 0;
+  for(int i=0; i<8; ++i)
+    u = (u<<8) | p[i];
+  double d;
+  memcpy(&d,&u,8);
+  return(d);
+  }
+
+//========================================================================
+//                          ParsePayload
+//========================================================================
+//Called with each MIP packet whose checksum is valid.  Packets of Euler
+//angles (field 0x0C) and GPS time (field 0x12) give a line of values, any
+//other 0x80 packet a hex dump of its fields.
+static void ParsePayload(tMip *m)
+  {
+  //Only packets with descriptor 0x80 are of interest.
+  if(m->descriptor != 0x80)
+    return;
+
+  const unsigned char *p = m->payload;
+  const double deg = 180.0/3.141592653589793238462643383279502884;
+  if(m->n >= 28 && p[0] == 0x0E && p[1] == 0x0C && p[14] == 0x0E && p[15] == 0x12)
+    {
+    float r = GetFloat(p+2), pitch = GetFloat(p+6), y = GetFloat(p+10);
+    fprintf(m->f,"%.3f,%s,",m->RT,m->TS);
+    fprintf(m->f,"%d,%.3f,%04X,",GetU16(p+24),GetDouble(p+16),GetU16(p+26));
+    fprintf(m->f,"%.2f,%.2f,%.2f\n",y*deg,pitch*deg,r*deg);
+    }
+  else
+    {
+    //Not the packet we're looking for.  Write the packet descriptor and
+    //each field's descriptor and data as hex.
+    fprintf(m->f,"%.3f,%s,%02X",m->RT,m->TS,m->descriptor);
+    int i = 0;
+    while(i < m->n)
+      {
+      //each field is [len,descriptor,data]
+      int len = p[i];
+      if(len == 0)
+        break;
+      int end = i + len;
+      if(end > m->n)
+        end = m->n;
+      fprintf(m->f," %02X",i+1 < m->n ? p[i+1] : 0);
+      for(int j=i+2; j<end; ++j)
+        fprintf(m->f,"%02X",p[j]);
+      i += len;
+      }
+    fputc('\n',m->f);
+    }
+  }
+
+//========================================================================
+//                             Parse
+//========================================================================
+//The MIP packet state machine, fed one subpacket at a time.  The runtime
+//and timestamp written with a packet are those of the subpacket holding
+//its checksum, as in mip.lua.
+static void Parse(tMip *m, const sttp_subpacket *s)
+  {
+  m->RT = s->rt;
+  m->TS = s->ts;
+  for(size_t i=0; i<s->len; ++i)
+    {
+    unsigned char b = s->data[i];
+    switch(m->state)
+      {
+      case 0:                     //waiting MIP start char 1 0x75
+        if(b == 0x75)
+          m->state = 1;
+        break;
+      case 1:                     //expect MIP start char 2 0x65
+        m->state = (b == 0x65) ? 2 : 0;
+        break;
+      case 2:                     //expect MIP descriptor byte
+        m->descriptor = b;
+        m->state = 3;
+        break;
+      case 3:                     //expect MIP length byte
+        //(mip.lua never leaves state 4 after a zero length, here it is
+        //taken as an empty payload)
+        m->paylen = b;
+        m->n = 0;
+        m->state = b ? 4 : 5;
+        break;
+      case 4:                     //expect 'length' payload bytes
+        m->payload[m->n++] = b;
+        if(--m->paylen == 0)
+          m->state = 5;
+        break;
+      case 5:                     //expect MIP checksum byte 1
+        m->cksum1 = b;
+        m->state = 6;
+        break;
+      case 6:                     //expect MIP checksum byte 2
+        {
+        //Fletcher checksum over the header and payload
+        unsigned char hdr[4] = { 0x75, 0x65, m->descriptor, (unsigned char)m->n };
+        unsigned cs1 = 0, cs2 = 0;
+        for(int j=0; j<4; ++j)
+          { cs1 += hdr[j]; cs2 += cs1; }
+        for(int j=0; j<m->n; ++j)
+          { cs1 += m->payload[j]; cs2 += cs1; }
+        if((cs1&0xFF) == m->cksum1 && (cs2&0xFF) == b)
+          ParsePayload(m);
+        m->state = 0;
+        break;
+        }
+      }
+    }
+  }
+
+//========================================================================
+//                        Plugin interface
+//========================================================================
+STTP_EXPORT int sttp_plugin_init(sttp_plugin_info *info, void **ctx)
+  {
+  if(info->abi != STTP_PLUGIN_ABI)
+    {
+    info->abi = STTP_PLUGIN_ABI;
+    return(0);
+    }
+  info->ts_format = "%Y%m%d,%X.";
+  info->suppress_msec = 0;
+
+  std::string path = std::string(info->archive_path) + info->archive_name + "_mip.txt";
+  FILE *f = fopen(path.c_str(),"w");
+  if(!f)
+    {
+    fprintf(stderr,"mip plugin: unable to open %s\n",path.c_str());
+    return(1);
+    }
+  setvbuf(f,NULL,_IOFBF,256*1024);
+  fprintf(f,"RunTime,Date,Time,GPSWeek,GPSTOW,Flags,yaw(deg),pitch(deg),roll(deg)\n");
+
+  tMip *m = new tMip;
+  memset(m,0,sizeof(tMip));
+  m->f = f;
+  *ctx = m;
+  return(0);
+  }
+
+STTP_EXPORT int sttp_plugin_parse_batch(void *ctx, const sttp_subpacket *subs, size_t n)
+  {
+  tMip *m = (tMip *)ctx;
+  for(size_t i=0; i<n; ++i)
+    Parse(m,&subs[i]);
+  return(0);
+  }
+
+STTP_EXPORT int sttp_plugin_finish(void *ctx)
+  {
+  tMip *m = (tMip *)ctx;
+  int ret = fclose(m->f) ? 1 : 0;
+  delete m;
+  return(ret);
+  }
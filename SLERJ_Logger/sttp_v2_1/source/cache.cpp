@@ -0,0 +1,311 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+
+//Cache of the decoded data stream (--cache).  Finding, checking and
+//timestamping the packets of a large archive takes most of an -x or -X
+//run, so the first run keeps the subpackets in a cache file and later runs
+//on the same archive hand them to the parser straight from it.
+//
+//The file is a key identifying the archive followed by blocks of about
+//1 MB of subpacket data.  Each block is its run table, one tCacheRun per
+//subpacket, then the bytes of all its subpackets end to end.  A block
+//with no runs ends the file.  The timestamp strings aren't stored; they
+//are made from the time of each run, once per second, so -N and -S can
+//change between runs.
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "sttp.h"
+
+#define CACHE_MAGIC "STTPC002"    //002: times per session (power cycles)
+#define CACHE_BLOCK (1024*1024)   //bytes of data per block
+#define CACHE_HASH (1024*1024)    //bytes hashed at each end of the archive
+#define CACHE_PKTEND 0x8000       //msec flag: last subpacket of an A2 packet
+
+typedef struct
+  {
+  char magic[8];
+  unsigned long long size;        //archive size
+  long long mtime;                //archive modification time
+  unsigned int crc;               //CRC-32 of its first and last MB
+  unsigned int interp;            //timestamps: 0 --nointerp, 1 interpolated, 2 --drift-fit
+  } tCacheKey;
+
+typedef struct
+  {
+  long long epoch_ms;             //time of the subpacket, ms since 1970
+  unsigned int rt_sec;            //SSR run time seconds
+  unsigned short msec;            //ms within rt_sec, | CACHE_PKTEND
+  unsigned short len;             //bytes of data
+  } tCacheRun;
+
+static std::string CachePath;     //cache file given with --cache
+static FILE *fpc = NULL;          //cache being read or written
+static bool Writing = false;
+static std::vector<tCacheRun> Runs;   //current block
+static std::string Data;
+static size_t Next = 0;           //reading: next run of the block
+static size_t At = 0;             //reading: where its data starts
+
+//Hour of the last subpacket written, as in plugin.cpp
+static tTCP HourTCP = {0};
+static long long HourMS = 0;
+
+//========================================================================
+//                           ArchiveId
+//========================================================================
+//Identifies the archive by size, modification time and a hash of its ends,
+//enough to tell a copied, replaced or appended file without reading it all.
+//Also used for the clock model (drift.cpp).
+bool ArchiveId(const std::string &archive, unsigned long long *size, long long *mtime,
+               unsigned int *crc)
+  {
+  struct stat st;
+  if(stat(archive.c_str(),&st))
+    return(false);
+  FILE *fp = fopen(archive.c_str(),"rb");
+  if(!fp)
+    return(false);
+  std::vector<unsigned char> buf(2*CACHE_HASH);
+  size_t n = fread(&buf[0],1,CACHE_HASH,fp);
+  if((unsigned long long)st.st_size > 2*CACHE_HASH)
+    fseek(fp,-CACHE_HASH,SEEK_END);
+  n += fread(&buf[n],1,CACHE_HASH,fp);
+  fclose(fp);
+
+  *size = st.st_size;
+  *mtime = st.st_mtime;
+  *crc = Crc32(&buf[0],n);
+  return(true);
+  }
+
+static bool ArchiveKey(const std::string &archive, unsigned int interp, tCacheKey &key)
+  {
+  memset(&key,0,sizeof(key));
+  memcpy(key.magic,CACHE_MAGIC,8);
+  key.interp = interp;
+  return(ArchiveId(archive,&key.size,&key.mtime,&key.crc));
+  }
+
+//========================================================================
+//                           CacheSetup
+//========================================================================
+//Opens the cache file.  If it holds this archive and CanReplay (no output
+//needs more than the subpackets), it is opened for CacheReplay and true is
+//returned.  If it holds another archive or none, it is rewritten during
+//this run.  interp is how the times are made, as in tCacheKey.
+bool CacheSetup(std::string path, std::string archive, unsigned int interp, bool CanReplay)
+  {
+  tCacheKey key, have;
+  if(!ArchiveKey(archive,interp,key))
+    ExitError(1,"Unable to read input file %s\n",archive.c_str());
+  CachePath = path;
+
+  FILE *fp = fopen(path.c_str(),"rb");
+  if(fp)
+    {
+    if(fread(&have,sizeof(have),1,fp) == 1 && !memcmp(&have,&key,sizeof(key)))
+      {
+      if(!CanReplay)
+        {
+        fclose(fp);
+        return(false);
+        }
+      fpc = fp;
+      setvbuf(fpc,0,_IOFBF,1024*1024);
+      return(true);
+      }
+    fclose(fp);
+    }
+
+  //Written under another name and renamed when complete, so a run that
+  //stops early doesn't leave a cache that looks valid.
+  fpc = fopen((path+".tmp").c_str(),"wb");
+  if(!fpc)
+    ExitError(1,"Unable to open cache file %s.tmp\n",path.c_str());
+  setvbuf(fpc,0,_IOFBF,1024*1024);
+  fwrite(&key,sizeof(key),1,fpc);
+  Writing = true;
+  return(false);
+  }
+
+bool CacheWriting()
+  {
+  return(Writing);
+  }
+
+//========================================================================
+//                           WriteBlock
+//========================================================================
+static void WriteBlock()
+  {
+  unsigned int n[2] = {(unsigned int)Runs.size(), (unsigned int)Data.size()};
+  STTP_PROBE3(flush,PROBE_CACHEBLOCK,n[0],n[1]);
+  if(fwrite(n,sizeof(n),1,fpc) != 1 ||
+     (n[0] && fwrite(&Runs[0],sizeof(tCacheRun),n[0],fpc) != n[0]) ||
+     (n[1] && fwrite(Data.c_str(),1,n[1],fpc) != n[1]))
+    ExitError(1,"Unable to write cache file %s.tmp\n",CachePath.c_str());
+  Runs.clear();
+  Data.clear();
+  }
+
+//========================================================================
+//                            CacheAdd
+//========================================================================
+//Adds a subpacket to the cache being written.  tcp is its time.
+void CacheAdd(std::string &subpkt, unsigned long RT_sec, unsigned short msec, tTCP &tcp)
+  {
+  if(tcp.hour != HourTCP.hour || tcp.day != HourTCP.day ||
+     tcp.month != HourTCP.month || tcp.year != HourTCP.year)
+    {
+    HourTCP = tcp;
+    HourTCP.min = HourTCP.sec = HourTCP.msec = 0;
+    HourMS = (long long)floor(TCPEpoch(HourTCP)*1000 + 0.5);
+    }
+  tCacheRun r;
+  r.epoch_ms = HourMS + (tcp.min*60 + tcp.sec)*1000LL + tcp.msec;
+  r.rt_sec = RT_sec;
+  r.msec = msec;
+  r.len = subpkt.length();
+  Runs.push_back(r);
+  Data += subpkt;
+  }
+
+//Marks the end of an A2 packet, where batching parsers get their data.
+void CachePacketEnd()
+  {
+  if(Runs.empty())
+    return;
+  Runs.back().msec |= CACHE_PKTEND;
+  if(Data.size() >= CACHE_BLOCK)
+    WriteBlock();
+  }
+
+//========================================================================
+//                           CacheFinish
+//========================================================================
+//Completes the cache being written, or closes the one read.
+void CacheFinish()
+  {
+  if(!fpc)
+    return;
+  if(Writing)
+    {
+    if(!Runs.empty())
+      WriteBlock();
+    WriteBlock();                 //no runs: end of the file
+    if(fclose(fpc))
+      ExitError(1,"Unable to write cache file %s.tmp\n",CachePath.c_str());
+    remove(CachePath.c_str());
+    if(rename((CachePath+".tmp").c_str(),CachePath.c_str()))
+      ExitError(1,"Unable to rename cache file %s.tmp\n",CachePath.c_str());
+    Writing = false;
+    }
+  else
+    fclose(fpc);
+  fpc = NULL;
+  }
+
+//========================================================================
+//                            ReadBlock
+//========================================================================
+static bool ReadBlock()
+  {
+  unsigned int n[2];
+  if(fread(n,sizeof(n),1,fpc) != 1)
+    ExitError(1,"Cache file %s is truncated\n",CachePath.c_str());
+  if(!n[0])
+    return(false);
+  Runs.resize(n[0]);
+  Data.resize(n[1]);
+  if(fread(&Runs[0],sizeof(tCacheRun),n[0],fpc) != n[0] ||
+     (n[1] && fread(&Data[0],1,n[1],fpc) != n[1]))
+    ExitError(1,"Cache file %s is truncated\n",CachePath.c_str());
+  Next = At = 0;
+  return(true);
+  }
+
+//========================================================================
+//                           CacheReplay
+//========================================================================
+//Hands the cached subpackets to the Lua parser L and/or the plugin, as the
+//archive loop of main does, and writes them to fpr if given.
+void CacheReplay(lua_State *L, FILE *fpr)
+  {
+  std::string subpkt;
+  std::string prefix;             //timestamp without msec, of second Sec
+  long long Sec = -1;
+  tTCP tcp;
+  char buf[8];
+
+  while(ReadBlock())
+    {
+    if(fpr)
+      fwrite(Data.c_str(),1,Data.size(),fpr);
+    if(!L && !PluginLoaded())
+      continue;
+
+    for(Next=0; Next<Runs.size(); ++Next)
+      {
+      tCacheRun &r = Runs[Next];
+      subpkt.assign(Data,At,r.len);
+      At += r.len;
+
+      long long sec = r.epoch_ms/1000;
+      if(sec != Sec)
+        {
+        tcp = EpochTCP((double)sec);
+        prefix = GetLineTimeStamp(tcp,TFormat,true);
+        Sec = sec;
+        }
+      tcp.msec = (unsigned short)(r.epoch_ms - sec*1000);
+      std::string ts = prefix;
+      if(!SuppressMSec)
+        {
+        sprintf(buf,"%03hu",tcp.msec);
+        ts += buf;
+        }
+
+      unsigned short msec = r.msec & ~CACHE_PKTEND;
+      if(L)
+        LuaParse(L,subpkt,r.rt_sec+msec/1000.0L,ts);
+      if(PluginLoaded())
+        PluginAdd(subpkt,r.rt_sec+msec/1000.0L,tcp,ts);
+      if(r.msec & CACHE_PKTEND)
+        {
+        if(L)
+          LuaPacketEnd(L);
+        if(PluginLoaded())
+          PluginPacketEnd();
+        }
+      }
+    }
+  }
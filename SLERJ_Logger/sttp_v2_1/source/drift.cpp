@@ -0,0 +1,401 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+//Clock drift model (--drift, --drift-fit, --drift-model).  Subpackets are
+//tagged with the SSR's free running ms clock (RT), and TCPs pair RT with
+//the RTC.  ScaledDT interpolates between the two TCPs around each
+//subpacket.  Here the whole TCP table of the archive is read first and
+//split into segments at run time resets (power cycles) and RTC steps, and
+//each segment is fitted by least squares with
+//      UTC = UTC0 + a + b*(RT - RT0)
+//where RT0 and UTC0 are of its first TCP.  The drift of RT is 1/b - 1,
+//positive when RT runs fast.
+//
+//--drift writes a report: each TCP with the drift over the interval
+//before it and its residual from the fit, the segments with their fits,
+//and the steps and resets.  --drift-fit timestamps subpackets with the
+//fit of their segment instead of interpolating, which smooths the ms
+//quantization of the TCPs and carries the time across a reset until the
+//next TCP.  --drift-model <file> keeps the TCP table and the fits, keyed to
+//the archive as the cache is, so later runs don't read the archive for
+//them.
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sttp.h"
+
+#define DRIFT_MAGIC "sttp drift model 1"
+#define STEP_MS 1000              //an interval off by more than this
+#define STEP_PPM 1000             //plus this much of its length is a step
+
+enum { SEG_FIRST, SEG_RESET, SEG_STEP };
+
+typedef struct
+  {
+  unsigned long offset;           //of the A3 packet, as GetPacket gives it
+  unsigned long RT;               //ms
+  long long utc;                  //RTC, ms since 1970
+  } tDriftTCP;
+
+typedef struct
+  {
+  size_t first, last;             //its TCPs
+  int start;                      //SEG_FIRST, SEG_RESET or SEG_STEP
+  unsigned long RT0;              //of the first TCP
+  long long utc0;
+  double a, b;                    //UTC = UTC0 + a + b*(RT - RT0), ms
+  } tDriftSeg;
+
+static FILE *fpReport = NULL;     //--drift
+static std::string ModelPath;     //--drift-model
+static bool Fit = false;          //--drift-fit
+static std::vector<tDriftTCP> TCPs;
+static std::vector<tDriftSeg> Segs;
+static std::vector<size_t> TCPSeg; //segment of each TCP
+static long Seen = -1;            //TCPs the decoder has passed, less one
+
+//========================================================================
+//                           DriftSetup
+//========================================================================
+//Return false if we run into a problem, true if good to go.
+bool DriftSetup(std::string report, std::string model, bool fit)
+  {
+  if(report.length())
+    {
+    fpReport = fopen(report.c_str(),"w");
+    if(!fpReport)
+      {
+      fprintf(stderr,"Unable to open drift report file %s\n",report.c_str());
+      return(false);
+      }
+    }
+  ModelPath = model;
+  Fit = fit;
+  return(true);
+  }
+
+bool DriftOn()
+  {
+  return(fpReport || ModelPath.length() || Fit);
+  }
+
+bool DriftFitting()
+  {
+  return(Fit);
+  }
+
+//========================================================================
+//                            Fitting
+//========================================================================
+//Reads the TCP table of the archive.
+static void ReadTCPs(const char *path)
+  {
+  FILE *fp = fopen(path,"rb");
+  if(!fp)
+    ExitError(1,"Unable to open input file %s\n",path);
+  setvbuf(fp,0,_IOFBF,1024*1024);
+  std::string pkt;
+  unsigned long loc;
+  while(!(pkt = GetPacket(fp,&loc,false)).empty())
+    if((unsigned char)pkt[1] == 0xA3)
+      {
+      tTCP tcp = ParseTCP(pkt);
+      tDriftTCP t;
+      t.offset = loc;
+      t.RT = tcp.RT;
+      t.utc = (long long)floor(TCPEpoch(tcp)*1000 + 0.5);
+      TCPs.push_back(t);
+      }
+  fclose(fp);
+  }
+
+//Splits the TCPs into segments at resets and steps and fits each.
+static void FitSegments()
+  {
+  Segs.clear();
+  for(size_t i=0; i<TCPs.size(); ++i)
+    {
+    int start = -1;
+    if(i == 0)
+      start = SEG_FIRST;
+    else if(TCPs[i].RT <= TCPs[i-1].RT)
+      start = SEG_RESET;
+    else
+      {
+      double drt = (double)TCPs[i].RT - TCPs[i-1].RT;
+      double dutc = (double)(TCPs[i].utc - TCPs[i-1].utc);
+      if(dutc <= 0 || fabs(drt - dutc) > STEP_MS + dutc*STEP_PPM/1e6)
+        start = SEG_STEP;
+      }
+    if(start >= 0)
+      {
+      tDriftSeg s = {i,i,start,TCPs[i].RT,TCPs[i].utc,0,1};
+      Segs.push_back(s);
+      }
+    Segs.back().last = i;
+    }
+
+  //Least squares about the means, in ms from the first TCP.
+  for(size_t k=0; k<Segs.size(); ++k)
+    {
+    tDriftSeg &s = Segs[k];
+    size_t n = s.last - s.first + 1;
+    if(n < 2)
+      continue;
+    double mx = 0, my = 0;
+    for(size_t i=s.first; i<=s.last; ++i)
+      {
+      mx += (double)TCPs[i].RT - s.RT0;
+      my += (double)(TCPs[i].utc - s.utc0);
+      }
+    mx /= n;
+    my /= n;
+    double sxx = 0, sxy = 0;
+    for(size_t i=s.first; i<=s.last; ++i)
+      {
+      double x = (double)TCPs[i].RT - s.RT0 - mx;
+      double y = (double)(TCPs[i].utc - s.utc0) - my;
+      sxx += x*x;
+      sxy += x*y;
+      }
+    s.b = sxy/sxx;
+    s.a = my - s.b*mx;
+    }
+  }
+
+static void MapTCPs()
+  {
+  TCPSeg.assign(TCPs.size(),0);
+  for(size_t k=0; k<Segs.size(); ++k)
+    for(size_t i=Segs[k].first; i<=Segs[k].last; ++i)
+      TCPSeg[i] = k;
+  }
+
+static double Residual(size_t i)
+  {
+  tDriftSeg &s = Segs[TCPSeg[i]];
+  return((double)(TCPs[i].utc - s.utc0) - (s.a + s.b*((double)TCPs[i].RT - s.RT0)));
+  }
+
+//========================================================================
+//                           Model file
+//========================================================================
+static std::string KeyLine(const char *path)
+  {
+  unsigned long long size;
+  long long mtime;
+  unsigned int crc;
+  if(!ArchiveId(path,&size,&mtime,&crc))
+    ExitError(1,"Unable to read input file %s\n",path);
+  char buf[100];
+  sprintf(buf,"archive %llu %lld %08x",size,mtime,crc);
+  return(std::string(buf));
+  }
+
+//Loads the model kept for the archive, if it is for this one.
+static bool LoadModel(const std::string &key)
+  {
+  FILE *fp = fopen(ModelPath.c_str(),"r");
+  if(!fp)
+    return(false);
+  char line[200];
+  bool ok = fgets(line,sizeof(line),fp) && !strncmp(line,DRIFT_MAGIC,strlen(DRIFT_MAGIC)) &&
+            fgets(line,sizeof(line),fp) && !strncmp(line,key.c_str(),key.length());
+  while(ok && fgets(line,sizeof(line),fp))
+    {
+    tDriftTCP t;
+    tDriftSeg s;
+    unsigned long long first, last;
+    if(sscanf(line,"tcp %lu %lu %lld",&t.offset,&t.RT,&t.utc) == 3)
+      TCPs.push_back(t);
+    else if(sscanf(line,"segment %llu %llu %d %lu %lld %lf %lf",&first,&last,&s.start,
+                   &s.RT0,&s.utc0,&s.a,&s.b) == 7)
+      {
+      s.first = first;
+      s.last = last;
+      ok = (first <= last) && (last < TCPs.size());
+      Segs.push_back(s);
+      }
+    else
+      ok = false;
+    }
+  fclose(fp);
+  if(!ok)
+    {
+    TCPs.clear();
+    Segs.clear();
+    }
+  return(ok);
+  }
+
+static void SaveModel(const std::string &key)
+  {
+  FILE *fp = fopen(ModelPath.c_str(),"w");
+  if(!fp)
+    ExitError(1,"Unable to write drift model file %s\n",ModelPath.c_str());
+  fprintf(fp,"%s\n%s\n",DRIFT_MAGIC,key.c_str());
+  for(size_t i=0; i<TCPs.size(); ++i)
+    fprintf(fp,"tcp %lu %lu %lld\n",TCPs[i].offset,TCPs[i].RT,TCPs[i].utc);
+  for(size_t k=0; k<Segs.size(); ++k)
+    fprintf(fp,"segment %llu %llu %d %lu %lld %.6f %.12f\n",(unsigned long long)Segs[k].first,
+            (unsigned long long)Segs[k].last,Segs[k].start,Segs[k].RT0,Segs[k].utc0,
+            Segs[k].a,Segs[k].b);
+  fclose(fp);
+  }
+
+//========================================================================
+//                             Report
+//========================================================================
+static std::string UTCText(long long ms)
+  {
+  tTCP t = EpochTCP(ms/1000.0);
+  char buf[40];
+  sprintf(buf,"%04hu-%02hu-%02hu %02hu:%02hu:%02hu.%03hu",t.year,t.month,t.day,
+          t.hour,t.min,t.sec,t.msec);
+  return(std::string(buf));
+  }
+
+static void Report(const char *path)
+  {
+  FILE *fp = fpReport;
+  fprintf(fp,"Clock drift of %s: %lu TCPs, %lu segment%s\n",path,(unsigned long)TCPs.size(),
+          (unsigned long)Segs.size(),Segs.size() == 1 ? "" : "s");
+
+  //TCP table
+  fprintf(fp,"%5s %10s %10s %-23s %12s %12s %4s\n","TCP","offset","RT_ms","UTC",
+          "interval_ppm","residual_ms","seg");
+  for(size_t i=0; i<TCPs.size(); ++i)
+    {
+    char ppm[20] = "-";
+    if(i && TCPSeg[i] == TCPSeg[i-1])
+      {
+      double dutc = (double)(TCPs[i].utc - TCPs[i-1].utc);
+      sprintf(ppm,"%.1f",((double)TCPs[i].RT - TCPs[i-1].RT - dutc)/dutc*1e6);
+      }
+    fprintf(fp,"%5lu %10lu %10lu %-23s %12s %12.2f %4lu\n",(unsigned long)i,TCPs[i].offset,
+            TCPs[i].RT,UTCText(TCPs[i].utc).c_str(),ppm,Residual(i),(unsigned long)TCPSeg[i]+1);
+    }
+
+  //Segment fits
+  fprintf(fp,"Segments, UTC = UTC0 + a + b*(RT - RT0) in ms:\n");
+  fprintf(fp,"%4s %11s %10s %-23s %9s %14s %10s %8s %8s\n","seg","TCPs","RT0","UTC0","a",
+          "b","drift_ppm","rms_ms","max_ms");
+  for(size_t k=0; k<Segs.size(); ++k)
+    {
+    tDriftSeg &s = Segs[k];
+    double ss = 0, mx = 0;
+    for(size_t i=s.first; i<=s.last; ++i)
+      {
+      double r = Residual(i);
+      ss += r*r;
+      mx = std::max(mx,fabs(r));
+      }
+    char tcps[30];
+    sprintf(tcps,"%lu-%lu",(unsigned long)s.first,(unsigned long)s.last);
+    fprintf(fp,"%4lu %11s %10lu %-23s %9.2f %14.10f %10.2f %8.2f %8.2f\n",(unsigned long)k+1,
+            tcps,s.RT0,UTCText(s.utc0).c_str(),s.a,s.b,(1/s.b - 1)*1e6,
+            sqrt(ss/(s.last - s.first + 1)),mx);
+    }
+
+  //Where the segments start
+  fprintf(fp,"Steps and resets:\n");
+  bool any = false;
+  for(size_t k=1; k<Segs.size(); ++k)
+    {
+    size_t i = Segs[k].first;
+    any = true;
+    if(Segs[k].start == SEG_RESET)
+      fprintf(fp,"  TCP %lu at %lu: run time reset, %lu ms to %lu ms\n",(unsigned long)i,
+              TCPs[i].offset,TCPs[i-1].RT,TCPs[i].RT);
+    else
+      fprintf(fp,"  TCP %lu at %lu: RTC step of %.3f s\n",(unsigned long)i,TCPs[i].offset,
+              ((double)(TCPs[i].utc - TCPs[i-1].utc) - ((double)TCPs[i].RT - TCPs[i-1].RT))/1000);
+    }
+  if(!any)
+    fprintf(fp,"  none\n");
+  fprintf(fp,"\n");
+  }
+
+//========================================================================
+//                           DriftArchive
+//========================================================================
+//Builds or loads the model of the archive at path before it is decoded,
+//and reports it.
+void DriftArchive(const char *path)
+  {
+  TCPs.clear();
+  Segs.clear();
+  Seen = -1;
+  std::string key;
+  if(ModelPath.length())
+    key = KeyLine(path);
+  if(!ModelPath.length() || !LoadModel(key))
+    {
+    ReadTCPs(path);
+    FitSegments();
+    if(ModelPath.length())
+      SaveModel(key);
+    }
+  MapTCPs();
+  if(Fit && TCPs.empty())
+    ExitError(1,"Error: A TCP was not found in %s\n",path);
+  if(fpReport)
+    Report(path);
+  }
+
+//The decoder passed a TCP.
+void DriftTCP()
+  {
+  ++Seen;
+  }
+
+//========================================================================
+//                            DriftTime
+//========================================================================
+//Time of run time RT (ms) from the fit of the segment of the last TCP.
+//Data from well before that TCP came after a reset, and belongs to the
+//next segment though its first TCP hasn't been reached.
+tTCP DriftTime(unsigned long RT)
+  {
+  size_t i = (Seen < 0) ? 0 : std::min((size_t)Seen,TCPs.size()-1);
+  size_t k = TCPSeg[i];
+  if(Seen >= 0 && RT + 2000 < TCPs[i].RT && k+1 < Segs.size() && Segs[k+1].start == SEG_RESET)
+    ++k;
+  tDriftSeg &s = Segs[k];
+  double ms = s.utc0 + s.a + s.b*((double)RT - s.RT0);
+  tTCP tcp = EpochTCP(ms/1000);
+  tcp.RT = RT;
+  return(tcp);
+  }
+
+void DriftFinish()
+  {
+  if(fpReport)
+    fclose(fpReport);
+  fpReport = NULL;
+  }
@@ -0,0 +1,173 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+//A radix-2 FFT for the spectral stage.  A real sequence of N points is
+//transformed with a complex FFT of N/2 points (even samples as the real
+//part, odd samples as the imaginary part) and then split into the real
+//spectrum.  Real and imaginary parts are kept in separate arrays and each
+//stage has its own contiguous twiddle table, so the butterfly loops run
+//over unit-stride arrays that the compiler can vectorize.
+
+#include <vector>
+#include <math.h>
+#include "sttp.h"
+
+//========================================================================
+//                          tFFT::Setup
+//========================================================================
+//Prepare tables for a real transform of n points (a power of two, >= 4).
+void tFFT::Setup(size_t n)
+  {
+  if(n == N)
+    return;
+  N = n;
+  M = n/2;
+
+  //Bit reversed order of the complex input
+  int bits = 0;
+  while(((size_t)1<<bits) < M)
+    ++bits;
+  Rev.resize(M);
+  for(size_t i=0; i<M; ++i)
+    {
+    size_t r = 0;
+    for(int b=0; b<bits; ++b)
+      if(i & ((size_t)1<<b))
+        r |= (size_t)1<<(bits-1-b);
+    Rev[i] = r;
+    }
+
+  //Twiddles for each stage of half-length h=1,2,4..M/2, stored one stage
+  //after the other: exp(-2*pi*i*j/(2h)) for j=0..h-1.
+  TwRe.clear();
+  TwIm.clear();
+  for(size_t h=1; h<M; h*=2)
+    for(size_t j=0; j<h; ++j)
+      {
+      TwRe.push_back(cos(M_PI*j/h));
+      TwIm.push_back(-sin(M_PI*j/h));
+      }
+
+  //Rotation used to split the half length transform into the real one.
+  RotRe.resize(M+1);
+  RotIm.resize(M+1);
+  for(size_t k=0; k<=M; ++k)
+    {
+    RotRe[k] = cos(2*M_PI*k/N);
+    RotIm[k] = -sin(2*M_PI*k/N);
+    }
+
+  Zr.resize(M);
+  Zi.resize(M);
+  }
+
+//========================================================================
+//                          tFFT::Complex
+//========================================================================
+//In place complex FFT of M points given in bit reversed order.  The
+//inverse is not scaled.
+void tFFT::Complex(double *re, double *im, bool inverse)
+  {
+  double sgn = inverse ? -1 : 1;
+  const double *twr = &TwRe[0];
+  const double *twi = &TwIm[0];
+  for(size_t h=1; h<M; h*=2)
+    {
+    for(size_t b=0; b<M; b+=2*h)
+      {
+      double *ar = re+b, *ai = im+b;
+      double *br = re+b+h, *bi = im+b+h;
+      for(size_t j=0; j<h; ++j)
+        {
+        double wr = twr[j], wi = sgn*twi[j];
+        double tr = br[j]*wr - bi[j]*wi;
+        double ti = br[j]*wi + bi[j]*wr;
+        br[j] = ar[j] - tr;
+        bi[j] = ai[j] - ti;
+        ar[j] += tr;
+        ai[j] += ti;
+        }
+      }
+    twr += h;
+    twi += h;
+    }
+  }
+
+//========================================================================
+//                          tFFT::Forward
+//========================================================================
+//Spectrum of the real sequence x[0..N-1].  re/im receive bins 0..N/2.
+void tFFT::Forward(const double *x, double *re, double *im)
+  {
+  //Pack even/odd samples as one complex sequence, in bit reversed order.
+  for(size_t i=0; i<M; ++i)
+    {
+    Zr[Rev[i]] = x[2*i];
+    Zi[Rev[i]] = x[2*i+1];
+    }
+  Complex(&Zr[0],&Zi[0],false);
+
+  //Separate the transforms of the even (E) and odd (O) samples and
+  //combine them: X[k] = E[k] + exp(-2*pi*i*k/N)*O[k].
+  for(size_t k=0; k<=M; ++k)
+    {
+    size_t k1 = (k == M) ? 0 : k;
+    size_t k2 = (k == 0) ? 0 : M-k;
+    double er = 0.5*(Zr[k1] + Zr[k2]);
+    double ei = 0.5*(Zi[k1] - Zi[k2]);
+    double odr = 0.5*(Zi[k1] + Zi[k2]);
+    double odi = -0.5*(Zr[k1] - Zr[k2]);
+    re[k] = er + RotRe[k]*odr - RotIm[k]*odi;
+    im[k] = ei + RotRe[k]*odi + RotIm[k]*odr;
+    }
+  }
+
+//========================================================================
+//                          tFFT::Inverse
+//========================================================================
+//Real sequence x[0..N-1] from its spectrum bins 0..N/2 (the inverse of
+//Forward, including the 1/N scaling).
+void tFFT::Inverse(const double *re, const double *im, double *x)
+  {
+  //Recover E[k] and O[k] and pack them as Z[k] = E[k] + i*O[k].
+  for(size_t k=0; k<M; ++k)
+    {
+    double er = 0.5*(re[k] + re[M-k]);
+    double ei = 0.5*(im[k] - im[M-k]);
+    double dr = 0.5*(re[k] - re[M-k]);
+    double di = 0.5*(im[k] + im[M-k]);
+    //O[k] = D[k]*exp(+2*pi*i*k/N)
+    double odr = dr*RotRe[k] + di*RotIm[k];
+    double odi = di*RotRe[k] - dr*RotIm[k];
+    Zr[Rev[k]] = er - odi;
+    Zi[Rev[k]] = ei + odr;
+    }
+  Complex(&Zr[0],&Zi[0],true);
+
+  double scale = 1.0/M;
+  for(size_t i=0; i<M; ++i)
+    {
+    x[2*i] = Zr[i]*scale;
+    x[2*i+1] = Zi[i]*scale;
+    }
+  }
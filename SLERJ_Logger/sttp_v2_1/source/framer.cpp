@@ -0,0 +1,380 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+//Framing engine for the instrument data inside the archive.  Subpacket data
+//is appended as it is decoded and complete frames, as described by a
+//tFrameSpec, are handed to tFramer::Frame() along with the run time and
+//timestamp of the subpackets holding their first and last bytes.  Frames
+//may span any number of subpackets.  A candidate that fails its checksum
+//or length check is dropped one byte at a time, so a sync sequence inside
+//bad data never hides a good frame behind it.
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sttp.h"
+
+#define COMPACT_SIZE 65536            //drop consumed bytes past this size
+
+//========================================================================
+//                        Checksums
+//========================================================================
+//Fletcher checksum as used by SSR packets and MIP frames: two 8 bit sums,
+//returned as (sum1<<8)|sum2, stored in that order.
+unsigned short Fletcher16(const unsigned char *p, size_t n)
+  {
+  unsigned char ck0 = 0;
+  unsigned char ck1 = 0;
+  for(size_t i=0; i<n; ++i)
+    {
+    ck0 += p[i];
+    ck1 += ck0;
+    }
+  return((unsigned short)((ck0<<8) | ck1));
+  }
+
+//Lookup tables of the CRCs.  They are made once, by the initializer of a
+//local static, which C++11 runs once even if Lua worker states reach it
+//at the same time.
+typedef struct
+  {
+  unsigned short v[256];
+  } tCrc16Table;
+
+typedef struct
+  {
+  unsigned long v[256];
+  } tCrc32Table;
+
+static tCrc16Table MakeCrc16Table()
+  {
+  tCrc16Table t;
+  for(int i=0; i<256; ++i)
+    {
+    unsigned short c = (unsigned short)(i<<8);
+    for(int k=0; k<8; ++k)
+      c = (c & 0x8000) ? (unsigned short)((c<<1) ^ 0x1021) : (unsigned short)(c<<1);
+    t.v[i] = c;
+    }
+  return(t);
+  }
+
+static tCrc32Table MakeCrc32Table()
+  {
+  tCrc32Table t;
+  for(unsigned long i=0; i<256; ++i)
+    {
+    unsigned long c = i;
+    for(int k=0; k<8; ++k)
+      c = (c & 1) ? (0xEDB88320UL ^ (c>>1)) : (c>>1);
+    t.v[i] = c;
+    }
+  return(t);
+  }
+
+//CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xFFFF.
+unsigned short Crc16(const unsigned char *p, size_t n)
+  {
+  static const tCrc16Table table = MakeCrc16Table();
+  unsigned short crc = 0xFFFF;
+  for(size_t i=0; i<n; ++i)
+    crc = (unsigned short)((crc<<8) ^ table.v[((crc>>8) ^ p[i]) & 0xFF]);
+  return(crc);
+  }
+
+//CRC-32 (IEEE 802.3, as zip/png): reflected polynomial 0xEDB88320.
+unsigned long Crc32(const unsigned char *p, size_t n)
+  {
+  static const tCrc32Table table = MakeCrc32Table();
+  unsigned long crc = 0xFFFFFFFFUL;
+  for(size_t i=0; i<n; ++i)
+    crc = table.v[(crc ^ p[i]) & 0xFF] ^ (crc>>8);
+  return(crc ^ 0xFFFFFFFFUL);
+  }
+
+unsigned char Xor8(const unsigned char *p, size_t n)
+  {
+  unsigned char x = 0;
+  for(size_t i=0; i<n; ++i)
+    x ^= p[i];
+  return(x);
+  }
+
+//Value of a hex digit, -1 if it isn't one.
+static int HexDigit(unsigned char c)
+  {
+  if(c >= '0' && c <= '9') return(c - '0');
+  if(c >= 'A' && c <= 'F') return(c - 'A' + 10);
+  if(c >= 'a' && c <= 'f') return(c - 'a' + 10);
+  return(-1);
+  }
+
+//Validate an NMEA sentence without its line end: the XOR of the bytes
+//between the leading '$' (or '!') and '*' must match the two hex digits
+//that follow the '*'.
+bool NmeaValid(const unsigned char *p, size_t n)
+  {
+  if(n < 4)
+    return(false);
+  const unsigned char *star = (const unsigned char *)memchr(p,'*',n);
+  if(!star || (size_t)(star - p) + 3 != n)
+    return(false);
+  int hi = HexDigit(star[1]);
+  int lo = HexDigit(star[2]);
+  if(hi < 0 || lo < 0)
+    return(false);
+  return(Xor8(p+1,star-p-1) == ((hi<<4) | lo));
+  }
+
+//Unsigned value of n bytes at p.
+static unsigned long GetField(const unsigned char *p, int n, bool big)
+  {
+  unsigned long v = 0;
+  for(int i=0; i<n; ++i)
+    v = (v<<8) | p[big ? i : (n-1-i)];
+  return(v);
+  }
+
+//========================================================================
+//                        tFramer
+//========================================================================
+tFramer::tFramer()
+  {
+  Start = 0;
+  }
+
+//Forget any partial frame, as at the start of a new stretch of data.
+void tFramer::Reset()
+  {
+  Buf.clear();
+  Runs.clear();
+  Start = 0;
+  }
+
+//Check the spec for things that can't work.  Returns an error message, or
+//an empty string if the spec is usable.
+std::string tFramer::Setup(const tFrameSpec &spec)
+  {
+  Spec = spec;
+  bool text = (Spec.cktype == CK_NEWLINE) || (Spec.cktype == CK_NMEA);
+  if(Spec.cktype == CK_NMEA && Spec.sync.empty())
+    Spec.sync = "$";
+  if(!text)
+    {
+    if(Spec.sync.empty())
+      return("binary frames need sync bytes");
+    if(Spec.lensize != 1 && Spec.lensize != 2 && Spec.lensize != 4)
+      return("length field size must be 1, 2 or 4");
+    if(Spec.lenpos < 0)
+      return("binary frames need a length field");
+    if(Spec.ckfrom < 0)
+      return("checksum start must be in the frame");
+    }
+  if(Spec.maxlen < Spec.sync.length() + 1)
+    return("maximum frame length is too short");
+  return("");
+  }
+
+//Bytes of checksum at the end of a binary frame.
+int tFramer::CkSize()
+  {
+  switch(Spec.cktype)
+    {
+    case CK_FLETCHER:
+    case CK_CRC16:  return(2);
+    case CK_CRC32:  return(4);
+    case CK_XOR:    return(1);
+    }
+  return(0);
+  }
+
+//Check a complete binary frame.
+bool tFramer::CkValid(const unsigned char *p, size_t n)
+  {
+  int ck = CkSize();
+  if((size_t)(Spec.ckfrom + ck) > n)
+    return(false);
+  const unsigned char *q = p + Spec.ckfrom;
+  size_t m = n - ck - Spec.ckfrom;
+  switch(Spec.cktype)
+    {
+    case CK_FLETCHER: return(Fletcher16(q,m) == GetField(p+n-2,2,true));
+    case CK_CRC16:    return(Crc16(q,m) == GetField(p+n-2,2,Spec.ckbig));
+    case CK_CRC32:    return(Crc32(q,m) == GetField(p+n-4,4,Spec.ckbig));
+    case CK_XOR:      return(Xor8(q,m) == p[n-1]);
+    }
+  return(true);
+  }
+
+//========================================================================
+//                        tFramer::Add
+//========================================================================
+//Append the data of one subpacket and deliver any frames it completes.
+void tFramer::Add(const char *data, size_t n, double RT, const std::string &TS)
+  {
+  if(!n)
+    return;
+  tRun r;
+  r.off = Buf.length();
+  r.RT = RT;
+  r.TS = TS;
+  Runs.push_back(r);
+  Buf.append(data,n);
+
+  bool text = (Spec.cktype == CK_NEWLINE) || (Spec.cktype == CK_NMEA);
+  size_t sl = Spec.sync.length();
+  while(true)
+    {
+    const unsigned char *b = (const unsigned char *)Buf.data();
+    size_t len = Buf.length();
+
+    //Find the next sync sequence.  Text frames without sync start anywhere.
+    if(sl)
+      {
+      size_t s = Start;
+      while(s + sl <= len)
+        {
+        const unsigned char *p = (const unsigned char *)memchr(b+s,(unsigned char)Spec.sync[0],len-s-sl+1);
+        if(!p)
+          {
+          s = len - sl + 1;
+          break;
+          }
+        s = p - b;
+        if(!memcmp(p,Spec.sync.data(),sl))
+          break;
+        ++s;
+        }
+      if(s + sl > len)
+        {
+        //No sync yet.  Keep only bytes that may start one.
+        size_t keep = (len - Start < sl - 1) ? (len - Start) : (sl - 1);
+        Start = len - keep;
+        break;
+        }
+      Start = s;
+      }
+
+    if(text)
+      {
+      //The frame ends at the next line feed.
+      const unsigned char *nl = (const unsigned char *)memchr(b+Start+sl,'\n',len-Start-sl);
+      if(!nl)
+        {
+        if(len - Start > Spec.maxlen)
+          Start += sl ? 1 : (len - Start - Spec.maxlen);
+        else
+          break;
+        continue;
+        }
+      size_t end = nl - b;
+      size_t flen = end - Start;
+      while(flen && (b[Start+flen-1] == '\r'))
+        --flen;
+      if(!flen || flen > Spec.maxlen ||
+         (Spec.cktype == CK_NMEA && !NmeaValid(b+Start,flen)))
+        {
+        //Empty lines aren't frames.  A bad line is rescanned from the byte
+        //after its sync.
+        if(flen && sl)
+          ++Start;
+        else
+          Start = end + 1;
+        }
+      else
+        {
+        Deliver(Start,flen,end);
+        Start = end + 1;
+        }
+      continue;
+      }
+
+    //Binary frame: wait for the length field, then the whole frame.
+    size_t hdr = Spec.lenpos + Spec.lensize;
+    if(len - Start < hdr)
+      break;
+    size_t flen = GetField(b+Start+Spec.lenpos,Spec.lensize,Spec.lenbig) + Spec.lenadd;
+    if(flen < hdr || flen > Spec.maxlen || flen < sl)
+      {
+      ++Start;
+      continue;
+      }
+    if(len - Start < flen)
+      break;
+    if(!CkValid(b+Start,flen))
+      {
+      ++Start;
+      continue;
+      }
+    Deliver(Start,flen,Start+flen-1);
+    Start += flen;
+    }
+
+  Compact();
+  }
+
+//Hand a frame to Frame() with the times of its first and last bytes.
+void tFramer::Deliver(size_t start, size_t flen, size_t last)
+  {
+  size_t i0 = RunOf(start);
+  size_t i1 = RunOf(last);
+  Frame(Buf.data()+start,flen,Runs[i0].RT,Runs[i0].TS,Runs[i1].RT,Runs[i1].TS);
+  }
+
+//Index of the run holding byte off.
+size_t tFramer::RunOf(size_t off)
+  {
+  size_t lo = 0, hi = Runs.size();
+  while(hi - lo > 1)
+    {
+    size_t mid = (lo + hi)/2;
+    if(Runs[mid].off <= off)
+      lo = mid;
+    else
+      hi = mid;
+    }
+  return(lo);
+  }
+
+//Drop consumed bytes and the runs that only held them.
+void tFramer::Compact()
+  {
+  if(Start == Buf.length())
+    {
+    //Everything is consumed; the common case for small frames.
+    Buf.clear();
+    Runs.clear();
+    Start = 0;
+    return;
+    }
+  if(Start < COMPACT_SIZE)
+    return;
+  size_t first = RunOf(Start);
+  Runs.erase(Runs.begin(),Runs.begin()+first);
+  for(size_t i=0; i<Runs.size(); ++i)
+    Runs[i].off = (Runs[i].off > Start) ? (Runs[i].off - Start) : 0;
+  Buf.erase(0,Start);
+  Start = 0;
+  }
@@ -0,0 +1,369 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+//Archive access from Lua.  sttp.open(path) gives an archive object for
+//scripts that drive the decoding themselves, either -x scripts or plain Lua
+//programs with sttp built as a module (make sttp.dll, then require "sttp"):
+//  archive:tcps()          array of the time correlation packets, each
+//                          {runtime=sec, epoch_ms=, time="Y-m-d H:M:S.ms",
+//                          offset=} (offset as written by sttp -O)
+//  archive:range(t0, t1)   archive object limited to data with times
+//                          t0 <= t < t1, ms since 1970 (nil = open ended)
+//  archive:chunks([n])     iterator over blocks of whole subpackets, about
+//                          n bytes each (default 64 KB), in file order:
+//                            for ms, data, ends in a:chunks() do ... end
+//                          ms[i] is the time (ms since 1970) of subpacket i
+//                          of the block and ends[i] the position of its
+//                          last byte in the string data.
+//Packets are found and checked and subpacket times interpolated between
+//the TCPs by the same code as the sttp command line.  Data before the
+//first TCP has no time and is skipped, as for -n.
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <limits.h>
+#include "luacompat.h"
+#include "sttp.h"
+
+#define ARCHIVE_MT "sttp.archive"
+#define CHUNKS_MT "sttp.chunks"
+#define CHUNK_DEFAULT (64*1024)
+
+typedef struct
+  {
+  std::string path;
+  bool indexed;                   //TCPs have been read
+  std::vector<tTCP> tcps;         //time correlation packets in file order
+  std::vector<unsigned long> offs;    //where each was found (GetPacket loc)
+  std::vector<long long> ms;      //time of each, ms since 1970
+  bool ranged;                    //limited to t0 <= t < t1
+  long long t0, t1;
+  } tArchive;
+
+//State of a chunks() iterator.  It reads the file on its own, so several
+//iterators over one archive don't get in each other's way.
+typedef struct
+  {
+  tArchive *A;
+  FILE *fp;
+  size_t n;                       //bytes per block
+  size_t next;                    //index of the next TCP in the file
+  tTCP PrevTCP, NextTCP;
+  std::vector<tSubPacket> Subs;   //subpackets of the current data packet
+  size_t nsubs, sub;              //how many, and the next one to hand out
+  unsigned long RT_sec;           //run time of the current data packet
+  } tChunks;
+
+static long long EpochMS(tTCP &tcp)
+  {
+  return((long long)floor(TCPEpoch(tcp)*1000 + 0.5));
+  }
+
+static void PushInt(lua_State *L, long long v)
+  {
+#ifdef STTP_LUAJIT
+  lua_pushnumber(L,(lua_Number)v);    //may not fit a 32 bit lua_Integer
+#else
+  lua_pushinteger(L,(lua_Integer)v);
+#endif
+  }
+
+//========================================================================
+//                             Index
+//========================================================================
+//Read the TCPs of the archive, once.
+static void Index(lua_State *L, tArchive *A)
+  {
+  if(A->indexed)
+    return;
+  FILE *fp = fopen(A->path.c_str(),"rb");
+  if(!fp)
+    luaL_error(L,"unable to open archive %s",A->path.c_str());
+  setvbuf(fp,0,_IOFBF,1024*1024);
+  unsigned long loc;
+  for(;;)
+    {
+    std::string pkt = GetPacket(fp,&loc);
+    if(pkt.empty())
+      break;
+    if(((unsigned char)pkt[1]) == 0xA3)
+      {
+      tTCP tcp = ParseTCP(pkt);
+      A->tcps.push_back(tcp);
+      A->offs.push_back(loc);
+      A->ms.push_back(EpochMS(tcp));
+      }
+    }
+  fclose(fp);
+  A->indexed = true;
+  }
+
+static tArchive *checkarchive(lua_State *L)
+  {
+  return(*(tArchive **)luaL_checkudata(L,1,ARCHIVE_MT));
+  }
+
+static tArchive *NewArchive(lua_State *L)
+  {
+  tArchive **pa = (tArchive **)lua_newuserdata(L,sizeof(tArchive *));
+  *pa = new tArchive;
+  (*pa)->indexed = false;
+  (*pa)->ranged = false;
+  (*pa)->t0 = (*pa)->t1 = 0;
+  luaL_setmetatable(L,ARCHIVE_MT);
+  return(*pa);
+  }
+
+//========================================================================
+//                          Archive methods
+//========================================================================
+//sttp.open(path) returns the archive object, or nil and a message if the
+//file can't be opened.
+int LuaArchiveOpen(lua_State *L)
+  {
+  const char *path = luaL_checkstring(L,1);
+  FILE *fp = fopen(path,"rb");
+  if(!fp)
+    return(luaL_fileresult(L,0,path));
+  fclose(fp);
+  tArchive *A = NewArchive(L);
+  A->path = path;
+  return(1);
+  }
+
+static int a_tcps(lua_State *L)
+  {
+  tArchive *A = checkarchive(L);
+  Index(L,A);
+  lua_createtable(L,(int)A->tcps.size(),0);
+  for(size_t i=0; i<A->tcps.size(); ++i)
+    {
+    tTCP &t = A->tcps[i];
+    char buf[64];
+    lua_createtable(L,0,4);
+    lua_pushnumber(L,t.RT/1000.0);
+    lua_setfield(L,-2,"runtime");
+    PushInt(L,A->ms[i]);
+    lua_setfield(L,-2,"epoch_ms");
+    snprintf(buf,sizeof(buf),"%04hu-%02hu-%02hu %02hu:%02hu:%02hu.%03hu",
+             t.year,t.month,t.day,t.hour,t.min,t.sec,t.msec);
+    lua_pushstring(L,buf);
+    lua_setfield(L,-2,"time");
+    PushInt(L,A->offs[i]);
+    lua_setfield(L,-2,"offset");
+    lua_rawseti(L,-2,(int)i+1);
+    }
+  return(1);
+  }
+
+static int a_range(lua_State *L)
+  {
+  tArchive *A = checkarchive(L);
+  long long t0 = lua_isnoneornil(L,2) ? LLONG_MIN : (long long)luaL_checknumber(L,2);
+  long long t1 = lua_isnoneornil(L,3) ? LLONG_MAX : (long long)luaL_checknumber(L,3);
+  if(A->ranged)
+    {
+    if(A->t0 > t0) t0 = A->t0;
+    if(A->t1 < t1) t1 = A->t1;
+    }
+  Index(L,A);
+  tArchive *R = NewArchive(L);
+  R->path = A->path;
+  R->indexed = true;
+  R->tcps = A->tcps;
+  R->offs = A->offs;
+  R->ms = A->ms;
+  R->ranged = true;
+  R->t0 = t0;
+  R->t1 = t1;
+  return(1);
+  }
+
+static int a_gc(lua_State *L)
+  {
+  tArchive **pa = (tArchive **)luaL_checkudata(L,1,ARCHIVE_MT);
+  delete *pa;
+  *pa = NULL;
+  return(0);
+  }
+
+static int a_tostring(lua_State *L)
+  {
+  tArchive *A = checkarchive(L);
+  lua_pushfstring(L,"sttp archive (%s)",A->path.c_str());
+  return(1);
+  }
+
+//========================================================================
+//                             Chunks
+//========================================================================
+//A TCP has just been read.  If the data up to the next TCP can't have
+//times in the range, move on to the next TCP directly.  Data between two
+//TCPs is taken to have run times between theirs, as the SSR writes it.
+static bool SkipSegment(tChunks *C, size_t k)
+  {
+  tArchive *A = C->A;
+  if(!A->ranged || k+1 >= A->tcps.size() || A->ms[k+1] < A->ms[k])
+    return(false);
+  if(A->ms[k+1] >= A->t0 && A->ms[k] < A->t1)
+    return(false);
+  fseek(C->fp,A->offs[k+1]-1,SEEK_SET);
+  return(true);
+  }
+
+//Get the next subpacket into the iterator, false at the end of the file.
+static bool NextSub(tChunks *C)
+  {
+  tArchive *A = C->A;
+  while(C->sub >= C->nsubs)
+    {
+    unsigned long loc;
+    std::string pkt = GetPacket(C->fp,&loc);
+    if(pkt.empty())
+      return(false);
+    if(((unsigned char)pkt[1]) == 0xA3)
+      {
+      //The TCPs were all indexed, so the index of this one is known.
+      size_t k = C->next++;
+      C->PrevTCP = ParseTCP(pkt);
+      memset(&C->NextTCP,0,sizeof(tTCP));
+      if(k+1 < A->tcps.size())
+        C->NextTCP = A->tcps[k+1];
+      if(SkipSegment(C,k))
+        C->nsubs = C->sub = 0;
+      }
+    else if(((unsigned char)pkt[1]) == 0xA2 && C->PrevTCP.RT)
+      {
+      C->nsubs = GetSubPackets(pkt,&C->RT_sec,C->Subs);
+      C->sub = 0;
+      }
+    }
+  return(true);
+  }
+
+static int c_next(lua_State *L)
+  {
+  tChunks *C = *(tChunks **)luaL_checkudata(L,lua_upvalueindex(2),CHUNKS_MT);
+  std::string data;
+  lua_newtable(L);                //ms
+  lua_newtable(L);                //ends
+  int i = 0;
+  while(data.length() < C->n && C->fp)
+    {
+    if(!NextSub(C))
+      {
+      fclose(C->fp);
+      C->fp = NULL;
+      break;
+      }
+    tSubPacket &s = C->Subs[C->sub++];
+    tTCP tcp = GetSubPacketTime(C->PrevTCP,C->NextTCP,C->RT_sec,s.msec);
+    long long ms = EpochMS(tcp);
+    if(C->A->ranged && (ms < C->A->t0 || ms >= C->A->t1))
+      continue;
+    data += s.data;
+    ++i;
+    PushInt(L,ms);
+    lua_rawseti(L,-3,i);
+    PushInt(L,(long long)data.length());
+    lua_rawseti(L,-2,i);
+    }
+  if(!i)
+    return(0);
+  lua_pushlstring(L,data.c_str(),data.length());
+  lua_insert(L,-2);
+  return(3);
+  }
+
+static int c_gc(lua_State *L)
+  {
+  tChunks **pc = (tChunks **)luaL_checkudata(L,1,CHUNKS_MT);
+  if(*pc && (*pc)->fp)
+    fclose((*pc)->fp);
+  delete *pc;
+  *pc = NULL;
+  return(0);
+  }
+
+static int a_chunks(lua_State *L)
+  {
+  tArchive *A = checkarchive(L);
+  lua_Integer n = luaL_optinteger(L,2,CHUNK_DEFAULT);
+  luaL_argcheck(L,n > 0,2,"block size must be positive");
+  Index(L,A);
+
+  lua_settop(L,1);                //upvalue 1: keeps the archive alive
+  tChunks **pc = (tChunks **)lua_newuserdata(L,sizeof(tChunks *));
+  *pc = NULL;
+  luaL_setmetatable(L,CHUNKS_MT);
+  tChunks *C = new tChunks;
+  *pc = C;
+  C->A = A;
+  C->n = (size_t)n;
+  C->next = 0;
+  memset(&C->PrevTCP,0,sizeof(tTCP));
+  memset(&C->NextTCP,0,sizeof(tTCP));
+  C->nsubs = C->sub = 0;
+  C->RT_sec = 0;
+  C->fp = fopen(A->path.c_str(),"rb");
+  if(!C->fp)
+    return(luaL_error(L,"unable to open archive %s",A->path.c_str()));
+  setvbuf(C->fp,0,_IOFBF,1024*1024);
+  lua_pushcclosure(L,c_next,2);
+  return(1);
+  }
+
+static const luaL_Reg ArchiveMethods[] =
+  {
+  {"tcps", a_tcps},
+  {"range", a_range},
+  {"chunks", a_chunks},
+  {NULL, NULL}
+  };
+
+//========================================================================
+//                          LuaArchiveSetup
+//========================================================================
+//Install the metatables of archives and their iterators.
+void LuaArchiveSetup(lua_State *L)
+  {
+  luaL_newmetatable(L,ARCHIVE_MT);
+  luaL_newlib(L,ArchiveMethods);
+  lua_setfield(L,-2,"__index");
+  lua_pushcfunction(L,a_gc);
+  lua_setfield(L,-2,"__gc");
+  lua_pushcfunction(L,a_tostring);
+  lua_setfield(L,-2,"__tostring");
+  lua_pop(L,1);
+
+  luaL_newmetatable(L,CHUNKS_MT);
+  lua_pushcfunction(L,c_gc);
+  lua_setfield(L,-2,"__gc");
+  lua_pop(L,1);
+  }
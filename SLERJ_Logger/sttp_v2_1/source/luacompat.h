@@ -0,0 +1,96 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+//The Lua engine behind -x.  sttp is normally built with the bundled Lua 5.3
+//(liblua.a).  Built with STTP_LUAJIT (make LUA=luajit LUAJIT=<LuaJIT src>)
+//it uses LuaJIT 2.1 instead, whose API is that of Lua 5.1; the few Lua 5.3
+//API functions sttp relies on are filled in below.
+
+#ifndef __LUACOMPAT_H__
+#define __LUACOMPAT_H__
+
+#ifdef STTP_LUAJIT
+
+//LuaJIT's lua.hpp, found ahead of the bundled headers by the include path.
+#include <lua.hpp>
+
+//All LuaJIT numbers are doubles.  One holding an integral value counts as
+//an integer.
+inline int lua_isinteger(lua_State *L, int idx)
+  {
+  if(lua_type(L,idx) != LUA_TNUMBER)
+    return(0);
+  lua_Number n = lua_tonumber(L,idx);
+  return(n == (lua_Number)(lua_Integer)n);
+  }
+
+inline void luaL_requiref(lua_State *L, const char *name, lua_CFunction open, int glb)
+  {
+  lua_pushcfunction(L,open);
+  lua_pushstring(L,name);
+  lua_call(L,1,1);
+  lua_getfield(L,LUA_REGISTRYINDEX,"_LOADED");
+  lua_pushvalue(L,-2);
+  lua_setfield(L,-2,name);
+  lua_pop(L,1);
+  if(glb)
+    {
+    lua_pushvalue(L,-1);
+    lua_setglobal(L,name);
+    }
+  }
+
+//tostring() of a value, pushed on the stack.
+inline const char *luaL_tolstring(lua_State *L, int idx, size_t *len)
+  {
+  if(idx < 0 && idx > LUA_REGISTRYINDEX)
+    idx = lua_gettop(L) + idx + 1;
+  lua_getglobal(L,"tostring");
+  lua_pushvalue(L,idx);
+  lua_call(L,1,1);
+  return(lua_tolstring(L,-1,len));
+  }
+
+//LuaJIT's lua_dump has no strip argument.
+#define lua_dump(L,writer,data,strip) lua_dump(L,writer,data)
+
+#ifndef luaL_newlib
+#define luaL_newlib(L,l) (lua_createtable(L,0,sizeof(l)/sizeof((l)[0]) - 1), luaL_setfuncs(L,l,0))
+#endif
+
+#ifndef LUA_INTEGER_FMT
+#define LUA_INTEGER_FRMLEN "ll"
+#define LUA_INTEGER_FMT "%lld"
+#define LUAI_UACINT long long
+#endif
+#ifndef LUAI_UACNUMBER
+#define LUAI_UACNUMBER double
+#endif
+
+#else
+
+#include "lua.hpp"
+
+#endif
+
+#endif
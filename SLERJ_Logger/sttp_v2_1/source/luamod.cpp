@@ -0,0 +1,786 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+//The sttp Lua module: native helpers for parser scripts, so byte level
+//work (hex dumps, checksums, binary decoding, formatted output) runs in C++
+//instead of Lua loops.  Installed as the global table sttp (also available
+//through require "sttp") in every parser script.
+//  sttp.hex(data [,sep])              upper case hex of the bytes
+//  sttp.fletcher16(data [,i [,j]])    Fletcher (SSR/MIP) as (sum1<<8)|sum2
+//  sttp.crc16(data [,i [,j]])         CRC-16/CCITT-FALSE
+//  sttp.crc32(data [,i [,j]])         CRC-32 (IEEE)
+//  sttp.nmea_checksum(sentence)       XOR between '$' and '*', and whether
+//                                     it matches the sentence's *hh if any
+//  sttp.unpack(fmt, data [,pos [,count [,stride]]])
+//                                     unpack an array of fixed size records,
+//                                     returning one array per field and the
+//                                     position after the last record
+//  sttp.writer(path [,mode])          buffered output file with
+//                                     w:write(...), w:printf(fmt, ...),
+//                                     w:hex(data [,sep]), w:flush(), w:close()
+//  sttp.open(path)                    archive object for reading an SSR
+//                                     archive from Lua, see luaarch.cpp
+//data may be a Lua string or a buffer from sttp_buffers.  i and j select a
+//range as in string.sub.
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "luacompat.h"
+#include "sttp.h"
+
+#define WRITER_MT "sttp.writer"
+#define WRITER_BUFSIZE (256*1024)     //stdio buffer of each writer
+
+static const char HexDigits[] = "0123456789ABCDEF";
+
+//========================================================================
+//                        Unpack
+//========================================================================
+//Size suffix of an unpack option, or def if there is none.
+static int optsize(lua_State *L, const char **fmt, int def)
+  {
+  if(**fmt < '0' || **fmt > '9')
+    return(def);
+  int n = 0;
+  while(**fmt >= '0' && **fmt <= '9')
+    n = n*10 + (*(*fmt)++ - '0');
+  if(n < 1 || n > 16)
+    luaL_error(L,"integral size (%d) out of limits [1,16]",n);
+  return(n);
+  }
+
+//Unsigned integer of n bytes at p.
+static unsigned long long getuint(const unsigned char *p, int n, bool little)
+  {
+  unsigned long long v = 0;
+  for(int i=0; i<n; ++i)
+    v = (v<<8) | p[little ? (n-1-i) : i];
+  return(v);
+  }
+
+//Unpack the values of fmt from the n bytes at data, starting at *at, which
+//is advanced past them.  The values are pushed and their number returned.
+//This is the subset of the string.unpack formats: < > = b B h H i[n] I[n]
+//l L j J T f d n s[n] z x c[n] and spaces.  Alignment (!) is not supported.
+int LuaUnpack(lua_State *L, const char *fmt, const unsigned char *data, size_t n, size_t *pat)
+  {
+  size_t at = *pat;
+  bool little = true;
+  int nres = 0;
+  while(*fmt)
+    {
+    char op = *fmt++;
+    int size = 0;
+    bool issigned = false;
+    switch(op)
+      {
+      case ' ': continue;
+      case '<': case '=': little = true; continue;
+      case '>': little = false; continue;
+      case 'b': size = 1; issigned = true; break;
+      case 'B': size = 1; break;
+      case 'h': size = 2; issigned = true; break;
+      case 'H': size = 2; break;
+      case 'i': size = optsize(L,&fmt,4); issigned = true; break;
+      case 'I': size = optsize(L,&fmt,4); break;
+      case 'l': case 'j': size = 8; issigned = true; break;
+      case 'L': case 'J': case 'T': size = 8; break;
+      case 'f': size = 4; break;
+      case 'd': case 'n': size = 8; break;
+      case 'x': size = 1; break;
+      case 's': size = optsize(L,&fmt,8); break;
+      case 'z': size = 0; break;
+      case 'c':
+        size = -1;
+        if(*fmt >= '0' && *fmt <= '9')
+          {
+          size = 0;
+          while(*fmt >= '0' && *fmt <= '9')
+            size = size*10 + (*fmt++ - '0');
+          }
+        if(size < 0)
+          luaL_error(L,"missing size for format option 'c'");
+        break;
+      default:
+        return(luaL_error(L,"invalid format option '%c'",op));
+      }
+    if(size > (int)(n - at))
+      luaL_error(L,"data string too short");
+    luaL_checkstack(L,2,"too many results");
+    const unsigned char *p = data + at;
+    switch(op)
+      {
+      case 'x':
+        break;
+      case 'f':
+        {
+        unsigned long long u = getuint(p,4,little);
+        unsigned int u32 = (unsigned int)u;
+        float f;
+        memcpy(&f,&u32,4);
+        lua_pushnumber(L,(lua_Number)f);
+        ++nres;
+        break;
+        }
+      case 'd': case 'n':
+        {
+        unsigned long long u = getuint(p,8,little);
+        double d;
+        memcpy(&d,&u,8);
+        lua_pushnumber(L,(lua_Number)d);
+        ++nres;
+        break;
+        }
+      case 'c':
+        lua_pushlstring(L,(const char *)p,size);
+        ++nres;
+        break;
+      case 's':
+        {
+        unsigned long long len = getuint(p,size > 8 ? 8 : size,little);
+        if(len > n - at - size)
+          luaL_error(L,"data string too short");
+        lua_pushlstring(L,(const char *)p+size,(size_t)len);
+        at += (size_t)len;
+        ++nres;
+        break;
+        }
+      case 'z':
+        {
+        //The end of the buffer counts as the terminator, as the hidden
+        //zero at the end of a Lua string does for string.unpack.
+        const unsigned char *e = (const unsigned char *)memchr(p,0,n - at);
+        if(!e)
+          e = data + n;
+        lua_pushlstring(L,(const char *)p,e-p);
+        at += (e-p) + 1;
+        ++nres;
+        break;
+        }
+      default:
+        {
+        int m = size > 8 ? 8 : size;
+        unsigned long long u = getuint(little ? p : p + (size-m),m,little);
+        bool neg = issigned && (u >> (8*m-1));
+        if(neg && m < 8)
+          u |= ~0ULL << (8*m);
+        for(int k=8; k<size; ++k)
+          if(p[little ? k : size-1-k] != (neg ? 0xFF : 0))
+            luaL_error(L,"%d-byte integer does not fit into Lua Integer",size);
+#ifdef STTP_LUAJIT
+        //LuaJIT integers are doubles and lua_Integer may be 32 bits.
+        lua_pushnumber(L,issigned ? (lua_Number)(long long)u : (lua_Number)u);
+#else
+        lua_pushinteger(L,(lua_Integer)u);
+#endif
+        ++nres;
+        break;
+        }
+      }
+    at += size;
+    }
+  *pat = at;
+  return(nres);
+  }
+
+//Bytes of a string or buffer argument, for functions that take either.
+const unsigned char *LuaCheckBytes(lua_State *L, int arg, size_t *n)
+  {
+  tBuffer *b = (tBuffer *)luaL_testudata(L,arg,BUFFER_MT);
+  if(b)
+    {
+    if(!b->p)
+      luaL_error(L,"buffer used outside of the parser call");
+    *n = b->n;
+    return(b->p);
+    }
+  return((const unsigned char *)luaL_checklstring(L,arg,n));
+  }
+
+
+//Bytes arg..arg+2 as (data [,i [,j]]), range selected as in string.sub.
+static const unsigned char *CheckRange(lua_State *L, int arg, size_t *n)
+  {
+  size_t len;
+  const unsigned char *p = LuaCheckBytes(L,arg,&len);
+  lua_Integer i = luaL_optinteger(L,arg+1,1);
+  lua_Integer j = luaL_optinteger(L,arg+2,-1);
+  if(i < 0) i = ((size_t)-i > len) ? 1 : (lua_Integer)len + i + 1;
+  if(j < 0) j = (lua_Integer)len + j + 1;
+  if(i < 1) i = 1;
+  if(j > (lua_Integer)len) j = (lua_Integer)len;
+  *n = (i > j) ? 0 : (size_t)(j - i + 1);
+  return(p + i - 1);
+  }
+
+//Hex of n bytes into out (2 or 2+|sep| chars per byte).
+static char *PutHex(char *out, const unsigned char *p, size_t n, const char *sep, size_t ls)
+  {
+  for(size_t i=0; i<n; ++i)
+    {
+    if(i && ls)
+      {
+      memcpy(out,sep,ls);
+      out += ls;
+      }
+    *out++ = HexDigits[p[i]>>4];
+    *out++ = HexDigits[p[i]&0xF];
+    }
+  return(out);
+  }
+
+//========================================================================
+//                        Module functions
+//========================================================================
+static int sttp_hex(lua_State *L)
+  {
+  size_t n, ls = 0;
+  const unsigned char *p = LuaCheckBytes(L,1,&n);
+  const char *sep = luaL_optlstring(L,2,"",&ls);
+  size_t len = n ? n*(2+ls)-ls : 0;
+  char *out = (char *)lua_newuserdata(L,len ? len : 1);     //scratch
+  lua_pushlstring(L,out,PutHex(out,p,n,sep,ls) - out);
+  return(1);
+  }
+
+static int sttp_fletcher16(lua_State *L)
+  {
+  size_t n;
+  const unsigned char *p = CheckRange(L,1,&n);
+  lua_pushinteger(L,Fletcher16(p,n));
+  return(1);
+  }
+
+static int sttp_crc16(lua_State *L)
+  {
+  size_t n;
+  const unsigned char *p = CheckRange(L,1,&n);
+  lua_pushinteger(L,Crc16(p,n));
+  return(1);
+  }
+
+static int sttp_crc32(lua_State *L)
+  {
+  size_t n;
+  const unsigned char *p = CheckRange(L,1,&n);
+#ifdef STTP_LUAJIT
+  lua_pushnumber(L,(lua_Number)Crc32(p,n));   //may not fit a 32 bit lua_Integer
+#else
+  lua_pushinteger(L,(lua_Integer)Crc32(p,n));
+#endif
+  return(1);
+  }
+
+//Returns the checksum, and a boolean for whether the sentence carries a
+//matching *hh (nil if it carries none).  Line end characters are ignored.
+static int sttp_nmea_checksum(lua_State *L)
+  {
+  size_t n;
+  const unsigned char *p = LuaCheckBytes(L,1,&n);
+  while(n && (p[n-1] == '\n' || p[n-1] == '\r'))
+    --n;
+  size_t first = (n && (p[0] == '$' || p[0] == '!')) ? 1 : 0;
+  const unsigned char *star = (const unsigned char *)memchr(p+first,'*',n-first);
+  size_t last = star ? (size_t)(star - p) : n;
+  lua_pushinteger(L,Xor8(p+first,last-first));
+  if(!star)
+    return(1);
+  lua_pushboolean(L,NmeaValid(p,n));
+  return(2);
+  }
+
+//Unpack count records (default: all whole records) of format fmt starting
+//at pos.  Records are stride bytes apart, default the size of the format.
+//Returns one array per field, then the position after the last record.
+static int sttp_unpack(lua_State *L)
+  {
+  const char *fmt = luaL_checkstring(L,1);
+  size_t n;
+  const unsigned char *p = LuaCheckBytes(L,2,&n);
+  lua_Integer pos = luaL_optinteger(L,3,1);
+  if(pos < 0) pos = ((size_t)-pos > n) ? 1 : (lua_Integer)n + pos + 1;
+  luaL_argcheck(L,pos >= 1 && (size_t)pos <= n+1,3,"initial position out of string");
+  lua_Integer count = luaL_optinteger(L,4,-1);
+  lua_Integer stride = luaL_optinteger(L,5,0);
+  luaL_argcheck(L,stride >= 0,5,"negative stride");
+  lua_settop(L,5);
+
+  size_t start = (size_t)pos - 1;
+  if(count == 0 || start >= n)
+    {
+    lua_pushinteger(L,(lua_Integer)start + 1);
+    return(1);
+    }
+
+  //The first record gives the number of fields and the record size.
+  size_t at = start;
+  int nf = LuaUnpack(L,fmt,p,n,&at);
+  size_t recsize = at - start;
+  size_t step = stride ? (size_t)stride : recsize;
+  luaL_argcheck(L,step > 0,1,"empty record format");
+  size_t nrec = (n - start - recsize)/step + 1;
+  if(count > 0 && (size_t)count < nrec)
+    nrec = (size_t)count;
+  luaL_checkstack(L,nf+2,"too many fields");
+  for(int f=1; f<=nf; ++f)
+    {
+    lua_createtable(L,(int)nrec,0);
+    lua_pushvalue(L,5+f);
+    lua_rawseti(L,-2,1);
+    }
+  int cols = 5 + nf;                  //column f is at cols+f
+  for(size_t r=1; r<nrec; ++r)
+    {
+    at = start + r*step;
+    LuaUnpack(L,fmt,p,n,&at);
+    for(int f=nf; f>=1; --f)
+      lua_rawseti(L,cols+f,(lua_Integer)r+1);
+    }
+  lua_pushinteger(L,(lua_Integer)(start + (nrec-1)*step + recsize) + 1);
+  return(nf + 1);
+  }
+
+//========================================================================
+//                        Writer
+//========================================================================
+//A stdio file with a large buffer.  Numbers are formatted straight into it,
+//no Lua strings are made along the way.
+//
+//Writers opened on the same path share one file (a sink), so the parallel
+//parser states of --lua-workers write to the same outputs.  Their output is
+//captured per chunk and written in order by the decoder (luapar.cpp).
+
+typedef struct
+  {
+  std::string path;
+  FILE *fp;                   //NULL once closed
+  int refs;                   //writers open on it
+  } tSink;
+
+typedef struct
+  {
+  int sink;                   //-1 once closed
+  FILE *fp;
+  } tWriter;
+
+static std::vector<tSink> Sinks;
+static std::mutex SinkLock;
+
+static tWriter *checkwriter(lua_State *L)
+  {
+  tWriter *w = (tWriter *)luaL_checkudata(L,1,WRITER_MT);
+  if(w->sink < 0)
+    luaL_error(L,"attempt to use a closed writer");
+  return(w);
+  }
+
+static int sttp_writer(lua_State *L)
+  {
+  const char *path = luaL_checkstring(L,1);
+  const char *mode = luaL_optstring(L,2,"w");
+  luaL_argcheck(L,mode[0] == 'w' || mode[0] == 'a',2,"invalid mode");
+  tWriter *w = (tWriter *)lua_newuserdata(L,sizeof(tWriter));
+  w->sink = -1;
+  w->fp = NULL;
+  luaL_setmetatable(L,WRITER_MT);
+
+  std::lock_guard<std::mutex> lk(SinkLock);
+  for(size_t i=0; i<Sinks.size(); ++i)
+    if(Sinks[i].fp && Sinks[i].path == path)
+      {
+      w->sink = (int)i;
+      break;
+      }
+  if(w->sink < 0)
+    {
+    FILE *fp = fopen(path,mode);
+    if(!fp)
+      return(luaL_fileresult(L,0,path));
+    setvbuf(fp,NULL,_IOFBF,WRITER_BUFSIZE);
+    tSink k;
+    k.path = path;
+    k.fp = fp;
+    k.refs = 0;
+    w->sink = (int)Sinks.size();
+    Sinks.push_back(k);
+    }
+  ++Sinks[w->sink].refs;
+  w->fp = Sinks[w->sink].fp;
+  return(1);
+  }
+
+//File of a sink, for writing captured output.
+FILE *LuaSinkFile(int sink)
+  {
+  std::lock_guard<std::mutex> lk(SinkLock);
+  return(Sinks[sink].fp);
+  }
+
+//Close the sinks no writer holds any more, at the end of parallel parsing.
+//Those of the main state's writers stay open until they are closed.
+void LuaSinksClose()
+  {
+  std::lock_guard<std::mutex> lk(SinkLock);
+  for(size_t i=0; i<Sinks.size(); ++i)
+    if(Sinks[i].fp && !Sinks[i].refs)
+      {
+      fclose(Sinks[i].fp);
+      Sinks[i].fp = NULL;
+      }
+  }
+
+//Drop a writer's hold on its sink.  The last one closes the file, unless
+//parallel states are capturing output, which is written later.
+static void ReleaseSink(tWriter *w)
+  {
+  std::lock_guard<std::mutex> lk(SinkLock);
+  tSink &k = Sinks[w->sink];
+  if(--k.refs == 0 && !LuaWorkersCapturing() && k.fp)
+    {
+    fclose(k.fp);
+    k.fp = NULL;
+    }
+  w->sink = -1;
+  w->fp = NULL;
+  }
+
+static void Out(lua_State *L, tWriter *w, const char *p, size_t n)
+  {
+  if(!LuaWorkersCapture(L,w->sink,p,n))
+    fwrite(p,1,n,w->fp);
+  }
+
+//Write a value: numbers as the Lua tostring() would, strings and buffers
+//as their bytes.
+static void WriteValue(lua_State *L, tWriter *w, int arg)
+  {
+  if(lua_type(L,arg) == LUA_TNUMBER)
+    {
+    char buf[64];
+    int n;
+    if(lua_isinteger(L,arg))
+      n = snprintf(buf,sizeof(buf),LUA_INTEGER_FMT,(LUAI_UACINT)lua_tointeger(L,arg));
+    else
+      {
+      //Floats that look like integers get ".0", as in tostring().
+      n = snprintf(buf,sizeof(buf)-2,LUA_NUMBER_FMT,(LUAI_UACNUMBER)lua_tonumber(L,arg));
+      if(buf[strspn(buf,"-0123456789")] == 0)
+        {
+        buf[n++] = '.';
+        buf[n++] = '0';
+        }
+      }
+    Out(L,w,buf,n);
+    return;
+    }
+  size_t n;
+  const unsigned char *p = LuaCheckBytes(L,arg,&n);
+  Out(L,w,(const char *)p,n);
+  }
+
+static int w_write(lua_State *L)
+  {
+  tWriter *w = checkwriter(L);
+  int top = lua_gettop(L);
+  for(int i=2; i<=top; ++i)
+    WriteValue(L,w,i);
+  lua_settop(L,1);
+  return(1);
+  }
+
+//string.format conversions (%d %i %u %c %o %x %X %e %E %f %F %g %G %a %A
+//%s %%) formatted by the C library straight into the output.
+static int w_printf(lua_State *L)
+  {
+  tWriter *w = checkwriter(L);
+  size_t fl;
+  const char *p = luaL_checklstring(L,2,&fl);
+  const char *e = p + fl;
+  int arg = 2;
+  char buf[512];
+  while(p < e)
+    {
+    if(*p != '%')
+      {
+      const char *q = (const char *)memchr(p,'%',e-p);
+      if(!q)
+        q = e;
+      Out(L,w,p,q-p);
+      p = q;
+      continue;
+      }
+    if(p+1 < e && p[1] == '%')
+      {
+      Out(L,w,"%",1);
+      p += 2;
+      continue;
+      }
+
+    //Copy flags, width and precision into a C format.
+    char spec[32];
+    size_t k = 0;
+    spec[k++] = *p++;
+    while(p < e && strchr("-+ #0",*p) && k < 8)
+      spec[k++] = *p++;
+    //Two digits at most for each, as string.format allows.
+    for(int d=0; p < e && *p >= '0' && *p <= '9'; ++d)
+      {
+      if(d == 2)
+        return(luaL_error(L,"invalid format (width or precision too long)"));
+      spec[k++] = *p++;
+      }
+    if(p < e && *p == '.')
+      {
+      spec[k++] = *p++;
+      for(int d=0; p < e && *p >= '0' && *p <= '9'; ++d)
+        {
+        if(d == 2)
+          return(luaL_error(L,"invalid format (width or precision too long)"));
+        spec[k++] = *p++;
+        }
+      }
+    if(p >= e)
+      return(luaL_error(L,"invalid format string to 'printf'"));
+    char conv = *p++;
+    ++arg;
+    int n = 0;
+    switch(conv)
+      {
+      case 'c':
+        spec[k++] = 'c';
+        spec[k] = 0;
+        n = snprintf(buf,sizeof(buf),spec,(int)luaL_checkinteger(L,arg));
+        break;
+      case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+        strcpy(spec+k,LUA_INTEGER_FRMLEN);
+        k += strlen(LUA_INTEGER_FRMLEN);
+        spec[k++] = conv;
+        spec[k] = 0;
+        n = snprintf(buf,sizeof(buf),spec,(LUAI_UACINT)luaL_checkinteger(L,arg));
+        break;
+      case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+        spec[k++] = conv;
+        spec[k] = 0;
+        n = snprintf(buf,sizeof(buf),spec,(LUAI_UACNUMBER)luaL_checknumber(L,arg));
+        break;
+      case 's':
+        if(k == 1)
+          WriteValue(L,w,arg);
+        else
+          {
+          //Width or precision: pad or cut the string, as %s does.
+          size_t len;
+          const char *str = luaL_tolstring(L,arg,&len);
+          std::string t(str,len);
+          spec[k++] = 's';
+          spec[k] = 0;
+          std::vector<char> big(len + 100);
+          int m = snprintf(&big[0],big.size(),spec,t.c_str());
+          if(m < 0)
+            m = 0;
+          else if(m > (int)big.size() - 1)
+            m = (int)big.size() - 1;
+          Out(L,w,&big[0],m);
+          lua_pop(L,1);
+          }
+        break;
+      default:
+        return(luaL_error(L,"invalid option '%%%c' to 'printf'",conv));
+      }
+    if(n > (int)sizeof(buf) - 1)
+      return(luaL_error(L,"printf: formatted value too long"));
+    Out(L,w,buf,n);
+    }
+  lua_settop(L,1);
+  return(1);
+  }
+
+static int w_hex(lua_State *L)
+  {
+  tWriter *w = checkwriter(L);
+  size_t n, ls = 0;
+  const unsigned char *p = LuaCheckBytes(L,2,&n);
+  const char *sep = luaL_optlstring(L,3,"",&ls);
+  char out[1024];
+  if(2+ls+ls > sizeof(out))
+    {
+    //A separator too long for the buffer: a byte at a time.
+    for(size_t i=0; i<n; ++i)
+      {
+      if(i)
+        Out(L,w,sep,ls);
+      Out(L,w,out,PutHex(out,p+i,1,sep,ls) - out);
+      }
+    lua_settop(L,1);
+    return(1);
+    }
+  size_t chunk = sizeof(out)/(2+ls+ls);
+  for(size_t i=0; i<n; i+=chunk)
+    {
+    size_t m = (n-i < chunk) ? (n-i) : chunk;
+    char *q = out;
+    if(i && ls)
+      {
+      memcpy(q,sep,ls);
+      q += ls;
+      }
+    q = PutHex(q,p+i,m,sep,ls);
+    Out(L,w,out,q-out);
+    }
+  lua_settop(L,1);
+  return(1);
+  }
+
+static int w_flush(lua_State *L)
+  {
+  tWriter *w = checkwriter(L);
+  if(!LuaWorkersCapturing())
+    fflush(w->fp);
+  return(0);
+  }
+
+static int w_close(lua_State *L)
+  {
+  ReleaseSink(checkwriter(L));
+  return(0);
+  }
+
+static int w_gc(lua_State *L)
+  {
+  tWriter *w = (tWriter *)luaL_checkudata(L,1,WRITER_MT);
+  if(w->sink >= 0)
+    ReleaseSink(w);
+  return(0);
+  }
+
+static const luaL_Reg WriterMethods[] =
+  {
+  {"write", w_write},
+  {"printf", w_printf},
+  {"hex", w_hex},
+  {"flush", w_flush},
+  {"close", w_close},
+  {NULL, NULL}
+  };
+
+static const luaL_Reg SttpFuncs[] =
+  {
+  {"hex", sttp_hex},
+  {"fletcher16", sttp_fletcher16},
+  {"crc16", sttp_crc16},
+  {"crc32", sttp_crc32},
+  {"nmea_checksum", sttp_nmea_checksum},
+  {"unpack", sttp_unpack},
+  {"writer", sttp_writer},
+  {"open", LuaArchiveOpen},
+  {NULL, NULL}
+  };
+
+//========================================================================
+//                          luaopen_sttp
+//========================================================================
+int luaopen_sttp(lua_State *L)
+  {
+  luaL_newmetatable(L,WRITER_MT);
+  luaL_newlib(L,WriterMethods);
+  lua_setfield(L,-2,"__index");
+  lua_pushcfunction(L,w_gc);
+  lua_setfield(L,-2,"__gc");
+  lua_pop(L,1);
+  LuaArchiveSetup(L);
+
+  luaL_newlib(L,SttpFuncs);
+  return(1);
+  }
+
+
+//========================================================================
+//                        Lua 5.3 compatibility
+//========================================================================
+//Scripts written for Lua 5.3 that run under LuaJIT get string.unpack,
+//math.type and math.tointeger.  The 5.3 integer operators (& | ~ << >> //)
+//are syntax and can't be added; LuaJIT's bit library does the same job.
+#ifdef STTP_LUAJIT
+static int str_unpack(lua_State *L)
+  {
+  const char *fmt = luaL_checkstring(L,1);
+  size_t n;
+  const unsigned char *data = (const unsigned char *)luaL_checklstring(L,2,&n);
+  lua_Integer pos = luaL_optinteger(L,3,1);
+  if(pos < 0)
+    pos = ((size_t)-pos > n) ? 0 : (lua_Integer)n + pos + 1;
+  --pos;
+  luaL_argcheck(L,pos >= 0 && (size_t)pos <= n,3,"initial position out of string");
+  size_t at = (size_t)pos;
+  int nres = LuaUnpack(L,fmt,data,n,&at);
+  lua_pushinteger(L,(lua_Integer)at + 1);
+  return(nres + 1);
+  }
+
+static int math_type(lua_State *L)
+  {
+  luaL_checkany(L,1);
+  if(lua_type(L,1) != LUA_TNUMBER)
+    lua_pushnil(L);
+  else
+    lua_pushstring(L,lua_isinteger(L,1) ? "integer" : "float");
+  return(1);
+  }
+
+static int math_tointeger(lua_State *L)
+  {
+  if(lua_isinteger(L,1))
+    lua_pushvalue(L,1);
+  else
+    lua_pushnil(L);
+  return(1);
+  }
+
+//Set t[name] = f unless the library already has it.
+static void AddMissing(lua_State *L, const char *lib, const char *name, lua_CFunction f)
+  {
+  lua_getglobal(L,lib);
+  lua_getfield(L,-1,name);
+  if(lua_isnil(L,-1))
+    {
+    lua_pushcfunction(L,f);
+    lua_setfield(L,-3,name);
+    }
+  lua_pop(L,2);
+  }
+#endif
+
+void LuaCompatSetup(lua_State *L)
+  {
+#ifdef STTP_LUAJIT
+  AddMissing(L,"string","unpack",str_unpack);
+  AddMissing(L,"math","type",math_type);
+  AddMissing(L,"math","tointeger",math_tointeger);
+#else
+  (void)L;                        //Lua 5.3 has them all
+#endif
+  }
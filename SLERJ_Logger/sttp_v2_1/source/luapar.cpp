@@ -0,0 +1,363 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+//Parallel Lua parsing (--lua-workers N).  A script that keeps only short
+//range state can declare
+//  sttp_parallel = { overlap_bytes = K [, reset = function() ... end] }
+//Subpacket data is then cut into contiguous chunks (whole A2 packets,
+//--lua-chunk KB each) and every chunk is parsed by one of N independent Lua
+//states, each with its own copy of the script.  Each chunk is preceded by
+//the last K bytes of the chunk before it so the parser can resync; output
+//made while parsing those bytes is dropped, so K must cover the longest
+//record.  reset, if given, is called before each chunk.
+//
+//The states run on worker threads while the decoder keeps going.  Output
+//written through sttp.writer is captured per chunk and written to the
+//files in chunk order, so it comes out in time order just as with a single
+//state.  Output written any other way (io.write etc.) is not ordered.
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdio.h>
+#include <stdlib.h>
+#include "luacompat.h"
+#include "sttp.h"
+
+static unsigned NWorkers = 0;         //parser states, 0/1 = no workers
+static size_t ChunkSize = 1024*1024;  //subpacket bytes per chunk
+static size_t Overlap = 0;            //bytes of the previous chunk replayed
+
+//One subpacket of a chunk.  Data is kept end to end in tChunk::data.
+typedef struct
+  {
+  double RT;
+  std::string TS;
+  size_t end;                 //end of the data in tChunk::data
+  bool pktend;                //last subpacket of an A2 packet
+  } tSub;
+
+typedef struct
+  {
+  std::vector<tSub> subs;
+  std::string data;
+  size_t nwarm;               //leading subs replayed from the previous chunk
+  std::vector<std::string> out;   //captured output per sink
+  bool done;
+  } tChunk;
+
+//A parser state and the chunk it is working on.
+typedef struct
+  {
+  lua_State *L;
+  tChunk *cur;                //NULL between chunks
+  bool warm;                  //replaying overlap, output is dropped
+  } tWorker;
+
+static std::vector<tWorker> States;   //States[0] is the state made by main
+static std::vector<std::thread> Threads;
+static bool Capturing = false;        //writer output goes through the states
+static bool Running = false;          //subpackets go to the workers
+static tChunk *Fill = NULL;           //chunk being filled by the decoder
+
+//========================================================================
+//                        LuaWorkersSetup
+//========================================================================
+//Parse --lua-workers and --lua-chunk.  Return false if we run into a problem.
+bool LuaWorkersSetup(std::string workers, std::string chunk)
+  {
+  if(workers.length())
+    NWorkers = atoi(workers.c_str());
+  if(chunk.length())
+    {
+    double k = atof(chunk.c_str());
+    if(k <= 0)
+      {
+      fprintf(stderr,"Invalid --lua-chunk\n");
+      return(false);
+      }
+    ChunkSize = (size_t)(k*1024);
+    }
+  return(true);
+  }
+
+bool LuaWorkersRunning()
+  {
+  return(Running);
+  }
+
+bool LuaWorkersCapturing()
+  {
+  return(Capturing);
+  }
+
+//========================================================================
+//                        LuaWorkersCapture
+//========================================================================
+//Called by sttp.writer for output of state L.  Returns true if the output
+//was taken (kept with the state's chunk, or dropped), false if it should
+//go straight to the file.  Only the state made by main writes directly,
+//and only while the script loads; the other states load the same script,
+//so their load time output would be a repeat.
+bool LuaWorkersCapture(lua_State *L, int sink, const char *p, size_t n)
+  {
+  if(!Capturing)
+    return(false);
+  for(size_t i=0; i<States.size(); ++i)
+    {
+    tWorker &w = States[i];
+    if(w.L != L)
+      continue;
+    if(!w.cur)
+      return(i != 0);
+    if(!w.warm)
+      {
+      if(w.cur->out.size() <= (size_t)sink)
+        w.cur->out.resize(sink+1);
+      w.cur->out[sink].append(p,n);
+      }
+    return(true);
+    }
+  return(true);               //a state still loading its script
+  }
+
+//========================================================================
+//                        Worker pool
+//========================================================================
+//Chunks are queued for the states and also kept in order in Pending until
+//their output is written.  At most MaxPending chunks are held, so memory
+//stays bounded when the parsers fall behind the decoder.
+static std::mutex PoolLock;
+static std::condition_variable PoolWork;   //a chunk was queued, or stop
+static std::condition_variable PoolDone;   //a chunk was finished
+static std::deque<tChunk*> Queue;          //chunks waiting for a state
+static std::deque<tChunk*> Pending;        //chunks waiting to be written
+static size_t MaxPending;
+static bool PoolStop = false;
+
+//Parse a chunk with the state of w.
+static void ParseChunk(tWorker &w, tChunk *c)
+  {
+  w.cur = c;
+  w.warm = (c->nwarm > 0);
+  LuaStateReset(w.L);
+  size_t start = 0;
+  for(size_t i=0; i<c->subs.size(); ++i)
+    {
+    if(i == c->nwarm && w.warm)
+      {
+      //Anything still batched belongs to the overlap.
+      LuaStateFlush(w.L);
+      w.warm = false;
+      }
+    tSub &s = c->subs[i];
+    LuaStateParse(w.L,c->data.c_str()+start,s.end-start,s.RT,s.TS);
+    if(s.pktend)
+      LuaStatePacketEnd(w.L);
+    start = s.end;
+    }
+  LuaStateFlush(w.L);
+  w.cur = NULL;
+  }
+
+static void Worker(size_t k)
+  {
+  std::unique_lock<std::mutex> lk(PoolLock);
+  for(;;)
+    {
+    while(Queue.empty() && !PoolStop)
+      PoolWork.wait(lk);
+    if(Queue.empty())
+      break;
+    tChunk *c = Queue.front();
+    Queue.pop_front();
+
+    lk.unlock();
+    ParseChunk(States[k],c);
+    lk.lock();
+
+    c->done = true;
+    PoolDone.notify_all();
+    }
+  }
+
+//Write the output of the finished chunks at the head of Pending.  If all is
+//set, or too many chunks are held, wait for the head chunk to finish.
+static void WriteReady(bool all)
+  {
+  std::unique_lock<std::mutex> lk(PoolLock);
+  for(;;)
+    {
+    while(!Pending.empty() && !Pending.front()->done && (all || Pending.size() > MaxPending))
+      PoolDone.wait(lk);
+    if(Pending.empty() || !Pending.front()->done)
+      break;
+    tChunk *c = Pending.front();
+    Pending.pop_front();
+
+    lk.unlock();
+    for(size_t i=0; i<c->out.size(); ++i)
+      if(c->out[i].length())
+        fwrite(c->out[i].data(),1,c->out[i].length(),LuaSinkFile(i));
+    delete c;
+    lk.lock();
+    }
+  }
+
+//Queue the chunk being filled and start the next one with its overlap.
+static void Submit()
+  {
+  tChunk *c = Fill;
+  Fill = new tChunk;
+  Fill->nwarm = 0;
+  Fill->done = false;
+  if(Overlap)
+    {
+    //The last subpackets holding at least Overlap bytes.
+    size_t i = c->subs.size();
+    size_t from = c->data.length();
+    while(i > 0 && (c->data.length() - from) < Overlap)
+      {
+      --i;
+      from = i ? c->subs[i-1].end : 0;
+      }
+    for(size_t k=i; k<c->subs.size(); ++k)
+      {
+      tSub s = c->subs[k];
+      s.end -= from;
+      Fill->subs.push_back(s);
+      }
+    Fill->data.assign(c->data,from,std::string::npos);
+    Fill->nwarm = Fill->subs.size();
+    }
+
+    {
+    std::lock_guard<std::mutex> lk(PoolLock);
+    Pending.push_back(c);
+    Queue.push_back(c);
+    }
+  PoolWork.notify_one();
+  WriteReady(false);
+  }
+
+//========================================================================
+//                        LuaWorkersStart
+//========================================================================
+//Called after the main state L is loaded.  If workers were asked for and
+//the script allows it, load the other states and start the threads.
+void LuaWorkersStart(lua_State *L, char *fname)
+  {
+  if(NWorkers < 2)
+    return;
+  if(!LuaParallelSpec(L,&Overlap))
+    {
+    fprintf(stderr,"--lua-workers ignored, %s doesn't declare sttp_parallel\n",fname);
+    return;
+    }
+  if(ChunkSize < 4*Overlap)
+    ChunkSize = 4*Overlap;
+
+  //Output of the other states' script loading is dropped from here on.
+  Capturing = true;
+  tWorker w;
+  w.L = L;
+  w.cur = NULL;
+  w.warm = false;
+  States.push_back(w);
+  for(unsigned i=1; i<NWorkers; ++i)
+    {
+    w.L = LuaSetup(fname);
+    States.push_back(w);
+    }
+
+  MaxPending = 2*NWorkers;
+  PoolStop = false;
+  Fill = new tChunk;
+  Fill->nwarm = 0;
+  Fill->done = false;
+  for(size_t i=0; i<States.size(); ++i)
+    Threads.push_back(std::thread(Worker,i));
+  Running = true;
+  }
+
+//========================================================================
+//                        LuaWorkersAdd
+//========================================================================
+//Add a subpacket to the chunk being filled.
+void LuaWorkersAdd(const char *data, size_t n, double RT, const std::string &TS)
+  {
+  tSub s;
+  s.RT = RT;
+  s.TS = TS;
+  Fill->data.append(data,n);
+  s.end = Fill->data.length();
+  s.pktend = false;
+  Fill->subs.push_back(s);
+  }
+
+//========================================================================
+//                        LuaWorkersPacketEnd
+//========================================================================
+//Chunks end at packet ends, once they hold ChunkSize new bytes.
+void LuaWorkersPacketEnd()
+  {
+  if(Fill->subs.size() <= Fill->nwarm)
+    return;
+  Fill->subs.back().pktend = true;
+  size_t warm = Fill->nwarm ? Fill->subs[Fill->nwarm-1].end : 0;
+  if(Fill->data.length() - warm >= ChunkSize)
+    Submit();
+  }
+
+//========================================================================
+//                        LuaWorkersFinish
+//========================================================================
+//Parse what is left, write all output, stop the threads and close the
+//extra states and the output files.
+void LuaWorkersFinish()
+  {
+  if(Fill->subs.size() > Fill->nwarm)
+    Submit();
+  delete Fill;
+  Fill = NULL;
+  WriteReady(true);
+
+    {
+    std::lock_guard<std::mutex> lk(PoolLock);
+    PoolStop = true;
+    }
+  PoolWork.notify_all();
+  for(size_t i=0; i<Threads.size(); ++i)
+    Threads[i].join();
+  Threads.clear();
+  Running = false;
+
+  for(size_t i=1; i<States.size(); ++i)
+    LuaClose(States[i].L);
+  States.clear();
+  LuaSinksClose();
+  Capturing = false;
+  }
@@ -0,0 +1,959 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+//External Lua parser support (-x).  The script is handed the data of each
+//subpacket along with its SSR run time and timestamp string, either one
+//subpacket per call (ParseData) or, if the script provides it, a batch of
+//subpackets per call (ParseBatch).
+//
+//When sttp is given several archives, a script that provides
+//  Reset(paths)
+//is called with the sttp_getPaths table of each archive after the first,
+//instead of being loaded again, so it can start new output files and clear
+//what it keeps between calls.
+//
+//A script that sets sttp_buffers = true receives the data as read-only
+//buffers over sttp's own packet data instead of Lua strings (see Buffer
+//userdata below).
+//
+//When sttp is built with LuaJIT (see luacompat.h), a script that sets
+//sttp_ffi = true gets the data as an FFI const uint8_t* and a length in
+//place of each string, valid only during the call:
+//  ParseData(runtime, timestamp, ptr, len)
+//  ParseBatch(runtimes, timestamps, ptrs, lens)
+//  ParseFrame(runtime, timestamp, ptr, len, end_runtime, end_timestamp)
+//
+//A script that declares its frame format in a table sttp_frame has sttp
+//reassemble and validate the frames, and gets one call per frame:
+//  ParseFrame(runtime, timestamp, frame, end_runtime, end_timestamp)
+//with the times of the subpackets holding the first and last frame bytes.
+//sttp_frame fields (positions are 1 based, as in Lua strings):
+//  sync        string of bytes each frame starts with
+//  len_pos     position of the length field        (binary frames)
+//  len_size    length field bytes, 1, 2 or 4       (default 1)
+//  len_endian  "big" or "little"                   (default big)
+//  len_add     frame length = length field + len_add (default 0)
+//  max_len     longest frame accepted              (default 4096)
+//  checksum    "none", "fletcher", "crc16", "crc32", "xor", "nmea"
+//              or "newline" (text lines, no check)  (default none)
+//  ck_endian   byte order of a CRC, "big" or "little" (default big)
+//  ck_from     first byte covered by the checksum  (default 1)
+//For example, MIP packets from a MicroStrain IMU:
+//  sttp_frame = { sync="\x75\x65", len_pos=4, len_add=6, max_len=261,
+//                 checksum="fletcher" }
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <conio.h>
+#endif
+#include "luacompat.h"
+#include "sttp.h"
+
+static size_t BatchLimit = 0;         //bytes per ParseBatch call, 0=one A2 packet
+static std::string CacheDir;          //--lua-cache directory, empty if none
+static std::string Compiled;          //bytecode of the script, once compiled
+
+class tLuaFramer;
+
+//What sttp keeps for each loaded script.  There is one per lua_State, and
+//more than one only with parallel parser states (--lua-workers).
+typedef struct
+  {
+  lua_State *L;
+
+  //The parser functions are looked up once and kept in the Lua registry.
+  int ParseRef;                   //ParseData(runtime, timestamp, buf)
+  int BatchRef;                   //ParseBatch(runtimes, timestamps, bufs)
+  int FrameRef;                   //ParseFrame(runtime, timestamp, frame, ...)
+  tLuaFramer *Framer;             //framing engine for sttp_frame
+
+  //Subpackets waiting to be handed to ParseBatch.  The data of all of them
+  //is kept end to end in BatchData, BatchEnd[i] is where subpacket i ends.
+  size_t BatchCount;
+  std::vector<double> BatchRT;
+  std::vector<std::string> BatchTS;
+  std::vector<size_t> BatchEnd;
+  std::string BatchData;
+
+  //Read-only views (tBuffer) of subpacket data handed to scripts with
+  //sttp_buffers set.  Views are only valid during the call they were
+  //passed to; afterwards they are emptied so a script that keeps one gets
+  //an error rather than stale data.  The views are held in a registry
+  //table until then, so one the script drops isn't collected before it
+  //is emptied.
+  bool UseBuffers;                //script set sttp_buffers
+  std::vector<tBuffer *> LiveBufs;    //views handed out in this call
+  int LiveRef;                    //registry table holding them
+
+  bool UseFFI;                    //script set sttp_ffi (LuaJIT only)
+  } tLuaParser;
+
+static std::vector<tLuaParser *> Parsers;
+
+static tLuaParser *Parser(lua_State *L)
+  {
+  for(size_t i=0; i<Parsers.size(); ++i)
+    if(Parsers[i]->L == L)
+      return(Parsers[i]);
+  ExitError(2,"Lua state without a parser\n");
+  return(NULL);
+  }
+
+//========================================================================
+//                    Lua Environment Functions
+//========================================================================
+//A few functions that we'd like to make available to the Lua scripts.
+//  sttp_setTSFormat(<strftime format string>)
+//  sttp_getPaths()  returns a table with relevant paths in fields:
+//          ArchiveFile, ArchivePath, ArchiveName, ArchiveExt, cwd
+
+extern "C" {
+
+//Sets TFormat from the lua script to control the timestamp format without
+//having to provide the -N argument to the sttp command line. 
+static int sttp_setTSFormat(lua_State *L)  //[-2,+0]
+  {
+  //Timestamps are made by the decoder, which parallel parser states run
+  //beside, so the format can only be set while the script loads.
+  if(LuaWorkersRunning())
+    return(luaL_error(L,"sttp_setTSFormat can't be used while parsing with --lua-workers"));
+  TFormat = luaL_checkstring(L,-2);         //get string provided on stack
+  SuppressMSec = lua_toboolean(L,-1);   //bool, SuppressMSec
+  return(0);                            //no results pushed to stack
+  }
+
+
+static int sttp_getPaths(lua_State *L)  //[-0,+1]
+  {
+  char drive[_MAX_DRIVE], dir[_MAX_DIR], name[_MAX_FNAME], ext[_MAX_EXT];
+  char absPath[_MAX_PATH];
+  _fullpath(absPath,ArchFilePath.c_str(),_MAX_PATH);
+  _splitpath(absPath,drive,dir,name,ext);
+  
+  lua_newtable(L);
+  lua_pushstring(L,absPath);
+  lua_setfield(L,-2,"ArchiveFile");
+  lua_pushstring(L,(std::string(drive)+std::string(dir)).c_str());
+  lua_setfield(L,-2,"ArchivePath");
+  lua_pushstring(L,name);
+  lua_setfield(L,-2,"ArchiveName");
+  lua_pushstring(L,ext);
+  lua_setfield(L,-2,"ArchiveExt");
+  
+  _getcwd(absPath,_MAX_PATH);
+  lua_pushstring(L,absPath);
+  lua_setfield(L,-2,"cwd");
+  
+  return(1);                          //one result pushed to stack
+  }
+
+//========================================================================
+//                        Buffer userdata
+//========================================================================
+//Methods of the read-only buffers, following the string library:
+//  buf[i], buf:byte(i [,j]), #buf    byte access (1 based, negative from end)
+//  buf:sub(i [,j])                   copy of a range as a Lua string
+//  buf:unpack(fmt [,pos])            string.unpack at pos without a copy
+//  buf:find(s [,init])               plain search (s is not a pattern)
+//  tostring(buf)                     copy of the whole buffer
+
+static tBuffer *checkbuffer(lua_State *L)
+  {
+  tBuffer *b = (tBuffer *)luaL_checkudata(L,1,BUFFER_MT);
+  if(!b->p)
+    luaL_error(L,"buffer used outside of the parser call");
+  return(b);
+  }
+
+//Relative string position as in lstrlib.c: negative means from the end.
+static lua_Integer posrelat(lua_Integer pos, size_t len)
+  {
+  if(pos >= 0)
+    return(pos);
+  else if((size_t)-pos > len)
+    return(0);
+  return((lua_Integer)len + pos + 1);
+  }
+
+static int buf_len(lua_State *L)
+  {
+  tBuffer *b = checkbuffer(L);
+  lua_pushinteger(L,(lua_Integer)b->n);
+  return(1);
+  }
+
+static int buf_tostring(lua_State *L)
+  {
+  tBuffer *b = checkbuffer(L);
+  lua_pushlstring(L,(const char *)b->p,b->n);
+  return(1);
+  }
+
+static int buf_byte(lua_State *L)
+  {
+  tBuffer *b = checkbuffer(L);
+  lua_Integer i = posrelat(luaL_optinteger(L,2,1),b->n);
+  lua_Integer j = posrelat(luaL_optinteger(L,3,i),b->n);
+  if(i < 1) i = 1;
+  if(j > (lua_Integer)b->n) j = (lua_Integer)b->n;
+  if(i > j)
+    return(0);
+  int n = (int)(j - i + 1);
+  luaL_checkstack(L,n,"buffer slice too long");
+  for(lua_Integer k=i; k<=j; ++k)
+    lua_pushinteger(L,b->p[k-1]);
+  return(n);
+  }
+
+static int buf_sub(lua_State *L)
+  {
+  tBuffer *b = checkbuffer(L);
+  lua_Integer i = posrelat(luaL_optinteger(L,2,1),b->n);
+  lua_Integer j = posrelat(luaL_optinteger(L,3,-1),b->n);
+  if(i < 1) i = 1;
+  if(j > (lua_Integer)b->n) j = (lua_Integer)b->n;
+  if(i > j)
+    lua_pushliteral(L,"");
+  else
+    lua_pushlstring(L,(const char *)b->p+i-1,(size_t)(j-i+1));
+  return(1);
+  }
+
+static int buf_find(lua_State *L)
+  {
+  tBuffer *b = checkbuffer(L);
+  size_t ls;
+  const char *s = luaL_checklstring(L,2,&ls);
+  lua_Integer init = posrelat(luaL_optinteger(L,3,1),b->n);
+  if(init < 1) init = 1;
+  if(init > (lua_Integer)b->n + 1)
+    {
+    lua_pushnil(L);
+    return(1);
+    }
+  const unsigned char *p = b->p + init - 1;
+  const unsigned char *end = b->p + b->n;
+  if(ls == 0)
+    {
+    lua_pushinteger(L,init);
+    lua_pushinteger(L,init-1);
+    return(2);
+    }
+  while((size_t)(end - p) >= ls)
+    {
+    p = (const unsigned char *)memchr(p,(unsigned char)s[0],(end-p)-ls+1);
+    if(!p)
+      break;
+    if(!memcmp(p,s,ls))
+      {
+      lua_pushinteger(L,(lua_Integer)(p - b->p) + 1);
+      lua_pushinteger(L,(lua_Integer)(p - b->p) + (lua_Integer)ls);
+      return(2);
+      }
+    ++p;
+    }
+  lua_pushnil(L);
+  return(1);
+  }
+
+static int buf_unpack(lua_State *L)
+  {
+  tBuffer *b = checkbuffer(L);
+  const char *fmt = luaL_checkstring(L,2);
+  lua_Integer pos = posrelat(luaL_optinteger(L,3,1),b->n) - 1;
+  luaL_argcheck(L,pos >= 0 && (size_t)pos <= b->n,3,"initial position out of string");
+  size_t at = (size_t)pos;
+  int nres = LuaUnpack(L,fmt,b->p,b->n,&at);
+  lua_pushinteger(L,(lua_Integer)at + 1);
+  return(nres + 1);
+  }
+
+//buf[i] gives the byte at i (nil outside the buffer), anything else is a
+//method lookup in the table held as upvalue.
+static int buf_index(lua_State *L)
+  {
+  if(lua_isinteger(L,2))
+    {
+    tBuffer *b = checkbuffer(L);
+    lua_Integer i = lua_tointeger(L,2);
+    if(i >= 1 && i <= (lua_Integer)b->n)
+      lua_pushinteger(L,b->p[i-1]);
+    else
+      lua_pushnil(L);
+    return(1);
+    }
+  lua_pushvalue(L,2);
+  lua_gettable(L,lua_upvalueindex(1));
+  return(1);
+  }
+
+static const luaL_Reg BufferMethods[] =
+  {
+  {"byte", buf_byte},
+  {"sub", buf_sub},
+  {"find", buf_find},
+  {"unpack", buf_unpack},
+  {"len", buf_len},
+  {NULL, NULL}
+  };
+
+} //End extern "C"
+
+//Install the buffer metatable.
+static void BufferSetup(lua_State *L)
+  {
+  luaL_newmetatable(L,BUFFER_MT);
+  luaL_newlib(L,BufferMethods);
+  lua_pushcclosure(L,buf_index,1);
+  lua_setfield(L,-2,"__index");
+  lua_pushcfunction(L,buf_len);
+  lua_setfield(L,-2,"__len");
+  lua_pushcfunction(L,buf_tostring);
+  lua_setfield(L,-2,"__tostring");
+  lua_pop(L,1);
+  }
+
+//Push subpacket data for the script: a buffer view if the script asked for
+//them, a pointer and length for FFI scripts, otherwise a copy as a Lua
+//string.  Returns the number of values pushed.
+static int PushData(tLuaParser *P, const char *p, size_t n)
+  {
+  if(P->UseFFI)
+    {
+    //The script's function is wrapped to cast the pointer (see FFIWrap).
+    lua_pushlightuserdata(P->L,(void *)p);
+    lua_pushinteger(P->L,(lua_Integer)n);
+    return(2);
+    }
+  if(!P->UseBuffers)
+    {
+    lua_pushlstring(P->L,p,n);
+    return(1);
+    }
+  tBuffer *b = (tBuffer *)lua_newuserdata(P->L,sizeof(tBuffer));
+  b->p = (const unsigned char *)p;
+  b->n = n;
+  luaL_setmetatable(P->L,BUFFER_MT);
+  P->LiveBufs.push_back(b);
+  lua_rawgeti(P->L,LUA_REGISTRYINDEX,P->LiveRef);
+  lua_pushvalue(P->L,-2);
+  lua_rawseti(P->L,-2,(int)P->LiveBufs.size());
+  lua_pop(P->L,1);
+  return(1);
+  }
+
+//Empty the views handed out in the call that just returned.
+static void ReleaseBuffers(tLuaParser *P)
+  {
+  if(P->LiveBufs.empty())
+    return;
+  for(size_t i=0; i<P->LiveBufs.size(); ++i)
+    {
+    P->LiveBufs[i]->p = NULL;
+    P->LiveBufs[i]->n = 0;
+    }
+  P->LiveBufs.clear();
+  lua_newtable(P->L);
+  lua_rawseti(P->L,LUA_REGISTRYINDEX,P->LiveRef);
+  }
+  
+//========================================================================
+//                        Frame spec
+//========================================================================
+//Frames from the framing engine go straight to ParseFrame.
+class tLuaFramer : public tFramer
+  {
+  public:
+    tLuaFramer(tLuaParser *p) : P(p) {}
+    void Frame(const char *p, size_t n, double RT0, const std::string &TS0,
+               double RT1, const std::string &TS1);
+
+  private:
+    tLuaParser *P;
+  };
+
+void tLuaFramer::Frame(const char *p, size_t n, double RT0, const std::string &TS0,
+                       double RT1, const std::string &TS1)
+  {
+  lua_State *L = P->L;
+  lua_rawgeti(L,LUA_REGISTRYINDEX,P->FrameRef);
+  lua_pushnumber(L,RT0);
+  lua_pushlstring(L,TS0.c_str(),TS0.length());
+  int nd = PushData(P,p,n);
+  lua_pushnumber(L,RT1);
+  lua_pushlstring(L,TS1.c_str(),TS1.length());
+  PROFILE_COUNT(PROF_LUA_CALLS,1);
+  STTP_PROBE3(lua_enter,PROBE_PARSEFRAME,(unsigned long)(RT0*1000),n);
+  if(lua_pcall(L,4+nd,0,0))
+    ExitError(2,lua_tostring(L,-1));
+  STTP_PROBE3(lua_exit,PROBE_PARSEFRAME,(unsigned long)(RT0*1000),n);
+  ReleaseBuffers(P);
+  lua_settop(L,0);
+  }
+
+//Fields of the sttp_frame table (on top of the stack).
+static int SpecInt(lua_State *L, const char *name, int def)
+  {
+  lua_getfield(L,-1,name);
+  if(!lua_isnil(L,-1) && !lua_isinteger(L,-1))
+    ExitError(2,"sttp_frame: %s must be an integer\n",name);
+  int v = lua_isnil(L,-1) ? def : (int)lua_tointeger(L,-1);
+  lua_pop(L,1);
+  return(v);
+  }
+
+static std::string SpecString(lua_State *L, const char *name, const char *def)
+  {
+  lua_getfield(L,-1,name);
+  std::string v = def;
+  if(!lua_isnil(L,-1))
+    {
+    if(lua_type(L,-1) != LUA_TSTRING)
+      ExitError(2,"sttp_frame: %s must be a string\n",name);
+    size_t n;
+    const char *c = lua_tolstring(L,-1,&n);
+    v.assign(c,n);
+    }
+  lua_pop(L,1);
+  return(v);
+  }
+
+//Build the framing engine from the sttp_frame table on top of the stack.
+static void FrameSetup(tLuaParser *P)
+  {
+  lua_State *L = P->L;
+  static const char *cknames[] = {"none","fletcher","crc16","crc32","xor","nmea","newline"};
+  tFrameSpec spec;
+  spec.sync = SpecString(L,"sync","");
+  spec.lenpos = SpecInt(L,"len_pos",0) - 1;
+  spec.lensize = SpecInt(L,"len_size",1);
+  spec.lenbig = SpecString(L,"len_endian","big") != "little";
+  spec.lenadd = SpecInt(L,"len_add",0);
+  spec.maxlen = SpecInt(L,"max_len",4096);
+  spec.ckbig = SpecString(L,"ck_endian","big") != "little";
+  spec.ckfrom = SpecInt(L,"ck_from",1) - 1;
+  std::string ck = SpecString(L,"checksum","none");
+  spec.cktype = -1;
+  for(int i=0; i<(int)(sizeof(cknames)/sizeof(cknames[0])); ++i)
+    if(ck == cknames[i])
+      spec.cktype = i;
+  if(spec.cktype < 0)
+    ExitError(2,"sttp_frame: unknown checksum type %s\n",ck.c_str());
+
+  P->Framer = new tLuaFramer(P);
+  std::string err = P->Framer->Setup(spec);
+  if(err.length())
+    ExitError(2,"sttp_frame: %s\n",err.c_str());
+  }
+
+//========================================================================
+//                          FunctionRef
+//========================================================================
+//For FFI scripts, each parser function is wrapped by one that casts the
+//light userdata pointers sttp passes into const uint8_t* cdata.  The cast
+//is compiled by LuaJIT along with the script's own code.
+static const char *FFIWrap =
+  "local f, kind = ...\n"
+  "local ffi = require('ffi')\n"
+  "local cast, u8p = ffi.cast, ffi.typeof('const uint8_t *')\n"
+  "if kind == 'batch' then\n"
+  "  return function(rts, tss, ps, ns)\n"
+  "    for i = 1, #ps do ps[i] = cast(u8p, ps[i]) end\n"
+  "    return f(rts, tss, ps, ns)\n"
+  "  end\n"
+  "elseif kind == 'frame' then\n"
+  "  return function(rt0, ts0, p, n, rt1, ts1)\n"
+  "    return f(rt0, ts0, cast(u8p, p), n, rt1, ts1)\n"
+  "  end\n"
+  "end\n"
+  "return function(rt, ts, p, n) return f(rt, ts, cast(u8p, p), n) end\n";
+
+//Registry reference to the parser function on top of the stack, which is
+//popped.  kind is "data", "batch" or "frame".
+static int FunctionRef(tLuaParser *P, const char *kind)
+  {
+  lua_State *L = P->L;
+  if(P->UseFFI)
+    {
+    if(luaL_loadstring(L,FFIWrap))
+      ExitError(2,lua_tostring(L,-1));
+    lua_insert(L,-2);
+    lua_pushstring(L,kind);
+    if(lua_pcall(L,2,1,0))
+      ExitError(2,lua_tostring(L,-1));
+    }
+  return(luaL_ref(L,LUA_REGISTRYINDEX));
+  }
+
+//========================================================================
+//                          LoadScript
+//========================================================================
+//Loads the script fname as a function on the stack, like luaL_loadfile.
+//It is only compiled the first time; the parallel parser states and a
+//script loaded again for the next archive load its bytecode.  With
+//--lua-cache the bytecode is also kept in a file named after a hash of the
+//script text, so later runs don't compile it either.
+#ifdef STTP_LUAJIT
+#define BYTECODE_EXT "ljbc"
+#else
+#define BYTECODE_EXT "luac"
+#endif
+
+static int DumpWriter(lua_State *, const void *p, size_t sz, void *ud)
+  {
+  ((std::string *)ud)->append((const char *)p,sz);
+  return(0);
+  }
+
+static int LoadScript(lua_State *L, const char *fname)
+  {
+  std::string chunkname = std::string("@") + fname;
+  if(Compiled.length())
+    return(luaL_loadbuffer(L,Compiled.data(),Compiled.length(),chunkname.c_str()));
+
+  FILE *fp = fopen(fname,"rb");
+  if(!fp)
+    return(luaL_loadfile(L,fname));   //for its error message
+  std::string text;
+  char buf[4096];
+  size_t n;
+  while((n = fread(buf,1,sizeof(buf),fp)) > 0)
+    text.append(buf,n);
+  fclose(fp);
+
+  //As luaL_loadfile: skip a UTF-8 BOM, and a first line starting with #
+  //is a comment.
+  if(text.compare(0,3,"\xEF\xBB\xBF") == 0)
+    text.erase(0,3);
+  if(text.length() && text[0] == '#')
+    text.insert(0,"--");
+
+  std::string cached;
+  if(CacheDir.length())
+    {
+    char name[64];
+    sprintf(name,"/%08lx%08lx." BYTECODE_EXT,
+            Crc32((const unsigned char *)text.data(),text.length()),
+            (unsigned long)text.length());
+    cached = CacheDir + name;
+    FILE *fc = fopen(cached.c_str(),"rb");
+    if(fc)
+      {
+      while((n = fread(buf,1,sizeof(buf),fc)) > 0)
+        Compiled.append(buf,n);
+      fclose(fc);
+      //Bytecode of another Lua version won't load; compile instead.
+      if(!luaL_loadbuffer(L,Compiled.data(),Compiled.length(),chunkname.c_str()))
+        return(0);
+      lua_pop(L,1);
+      Compiled.clear();
+      }
+    }
+
+  int err = luaL_loadbuffer(L,text.data(),text.length(),chunkname.c_str());
+  if(err)
+    return(err);
+  lua_dump(L,DumpWriter,&Compiled,0);
+  if(cached.length())
+    {
+    FILE *fc = fopen(cached.c_str(),"wb");
+    if(!fc || fwrite(Compiled.data(),1,Compiled.length(),fc) != Compiled.length())
+      fprintf(stderr,"Unable to write compiled script %s\n",cached.c_str());
+    if(fc)
+      fclose(fc);
+    }
+  return(0);
+  }
+
+//========================================================================
+//                          LuaSetup
+//========================================================================
+//LuaSetup encapsulates the code needed to setup the Lua parser, install
+//the custom sttp functions for scripts to use, and load the user script.
+lua_State *LuaSetup(char *fname)
+  {
+  lua_State *L = luaL_newstate();
+  luaL_openlibs(L);
+  
+  //Install custom functions
+  lua_pushcfunction(L, sttp_setTSFormat);
+  lua_setglobal(L,"sttp_setTSFormat");
+  lua_pushcfunction(L, sttp_getPaths);
+  lua_setglobal(L,"sttp_getPaths");
+  luaL_requiref(L,"sttp",luaopen_sttp,1);
+  lua_pop(L,1);
+  BufferSetup(L);
+  LuaCompatSetup(L);
+  
+  int err = LoadScript(L,fname);
+  if(!err)
+    err = lua_pcall(L,0,LUA_MULTRET,0);
+  if(err)
+    {
+    fprintf(stderr,"Error loading external parser file %s\n",fname);
+#ifdef STTP_LUAJIT
+    if(err == LUA_ERRSYNTAX)
+      fprintf(stderr,"(LuaJIT takes Lua 5.1 syntax: use bit.band, bit.bor, bit.bxor, "
+                     "bit.lshift and bit.rshift for the Lua 5.3 operators & | ~ << >>, "
+                     "and math.floor(a/b) for a//b)\n");
+#endif
+    ExitError(2,lua_tostring(L,-1));
+    }
+
+  tLuaParser *P = new tLuaParser;
+  P->L = L;
+  P->ParseRef = P->BatchRef = P->FrameRef = LUA_NOREF;
+  P->Framer = NULL;
+  P->BatchCount = 0;
+  Parsers.push_back(P);
+
+  //Buffers instead of strings if the script asks for them.
+  lua_getglobal(L,"sttp_buffers");
+  P->UseBuffers = lua_toboolean(L,-1);
+  lua_pop(L,1);
+  lua_newtable(L);
+  P->LiveRef = luaL_ref(L,LUA_REGISTRYINDEX);
+
+  //Pointers for FFI scripts.
+  lua_getglobal(L,"sttp_ffi");
+  P->UseFFI = lua_toboolean(L,-1);
+  lua_pop(L,1);
+#ifndef STTP_LUAJIT
+  if(P->UseFFI)
+    ExitError(2,"sttp_ffi needs sttp built with LuaJIT (make LUA=luajit)\n");
+#endif
+
+  //A frame spec means frames go to ParseFrame.
+  lua_getglobal(L,"sttp_frame");
+  if(lua_istable(L,-1))
+    {
+    FrameSetup(P);
+    lua_pop(L,1);
+    lua_getglobal(L,"ParseFrame");
+    if(!lua_isfunction(L,-1))
+      ExitError(2,"ParseFrame function not found in external parser.");
+    P->FrameRef = FunctionRef(P,"frame");
+    return(L);
+    }
+  lua_pop(L,1);
+
+  //Find the parser function.  A script that provides ParseBatch gets
+  //batches of subpackets, otherwise ParseData is called for each one.
+  lua_getglobal(L,"ParseBatch");
+  if(lua_isfunction(L,-1))
+    P->BatchRef = FunctionRef(P,"batch");
+  else
+    {
+    lua_pop(L,1);
+    lua_getglobal(L,"ParseData");
+    if(!lua_isfunction(L,-1))
+      ExitError(2,"ParseData function not found in external parser.");
+    P->ParseRef = FunctionRef(P,"data");
+    }
+  return(L);
+  }
+
+//========================================================================
+//                          LuaClose
+//========================================================================
+//Close a state made by LuaSetup.
+void LuaClose(lua_State *L)
+  {
+  tLuaParser *P = Parser(L);
+  for(size_t i=0; i<Parsers.size(); ++i)
+    if(Parsers[i] == P)
+      Parsers.erase(Parsers.begin()+i);
+  lua_close(L);
+  delete P->Framer;
+  delete P;
+  }
+
+//========================================================================
+//                          LuaReset
+//========================================================================
+//Readies the script of L for the next archive (ArchFilePath) by calling
+//its Reset function with the table sttp_getPaths would return.  Returns
+//false if the script has no Reset, and so has to be loaded again.
+bool LuaReset(lua_State *L)
+  {
+  tLuaParser *P = Parser(L);
+  lua_getglobal(L,"Reset");
+  if(!lua_isfunction(L,-1))
+    {
+    lua_settop(L,0);
+    return(false);
+    }
+  if(P->Framer)
+    P->Framer->Reset();
+  sttp_getPaths(L);
+  if(lua_pcall(L,1,0,0))
+    ExitError(2,lua_tostring(L,-1));
+  lua_settop(L,0);
+  return(true);
+  }
+
+//========================================================================
+//                          LuaCacheSetup
+//========================================================================
+//Directory for compiled scripts (--lua-cache).  Return false if we run into
+//a problem.
+bool LuaCacheSetup(std::string dir)
+  {
+  struct stat st;
+  if(dir.length() && (stat(dir.c_str(),&st) || !(st.st_mode & S_IFDIR)))
+    {
+    fprintf(stderr,"--lua-cache %s is not a directory\n",dir.c_str());
+    return(false);
+    }
+  CacheDir = dir;
+  return(true);
+  }
+
+//========================================================================
+//                          LuaBatchSetup
+//========================================================================
+//Set the batch size for ParseBatch in KB.  Without it a batch is one A2
+//packet.  Return false if we run into a problem.
+bool LuaBatchSetup(std::string kb)
+  {
+  if(kb.length())
+    {
+    double k = atof(kb.c_str());
+    if(k <= 0)
+      {
+      fprintf(stderr,"Invalid --lua-batch\n");
+      return(false);
+      }
+    BatchLimit = (size_t)(k*1024);
+    }
+  return(true);
+  }
+
+
+//========================================================================
+//                          LuaParse
+//========================================================================
+//Hand a subpacket to the script, or to the parallel parser states.
+void LuaParse(lua_State *L, std::string &subpkt, double RT, std::string &TS)
+  {
+  PROFILE_SCOPE(PROF_LUA);
+  if(LuaWorkersRunning())
+    LuaWorkersAdd(subpkt.c_str(),subpkt.length(),RT,TS);
+  else
+    LuaStateParse(L,subpkt.c_str(),subpkt.length(),RT,TS);
+  }
+
+//========================================================================
+//                          LuaPacketEnd
+//========================================================================
+//Called after the last subpacket of each A2 packet.
+void LuaPacketEnd(lua_State *L)
+  {
+  PROFILE_SCOPE(PROF_LUA);
+  if(LuaWorkersRunning())
+    LuaWorkersPacketEnd();
+  else
+    LuaStatePacketEnd(L);
+  }
+
+//========================================================================
+//                          LuaFlush
+//========================================================================
+//Called at the end of the archive.
+void LuaFlush(lua_State *L)
+  {
+  PROFILE_SCOPE(PROF_LUA);
+  if(LuaWorkersRunning())
+    LuaWorkersFinish();
+  else
+    LuaStateFlush(L);
+  }
+
+//========================================================================
+//                          LuaStateParse
+//========================================================================
+//Hand a subpacket to the script of state L.
+void LuaStateParse(lua_State *L, const char *data, size_t n, double RT, const std::string &TS)
+  {
+  tLuaParser *P = Parser(L);
+  if(P->Framer)
+    {
+    P->Framer->Add(data,n,RT,TS);
+    return;
+    }
+
+  //Batching script: queue the subpacket and send the batch once it is big
+  //enough.  Slots are reused from batch to batch.
+  if(P->BatchRef != LUA_NOREF)
+    {
+    size_t k = P->BatchCount;
+    if(k == P->BatchRT.size())
+      {
+      P->BatchRT.push_back(RT);
+      P->BatchTS.push_back(TS);
+      }
+    else
+      {
+      P->BatchRT[k] = RT;
+      P->BatchTS[k] = TS;
+      }
+    P->BatchData.append(data,n);
+    if(k == P->BatchEnd.size())
+      P->BatchEnd.push_back(P->BatchData.length());
+    else
+      P->BatchEnd[k] = P->BatchData.length();
+    ++P->BatchCount;
+    if(BatchLimit && (P->BatchData.length() >= BatchLimit))
+      LuaStateFlush(L);
+    return;
+    }
+
+  //Get the function onto the stack
+  lua_rawgeti(L,LUA_REGISTRYINDEX,P->ParseRef);
+
+  //Push the parameters onto the stack
+  lua_pushnumber(L,RT);                               //RT as double
+  lua_pushstring(L,TS.c_str());                       //Timestamp str
+  int nd = PushData(P,data,n);                        //Data
+  
+  //Call the parser function in the Lua module
+  PROFILE_COUNT(PROF_LUA_CALLS,1);
+  STTP_PROBE3(lua_enter,PROBE_PARSEDATA,(unsigned long)(RT*1000),n);
+  if(lua_pcall(L,2+nd,0,0))
+    ExitError(2,lua_tostring(L,-1));
+  STTP_PROBE3(lua_exit,PROBE_PARSEDATA,(unsigned long)(RT*1000),n);
+  ReleaseBuffers(P);
+  lua_settop(L,0);
+  }
+
+//========================================================================
+//                          LuaStateFlush
+//========================================================================
+//Hand the queued subpackets of state L to ParseBatch as three arrays of
+//equal length: run times (sec), timestamp strings and data.
+void LuaStateFlush(lua_State *L)
+  {
+  tLuaParser *P = Parser(L);
+  if((P->BatchRef == LUA_NOREF) || !P->BatchCount)
+    return;
+
+  //FFI scripts get a fourth array, of lengths.
+  int nt = P->UseFFI ? 4 : 3;
+  lua_rawgeti(L,LUA_REGISTRYINDEX,P->BatchRef);
+  for(int t=0; t<nt; ++t)
+    lua_createtable(L,(int)P->BatchCount,0);
+  size_t start = 0;
+  for(size_t i=0; i<P->BatchCount; ++i)
+    {
+    lua_pushnumber(L,P->BatchRT[i]);
+    lua_rawseti(L,-1-nt,i+1);
+    lua_pushlstring(L,P->BatchTS[i].c_str(),P->BatchTS[i].length());
+    lua_rawseti(L,-nt,i+1);
+    if(PushData(P,P->BatchData.c_str()+start,P->BatchEnd[i]-start) == 2)
+      {
+      //length, then pointer
+      lua_rawseti(L,-3,i+1);
+      lua_rawseti(L,-3,i+1);
+      }
+    else
+      lua_rawseti(L,-2,i+1);
+    start = P->BatchEnd[i];
+    }
+  STTP_PROBE3(flush,PROBE_LUABATCH,P->BatchCount,P->BatchData.length());
+  P->BatchCount = 0;
+
+  PROFILE_COUNT(PROF_LUA_CALLS,1);
+  STTP_PROBE3(lua_enter,PROBE_PARSEBATCH,(unsigned long)(P->BatchRT[0]*1000),P->BatchData.length());
+  if(lua_pcall(L,nt,0,0))
+    ExitError(2,lua_tostring(L,-1));
+  STTP_PROBE3(lua_exit,PROBE_PARSEBATCH,(unsigned long)(P->BatchRT[0]*1000),P->BatchData.length());
+  ReleaseBuffers(P);
+  P->BatchData.clear();
+  lua_settop(L,0);
+  }
+
+//========================================================================
+//                          LuaStatePacketEnd
+//========================================================================
+void LuaStatePacketEnd(lua_State *L)
+  {
+  if(!BatchLimit)
+    LuaStateFlush(L);
+  }
+
+//========================================================================
+//                          LuaStateReset
+//========================================================================
+//State L is about to get data that doesn't follow what it had before.  Drop
+//any partial frame and let the script do the same through
+//sttp_parallel.reset, if it has one.
+void LuaStateReset(lua_State *L)
+  {
+  tLuaParser *P = Parser(L);
+  if(P->Framer)
+    P->Framer->Reset();
+  lua_getglobal(L,"sttp_parallel");
+  if(lua_istable(L,-1))
+    {
+    lua_getfield(L,-1,"reset");
+    if(lua_isfunction(L,-1))
+      {
+      if(lua_pcall(L,0,0,0))
+        ExitError(2,lua_tostring(L,-1));
+      }
+    }
+  lua_settop(L,0);
+  }
+
+//========================================================================
+//                          LuaParallelSpec
+//========================================================================
+//Whether the script of L allows parallel parsing (declares sttp_parallel),
+//and the overlap it needs.
+bool LuaParallelSpec(lua_State *L, size_t *overlap)
+  {
+  bool par = false;
+  *overlap = 0;
+  lua_getglobal(L,"sttp_parallel");
+  if(lua_istable(L,-1))
+    {
+    par = true;
+    lua_getfield(L,-1,"overlap_bytes");
+    if(!lua_isnil(L,-1))
+      {
+      if(!lua_isinteger(L,-1))
+        ExitError(2,"sttp_parallel: overlap_bytes must be an integer\n");
+      lua_Integer k = lua_tointeger(L,-1);
+      *overlap = (k > 0) ? (size_t)k : 0;
+      }
+    }
+  lua_settop(L,0);
+  return(par);
+  }
@@ -0,0 +1,220 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+//Native parser plugins (-X).  The plugin library is loaded once, handed
+//the subpackets of each A2 packet in one parse_batch call and finished
+//when the archive has been read.  See sttp_plugin.h for the interface.
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#ifdef _WIN32
+#include <conio.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+#include "sttp.h"
+#include "sttp_plugin.h"
+
+static std::string PluginName;        //path given with -X
+static void *Lib = NULL;              //loaded library, NULL if none
+static void *Ctx = NULL;              //plugin state from init
+static sttp_plugin_parse_fn ParseFn = NULL;
+static sttp_plugin_finish_fn FinishFn = NULL;
+
+//Subpackets of the current A2 packet.  The data of all of them is kept end
+//to end in Data, End[i] is where subpacket i ends.  The vectors only grow,
+//Count is how many entries are in use.
+static size_t Count = 0;
+static std::vector<double> RT;
+static std::vector<long long> MS;
+static std::vector<std::string> TS;
+static std::vector<size_t> End;
+static std::string Data;
+static std::vector<sttp_subpacket> Subs;
+
+//Epoch (ms) of the start of the hour of the last subpacket, since mktime
+//is slow enough to show at one call per subpacket.
+static tTCP HourTCP = {0};
+static long long HourMS = 0;
+
+//========================================================================
+//                           LibSymbol
+//========================================================================
+//Looks up an export of the plugin library, exiting if it is missing.
+static void *LibSymbol(const char *name)
+  {
+#ifdef _WIN32
+  void *f = (void *)GetProcAddress((HMODULE)Lib,name);
+#else
+  void *f = dlsym(Lib,name);
+#endif
+  if(!f)
+    ExitError(1,"Plugin %s does not export %s\n",PluginName.c_str(),name);
+  return(f);
+  }
+
+//========================================================================
+//                           PluginLoad
+//========================================================================
+//Loads the plugin library and calls its init function.  args is passed to
+//the plugin as is.
+void PluginLoad(const char *path, std::string args)
+  {
+  PluginName = path;
+#ifdef _WIN32
+  Lib = (void *)LoadLibraryA(path);
+  if(!Lib)
+    ExitError(1,"Unable to load plugin %s (error %lu)\n",path,(unsigned long)GetLastError());
+#else
+  //A bare name would be searched for on the library path, not here.
+  std::string p = path;
+  if(p.find('/') == std::string::npos)
+    p = "./" + p;
+  Lib = dlopen(p.c_str(),RTLD_NOW|RTLD_LOCAL);
+  if(!Lib)
+    ExitError(1,"Unable to load plugin %s (%s)\n",path,dlerror());
+#endif
+  sttp_plugin_init_fn InitFn = (sttp_plugin_init_fn)LibSymbol(STTP_PLUGIN_INIT);
+  ParseFn = (sttp_plugin_parse_fn)LibSymbol(STTP_PLUGIN_PARSE);
+  FinishFn = (sttp_plugin_finish_fn)LibSymbol(STTP_PLUGIN_FINISH);
+
+  char drive[_MAX_DRIVE], dir[_MAX_DIR], name[_MAX_FNAME], ext[_MAX_EXT];
+  char absPath[_MAX_PATH];
+  _fullpath(absPath,ArchFilePath.c_str(),_MAX_PATH);
+  _splitpath(absPath,drive,dir,name,ext);
+  std::string ArchPath = std::string(drive) + std::string(dir);
+
+  sttp_plugin_info info;
+  info.abi = STTP_PLUGIN_ABI;
+  info.archive = absPath;
+  info.archive_path = ArchPath.c_str();
+  info.archive_name = name;
+  info.args = args.c_str();
+  info.ts_format = TFormat.c_str();
+  info.suppress_msec = SuppressMSec;
+  int ret = InitFn(&info,&Ctx);
+  if(ret)
+    ExitError(1,"Plugin %s failed to initialize (%d)\n",path,ret);
+  if(info.abi != STTP_PLUGIN_ABI)
+    ExitError(1,"Plugin %s was built for interface version %d, sttp has %d\n",
+              path,info.abi,STTP_PLUGIN_ABI);
+
+  //The plugin may have chosen its own timestamp format, as a Lua script
+  //can with sttp_setTSFormat.
+  TFormat = info.ts_format ? info.ts_format : "";
+  SuppressMSec = info.suppress_msec != 0;
+  }
+
+bool PluginLoaded()
+  {
+  return(Lib != NULL);
+  }
+
+//========================================================================
+//                           PluginAdd
+//========================================================================
+//Adds a subpacket to the batch of the current A2 packet.  tcp is its time
+//and timestamp the formatted time.
+void PluginAdd(std::string &subpkt, double rt, tTCP &tcp, std::string &timestamp)
+  {
+  PROFILE_SCOPE(PROF_PLUGIN);
+  if(Count == RT.size())
+    {
+    RT.push_back(0);
+    MS.push_back(0);
+    TS.push_back(std::string());
+    End.push_back(0);
+    }
+  RT[Count] = rt;
+  if(tcp.hour != HourTCP.hour || tcp.day != HourTCP.day ||
+     tcp.month != HourTCP.month || tcp.year != HourTCP.year)
+    {
+    HourTCP = tcp;
+    HourTCP.min = HourTCP.sec = HourTCP.msec = 0;
+    HourMS = (long long)floor(TCPEpoch(HourTCP)*1000 + 0.5);
+    }
+  MS[Count] = HourMS + (tcp.min*60 + tcp.sec)*1000LL + tcp.msec;
+  TS[Count] = timestamp;
+  Data += subpkt;
+  End[Count] = Data.size();
+  ++Count;
+  }
+
+//========================================================================
+//                         PluginPacketEnd
+//========================================================================
+//Hands the subpackets of the A2 packet just decoded to the plugin.
+void PluginPacketEnd()
+  {
+  if(!Count)
+    return;
+  PROFILE_SCOPE(PROF_PLUGIN);
+
+  //Data doesn't move any more, so the views can be made now.
+  Subs.resize(Count);
+  size_t start = 0;
+  for(size_t i=0; i<Count; ++i)
+    {
+    Subs[i].rt = RT[i];
+    Subs[i].epoch_ms = MS[i];
+    Subs[i].ts = TS[i].c_str();
+    Subs[i].data = (const unsigned char *)Data.data() + start;
+    Subs[i].len = End[i] - start;
+    start = End[i];
+    }
+
+  STTP_PROBE3(flush,PROBE_PLUGINBATCH,Count,Data.length());
+  int ret = ParseFn(Ctx,&Subs[0],Count);
+  if(ret)
+    ExitError(1,"Plugin %s failed parsing data (%d)\n",PluginName.c_str(),ret);
+  Count = 0;
+  Data.clear();
+  }
+
+//========================================================================
+//                          PluginFinish
+//========================================================================
+//Hands over any subpackets still waiting, lets the plugin finish and
+//unloads it.
+void PluginFinish()
+  {
+  if(!Lib)
+    return;
+  PluginPacketEnd();
+  int ret = FinishFn(Ctx);
+  if(ret)
+    ExitError(1,"Plugin %s failed to finish (%d)\n",PluginName.c_str(),ret);
+#ifdef _WIN32
+  FreeLibrary((HMODULE)Lib);
+#else
+  dlclose(Lib);
+#endif
+  Lib = NULL;
+  }
@@ -0,0 +1,148 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+//Stage timers and counters for --profile.  sttp built with make PROFILE=1
+//(STTP_PROFILE) times each stage of the decode with PROFILE_SCOPE and
+//counts what it handles with PROFILE_COUNT; without it both are empty
+//and none of this is compiled.
+//
+//Stage times are exclusive: a stage inside another (the checksum inside
+//framing, the timestamp inside the -n line handling) is taken off the
+//time of the outer one, so the stages add up to the run.  Timers are only
+//used on the main thread.  Each costs two clock reads, which are counted
+//in the stage.
+
+#ifdef STTP_PROFILE
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include "sttp.h"
+
+typedef std::chrono::steady_clock tClock;
+
+static bool Profiling = false;
+static long long StartTicks;
+static tProfileScope *Current = NULL;   //innermost running scope
+static double StageTime[PROF_NSTAGES];   //exclusive seconds
+static unsigned long long StageCalls[PROF_NSTAGES];
+static std::atomic<unsigned long long> Counts[PROF_NCOUNTS];
+
+static const char *StageNames[PROF_NSTAGES] =
+  {
+  "framing", "checksum", "TCP look-ahead", "timestamps", "formatting",
+  "Lua calls", "plugin calls", "writes", "line output (-n)", "analysis"
+  };
+
+static long long Ticks()
+  {
+  return(tClock::now().time_since_epoch().count());
+  }
+
+static double Seconds(long long ticks)
+  {
+  return(ticks*(double)tClock::period::num/tClock::period::den);
+  }
+
+//========================================================================
+//                          tProfileScope
+//========================================================================
+tProfileScope::tProfileScope(int stage)
+  {
+  Stage = Profiling ? stage : -1;
+  if(Stage < 0)
+    return;
+  Parent = Current;
+  Current = this;
+  Child = 0;
+  T0 = Ticks();
+  }
+
+tProfileScope::~tProfileScope()
+  {
+  if(Stage < 0)
+    return;
+  long long dt = Ticks() - T0;
+  StageTime[Stage] += Seconds(dt - Child);
+  ++StageCalls[Stage];
+  Current = Parent;
+  if(Parent)
+    Parent->Child += dt;
+  }
+
+//========================================================================
+//                          ProfileCount
+//========================================================================
+//Counts can come from the Lua worker threads.
+void ProfileCount(int counter, unsigned long long n)
+  {
+  if(Profiling)
+    Counts[counter].fetch_add(n,std::memory_order_relaxed);
+  }
+
+//========================================================================
+//                          ProfileStart
+//========================================================================
+void ProfileStart()
+  {
+  Profiling = true;
+  StartTicks = Ticks();
+  }
+
+//========================================================================
+//                          ProfileReport
+//========================================================================
+//Time of each stage, the rest of the run as "other", and the counts.
+void ProfileReport(FILE *fp)
+  {
+  if(!Profiling)
+    return;
+  double total = Seconds(Ticks() - StartTicks);
+  double staged = 0;
+  fprintf(fp,"Profile, %.3f s:\n",total);
+  fprintf(fp,"  %-18s %10s %7s %12s\n","stage","time(s)","%","calls");
+  for(int i=0; i<PROF_NSTAGES; ++i)
+    {
+    if(!StageCalls[i])
+      continue;
+    fprintf(fp,"  %-18s %10.3f %6.1f%% %12llu\n",StageNames[i],StageTime[i],
+            total > 0 ? 100*StageTime[i]/total : 0,StageCalls[i]);
+    staged += StageTime[i];
+    }
+  fprintf(fp,"  %-18s %10.3f %6.1f%%\n","other",total - staged,
+          total > 0 ? 100*(total - staged)/total : 0);
+
+  unsigned long long in = Counts[PROF_BYTES_IN], out = Counts[PROF_BYTES_OUT];
+  fprintf(fp,"  archive bytes      %12llu  %.1f MB/s\n",in,total > 0 ? in/total/1e6 : 0);
+  fprintf(fp,"  output bytes       %12llu  %.1f MB/s\n",out,total > 0 ? out/total/1e6 : 0);
+  fprintf(fp,"  A2 packets         %12llu\n",(unsigned long long)Counts[PROF_A2]);
+  fprintf(fp,"  A3 packets         %12llu\n",(unsigned long long)Counts[PROF_A3]);
+  fprintf(fp,"  subpackets         %12llu\n",(unsigned long long)Counts[PROF_SUBPACKETS]);
+  fprintf(fp,"  timestamped lines  %12llu\n",(unsigned long long)Counts[PROF_LINES_OUT]);
+  fprintf(fp,"  Lua calls          %12llu\n",(unsigned long long)Counts[PROF_LUA_CALLS]);
+  fprintf(fp,"  erased bytes       %12llu  (0xFF/0x00, skipped in blocks)\n",
+          (unsigned long long)Counts[PROF_ERASED]);
+  }
+
+#endif
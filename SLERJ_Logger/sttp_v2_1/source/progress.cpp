@@ -0,0 +1,292 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+//Progress of a long conversion (--progress, --status).  The decoder
+//updates a few relaxed atomics per packet: the archive offset, the packet
+//count and the run time.  A reporter thread samples them each interval and
+//shows percent done, MB/s, packets/s, the time left and the archive's UTC
+//time on stderr, and with --status writes the same as a JSON line to a
+//file or an inherited file descriptor (fd:N), so a job runner can follow
+//many conversions.  The last line has "state":"done".
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "sttp.h"
+
+typedef std::chrono::steady_clock tClock;
+
+static bool Show = false;                 //--progress
+static FILE *fpStatus = NULL;             //--status
+static double Every = 1;                  //seconds between reports
+static std::vector<std::string> Paths;
+static std::vector<unsigned long long> Sizes;
+static unsigned long long Total = 0;      //bytes of all the archives
+static tClock::time_point T0;
+
+//Updated by the decoder
+static std::atomic<int> Archive(0);
+static std::atomic<unsigned long long> Before(0);     //bytes of the archives done
+static std::atomic<unsigned long long> Pos(0);        //in the current archive
+static std::atomic<unsigned long long> Packets(0);
+static std::atomic<long long> TCPms(0);               //UTC of the last TCP, 0 for none
+static std::atomic<unsigned long> TCPRT(0);           //its run time, ms
+static std::atomic<unsigned long> RTms(0);            //run time of the last packet
+
+static std::thread *Reporter = NULL;
+static std::mutex StopMutex;
+static std::condition_variable StopCV;
+static bool Stop = false;
+
+//========================================================================
+//                          ProgressSetup
+//========================================================================
+//status is a file name or fd:N, every the report interval in seconds.
+//Return false if we run into a problem, true if good to go.
+bool ProgressSetup(bool show, std::string status, std::string every)
+  {
+  Show = show;
+  if(every.length())
+    Every = atof(every.c_str());
+  if(Every <= 0)
+    {
+    fprintf(stderr,"Invalid --progress-every\n");
+    return(false);
+    }
+  if(status.length())
+    {
+    if(status.compare(0,3,"fd:") == 0)
+      fpStatus = fdopen(atoi(status.c_str()+3),"w");
+    else
+      fpStatus = fopen(status.c_str(),"w");
+    if(!fpStatus)
+      {
+      fprintf(stderr,"Unable to open status output %s\n",status.c_str());
+      return(false);
+      }
+    }
+  return(true);
+  }
+
+static bool ProgressOn()
+  {
+  return(Show || fpStatus);
+  }
+
+//========================================================================
+//                           Reports
+//========================================================================
+static std::string Clock(double s)
+  {
+  char buf[40];
+  unsigned long t = (unsigned long)(s + 0.5);
+  sprintf(buf,"%lu:%02lu:%02lu",t/3600,(t/60)%60,t%60);
+  return(std::string(buf));
+  }
+
+//UTC text of ms since 1970.  gmtime isn't used as the decoder thread uses
+//its buffer, so the date comes from the day number (proleptic Gregorian).
+static std::string UTCText(long long ms)
+  {
+  long long s = ms/1000;
+  long long z = s/86400 + 719468;
+  long long era = z/146097;
+  long long doe = z - era*146097;
+  long long yoe = (doe - doe/1460 + doe/36524 - doe/146096)/365;
+  long long doy = doe - (365*yoe + yoe/4 - yoe/100);
+  long long mp = (5*doy + 2)/153;
+  int day = (int)(doy - (153*mp + 2)/5 + 1);
+  int month = (int)(mp < 10 ? mp + 3 : mp - 9);
+  int year = (int)(yoe + era*400 + (month <= 2));
+  char buf[40];
+  sprintf(buf,"%04d-%02d-%02d %02d:%02d:%02d",year,month,day,
+          (int)(s%86400/3600),(int)(s%3600/60),(int)(s%60));
+  return(std::string(buf));
+  }
+
+//Characters of s that need it escaped for a JSON string.
+static std::string JsonString(const std::string &s)
+  {
+  std::string o;
+  for(size_t i=0; i<s.length(); ++i)
+    {
+    if(s[i] == '"' || s[i] == '\\')
+      o.push_back('\\');
+    o.push_back(s[i]);
+    }
+  return(o);
+  }
+
+//Reports the progress so far.  Rates are over the time since the last
+//report, the time left from the average rate since the start.
+static void Report(bool done)
+  {
+  static double LastT = 0;
+  static unsigned long long LastBytes = 0, LastPackets = 0;
+  double t = std::chrono::duration<double>(tClock::now() - T0).count();
+  int a = Archive.load(std::memory_order_relaxed);
+  unsigned long long bytes = done ? Total : Before.load(std::memory_order_relaxed) +
+                                            Pos.load(std::memory_order_relaxed);
+  unsigned long long packets = Packets.load(std::memory_order_relaxed);
+  double dt = t - LastT;
+  double mbs = (dt > 0) ? (bytes - LastBytes)/dt/1e6 : 0;
+  double pps = (dt > 0) ? (packets - LastPackets)/dt : 0;
+  double pct = Total ? 100.0*bytes/Total : 100;
+  double eta = (bytes && t > 0) ? (Total - bytes)/(bytes/t) : -1;
+  LastT = t;
+  LastBytes = bytes;
+  LastPackets = packets;
+
+  //Archive UTC time from the last TCP and the run time since it.
+  std::string utc;
+  long long ms = TCPms.load(std::memory_order_relaxed);
+  if(ms)
+    utc = UTCText(ms + (long long)RTms.load(std::memory_order_relaxed) -
+                  TCPRT.load(std::memory_order_relaxed));
+
+  if(Show)
+    {
+    fprintf(stderr,"\r%5.1f%% %8.2f MB/s %8.0f pkt/s  ETA %s  %s  %s (%d/%d)  ",pct,mbs,pps,
+            eta >= 0 ? Clock(eta).c_str() : "-",utc.empty() ? "-" : utc.c_str(),
+            BaseFileName(Paths[a].c_str()).c_str(),a+1,(int)Paths.size());
+    if(done)
+      fprintf(stderr,"\n");
+    fflush(stderr);
+    }
+  if(fpStatus)
+    {
+    fprintf(fpStatus,"{\"state\":\"%s\",\"elapsed\":%.1f,\"archive\":%d,\"archives\":%d,"
+            "\"file\":\"%s\",\"bytes\":%llu,\"total\":%llu,\"percent\":%.2f,"
+            "\"mb_s\":%.3f,\"packets\":%llu,\"packets_s\":%.0f,\"eta\":%.0f,\"utc\":%s%s%s}\n",
+            done ? "done" : "running",t,a+1,(int)Paths.size(),JsonString(Paths[a]).c_str(),
+            bytes,Total,pct,mbs,packets,pps,eta,
+            utc.empty() ? "" : "\"",utc.empty() ? "null" : utc.c_str(),utc.empty() ? "" : "\"");
+    fflush(fpStatus);
+    }
+  }
+
+static void ReporterThread()
+  {
+  std::unique_lock<std::mutex> lock(StopMutex);
+  while(!StopCV.wait_for(lock,std::chrono::duration<double>(Every),[]{ return(Stop); }))
+    Report(false);
+  }
+
+//========================================================================
+//                          ProgressStart
+//========================================================================
+//Starts the reporter for the archives in paths.
+void ProgressStart(const std::vector<std::string> &paths)
+  {
+  if(!ProgressOn())
+    return;
+  Paths = paths;
+  for(size_t i=0; i<Paths.size(); ++i)
+    {
+#ifdef _WIN32
+    struct __stat64 st;
+    unsigned long long size = _stat64(Paths[i].c_str(),&st) ? 0 : st.st_size;
+#else
+    struct stat st;
+    unsigned long long size = stat(Paths[i].c_str(),&st) ? 0 : st.st_size;
+#endif
+    Sizes.push_back(size);
+    Total += size;
+    }
+  T0 = tClock::now();
+  Reporter = new std::thread(ReporterThread);
+  }
+
+//The decoder starts archive a.
+void ProgressArchive(int a)
+  {
+  if(!ProgressOn())
+    return;
+  if(a)
+    Before.fetch_add(Sizes[a-1],std::memory_order_relaxed);
+  Pos.store(0,std::memory_order_relaxed);
+  TCPms.store(0,std::memory_order_relaxed);
+  Archive.store(a,std::memory_order_relaxed);
+  }
+
+//A good packet pkt was found at offset.
+void ProgressPacket(std::string &pkt, unsigned long offset)
+  {
+  if(!ProgressOn())
+    return;
+  Pos.store(offset + pkt.length(),std::memory_order_relaxed);
+  Packets.fetch_add(1,std::memory_order_relaxed);
+  if((unsigned char)pkt[1] == 0xA3)
+    {
+    tTCP tcp = ParseTCP(pkt);
+    TCPRT.store(tcp.RT,std::memory_order_relaxed);
+    RTms.store(tcp.RT,std::memory_order_relaxed);
+    TCPms.store((long long)(TCPEpoch(tcp)*1000 + 0.5),std::memory_order_relaxed);
+    }
+  else
+    RTms.store((((unsigned long)(unsigned char)pkt[2]<<24) | ((unsigned long)(unsigned char)pkt[3]<<16) |
+                ((unsigned long)(unsigned char)pkt[4]<<8) | (unsigned char)pkt[5])*1000,
+               std::memory_order_relaxed);
+  }
+
+//A good packet ending bytes after the last one (or the start of the part)
+//was found by a worker decoding part of the archive (DecodeSessions).
+//The parts go on at once, so their bytes are added up instead.
+void ProgressPartPacket(unsigned long long bytes)
+  {
+  if(!ProgressOn())
+    return;
+  Pos.fetch_add(bytes,std::memory_order_relaxed);
+  Packets.fetch_add(1,std::memory_order_relaxed);
+  }
+
+//========================================================================
+//                          ProgressFinish
+//========================================================================
+//Stops the reporter after a last report.
+void ProgressFinish()
+  {
+  if(!Reporter)
+    return;
+
+  //Stop is set under the lock so the reporter can't miss the notify.
+    {
+    std::lock_guard<std::mutex> lock(StopMutex);
+    Stop = true;
+    }
+  StopCV.notify_one();
+  Reporter->join();
+  delete Reporter;
+  Reporter = NULL;
+  Report(true);
+  if(fpStatus)
+    fclose(fpStatus);
+  fpStatus = NULL;
+  }
@@ -0,0 +1,229 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+//Resampling of timestamped line values onto a uniform time grid.  Lines
+//from the BRPT arrive at irregular times (the sketch loop is paced by the
+//sensor conversions plus a delay, and the SSR tags data to 2 ms), while
+//spectral analysis needs samples at exact intervals.  The resampler keeps a
+//sliding window of the last four samples and interpolates each grid point
+//as soon as the samples around it have arrived, so memory use does not
+//depend on the archive length.  Gaps longer than GridMaxGap are not
+//bridged; the grid restarts after the gap and the first point is flagged.
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "sttp.h"
+
+double GridRate = 16;
+int GridOrder = 1;
+double GridMaxGap = 0.5;
+
+//========================================================================
+//                        ResampleSetup
+//========================================================================
+//Parse the --rate, --interp and --maxgap options.  Empty strings keep the
+//defaults.  Return false if we run into a problem, true if good to go.
+bool ResampleSetup(std::string rate, std::string interp, std::string maxgap)
+  {
+  if(rate.length())
+    GridRate = atof(rate.c_str());
+  if(maxgap.length())
+    GridMaxGap = atof(maxgap.c_str());
+  if(interp == "cubic")
+    GridOrder = 3;
+  else if(interp.length() && interp != "linear")
+    {
+    fprintf(stderr,"Unknown interpolation '%s', use linear or cubic\n",interp.c_str());
+    return(false);
+    }
+  if(GridRate <= 0 || GridMaxGap <= 0)
+    {
+    fprintf(stderr,"Grid rate and maximum gap must be positive\n");
+    return(false);
+    }
+  return(true);
+  }
+
+//========================================================================
+//                        tResampler
+//========================================================================
+tResampler::tResampler()
+  {
+  Setup(GridRate,GridOrder,GridMaxGap);
+  }
+
+void tResampler::Setup(double rate, int order, double maxgap)
+  {
+  Rate = rate;
+  Order = order;
+  MaxGap = maxgap;
+  S.clear();
+  NextGrid = 0;
+  Gap = false;
+  }
+
+//Add the next (irregular) sample.  Grid points are produced for the
+//interval that is complete: for linear interpolation the one ending at
+//this sample, for cubic the one before it, since a cubic also needs the
+//sample following the interval.
+void tResampler::Add(const tSample &s)
+  {
+  if(!S.empty())
+    {
+    double dt = s.t - S.back().t;
+
+    //Two lines stamped in the same SSR frame carry the same time.  Keep
+    //the first, a zero length interval can't be interpolated.
+    if(dt == 0)
+      return;
+
+    //Don't bridge long gaps, clock steps back, or the space between
+    //interval windows.  Finish this run and start a new one.
+    if((dt > MaxGap) || (dt < 0) || (s.win != S.back().win))
+      Flush();
+    }
+
+  if(S.empty())
+    NextGrid = (long long)ceil(s.t*Rate);
+  S.push_back(s);
+  if(S.size() > 4)
+    S.erase(S.begin());
+
+  size_t n = S.size();
+  if(n < 2)
+    return;
+  if(Order == 1)
+    Emit(n-2, n-2, n-1, false);
+  else if(n >= 3)
+    Emit(n-3, (n >= 4) ? n-4 : n-3, n-1, false);
+  }
+
+//Finish the current run, producing the grid points up to and including
+//the last sample.  The next sample starts a new run after a gap.
+void tResampler::Flush()
+  {
+  size_t n = S.size();
+  if(n >= 2)
+    Emit(n-2, ((Order == 3) && (n >= 3)) ? n-3 : n-2, n-1, true);
+  S.clear();
+  Gap = true;
+  }
+
+//Produce the grid points between samples S[i] and S[i+1] by Lagrange
+//interpolation through samples S[p0..p1] (two points is linear, four is
+//cubic).  Times are taken relative to S[i] to keep full precision.
+void tResampler::Emit(size_t i, size_t p0, size_t p1, bool inclusive)
+  {
+  if(i+1 >= S.size())
+    return;
+  double t0 = S[i].t;
+  double tend = S[i+1].t - t0;
+  size_t nch = 0;
+  for(size_t j=p0; j<=p1; ++j)
+    if(S[j].vals.size() > nch)
+      nch = S[j].vals.size();
+
+  for(;;)
+    {
+    double tg = NextGrid/Rate;
+    double x = tg - t0;
+    if((x > tend) || (!inclusive && (x >= tend)))
+      break;
+
+    //Lagrange basis weights for this grid point
+    double w[4];
+    for(size_t j=p0; j<=p1; ++j)
+      {
+      w[j-p0] = 1;
+      for(size_t m=p0; m<=p1; ++m)
+        if(m != j)
+          w[j-p0] *= (x - (S[m].t - t0))/(S[j].t - S[m].t);
+      }
+
+    //Weighted sum per channel.  A field missing or non-numeric in any of
+    //the samples used gives NaN.
+    V.assign(nch,0);
+    for(size_t j=p0; j<=p1; ++j)
+      for(size_t c=0; c<nch; ++c)
+        V[c] += (c < S[j].vals.size()) ? w[j-p0]*S[j].vals[c] : NAN;
+
+    GridPoint(tg, S[i].win, V, Gap);
+    Gap = false;
+    ++NextGrid;
+    }
+  }
+
+//========================================================================
+//                        Grid file output
+//========================================================================
+//Resampler that writes each grid point as a line: timestamp, gap flag (1
+//if a gap precedes the point), then the interpolated channel values.
+class tGridWriter : public tResampler
+  {
+  public:
+    FILE *fp;
+    bool Hdrs;
+
+    tGridWriter() : fp(NULL), Hdrs(false) {}
+
+    virtual void GridPoint(double t, unsigned long, const std::vector<double> &v, bool gap)
+      {
+      if(Hdrs)
+        {
+        fprintf(fp,"Time Gap");
+        for(unsigned c=1; c<=v.size(); ++c)
+          fprintf(fp," V%u",c);
+        fprintf(fp,"\n");
+        Hdrs = false;
+        }
+      tTCP tcp = EpochTCP(t);
+      std::string ts = ColumnTimeStamp(tcp);
+      fprintf(fp,"%s %d",ts.c_str(),gap ? 1 : 0);
+      for(size_t c=0; c<v.size(); ++c)
+        WriteNumber(fp,v[c]);
+      fprintf(fp,"\n");
+      }
+  };
+
+static tGridWriter Grid;
+
+void GridSetup(FILE *fp, bool WriteHdrs)
+  {
+  Grid.Setup(GridRate,GridOrder,GridMaxGap);
+  Grid.fp = fp;
+  Grid.Hdrs = WriteHdrs;
+  }
+
+void GridAddSample(const tSample &s)
+  {
+  if(Grid.fp)
+    Grid.Add(s);
+  }
+
+void GridFinish()
+  {
+  if(Grid.fp)
+    Grid.Flush();
+  }
@@ -0,0 +1,503 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+//Integrity scan of an archive (--scan).  The archive is framed and
+//checksummed as GetPacket does, finding the same packets, but without
+//decoding or writing anything, and reported on: valid A2 and A3 packets,
+//checksum failures, framing errors, the regions skipped between packets
+//(and which of them are erased flash), TCP gaps, run time restarts
+//(power cycles) and the drift of the run time clock between TCPs.
+//
+//The file is read through memory mapped views, so the OS reads it ahead
+//and nothing is copied, and the search for the 0x82 start byte is memchr,
+//which the C library does 16 or 32 bytes at a time.  Checksums are summed
+//in a form the compiler vectorizes.  A multi-GB archive scans in seconds,
+//about as fast as it can be read.
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "sttp.h"
+
+#define SCAN_VIEW (1024*1024)     //bytes usually mapped at a time
+#define SCAN_ALIGN (64*1024)      //view offsets are multiples of this
+#define SCAN_LIST 20              //items listed of each kind
+
+//A read only view of part of the archive file.
+typedef struct
+  {
+#ifdef _WIN32
+  HANDLE file, map;
+#else
+  int fd;
+#endif
+  unsigned long long size;        //file size
+  unsigned long long off;         //file offset of the view
+  size_t len;                     //bytes in the view
+  size_t want;                    //bytes to map, more for a long packet
+  const unsigned char *p;         //the view, NULL if none
+  } tMap;
+
+//========================================================================
+//                          Mapped views
+//========================================================================
+static bool MapOpen(tMap &m, const char *path)
+  {
+  m.p = NULL;
+  m.off = 0;
+  m.len = 0;
+  m.want = SCAN_VIEW;
+  m.size = 0;
+#ifdef _WIN32
+  m.map = NULL;
+  m.file = CreateFileA(path,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,
+                       FILE_FLAG_SEQUENTIAL_SCAN,NULL);
+  if(m.file == INVALID_HANDLE_VALUE)
+    return(false);
+  LARGE_INTEGER sz;
+  if(GetFileSizeEx(m.file,&sz))
+    m.size = sz.QuadPart;
+  m.map = m.size ? CreateFileMappingA(m.file,NULL,PAGE_READONLY,0,0,NULL) : NULL;
+  if(m.size && !m.map)
+    {
+    CloseHandle(m.file);
+    return(false);
+    }
+#else
+  m.fd = open(path,O_RDONLY);
+  if(m.fd < 0)
+    return(false);
+  struct stat st;
+  if(fstat(m.fd,&st) == 0)
+    m.size = st.st_size;
+#endif
+  return(true);
+  }
+
+static void MapRelease(tMap &m)
+  {
+  if(!m.p)
+    return;
+#ifdef _WIN32
+  UnmapViewOfFile((void *)m.p);
+#else
+  munmap((void *)m.p,m.len);
+#endif
+  m.p = NULL;
+  }
+
+//Maps the view holding off, from the alignment boundary at or below it.
+static void MapView(tMap &m, unsigned long long off)
+  {
+  MapRelease(m);
+  m.off = off - off%SCAN_ALIGN;
+  m.len = (size_t)std::min<unsigned long long>(m.want,m.size - m.off);
+#ifdef _WIN32
+  m.p = (const unsigned char *)MapViewOfFile(m.map,FILE_MAP_READ,(DWORD)(m.off>>32),
+                                             (DWORD)(m.off & 0xFFFFFFFF),m.len);
+#else
+  void *v = mmap(NULL,m.len,PROT_READ,MAP_PRIVATE,m.fd,m.off);
+  m.p = (v == MAP_FAILED) ? NULL : (const unsigned char *)v;
+  if(m.p)
+    madvise(v,m.len,MADV_SEQUENTIAL);
+#endif
+  if(!m.p)
+    ExitError(1,"Unable to map the archive at offset %llu\n",m.off);
+  }
+
+static void MapClose(tMap &m)
+  {
+  MapRelease(m);
+#ifdef _WIN32
+  if(m.map)
+    CloseHandle(m.map);
+  CloseHandle(m.file);
+#else
+  close(m.fd);
+#endif
+  }
+
+//========================================================================
+//                            Packets
+//========================================================================
+//True if the Fletcher checksum of the n bytes at p is ck[0],ck[1].  The
+//second sum is the first weighted by how many sums each byte is in, so
+//the loop has no carried dependency between bytes.
+static bool Fletcher(const unsigned char *p, size_t n, const unsigned char *ck)
+  {
+  unsigned int s0 = 0, s1 = 0;
+  for(size_t i=0; i<n; ++i)
+    {
+    s0 += p[i];
+    s1 += (unsigned int)(n - i)*p[i];
+    }
+  return(((s0 & 0xFF) == ck[0]) && ((s1 & 0xFF) == ck[1]));
+  }
+
+//Looks for the next packet in p[at..n) with the rules of GetPacket.  The
+//0x82 of what was found is at *start, and for a packet or a failed one
+//*len is its length.  SCAN_SHORT is a packet running past n.
+static int NextPacket(const unsigned char *p, size_t n, size_t at, size_t *start, size_t *len)
+  {
+  for(;;)
+    {
+    const unsigned char *q = (at < n) ? (const unsigned char *)memchr(p+at,0x82,n-at) : NULL;
+    if(!q)
+      {
+      *start = n;
+      return(SCAN_NONE);
+      }
+    size_t s = q - p;
+    *start = s;
+    if(s+1 >= n)
+      return(SCAN_SHORT);
+
+    //GetPacket takes the byte after 0x82 even if it doesn't start a
+    //packet, so the search goes on after it.
+    if(p[s+1] == 0xA3)
+      {
+      if(s+14 > n)
+        return(SCAN_SHORT);
+      *len = 14;
+      return(Fletcher(p+s+2,10,p+s+12) ? SCAN_PACKET : SCAN_CKSUM);
+      }
+    if(p[s+1] != 0xA2)
+      {
+      at = s+2;
+      continue;
+      }
+
+    //A2: rt_sec, then ms/count blocks up to 0xFFFF and the checksum.
+    size_t j = s+6;
+    for(;;)
+      {
+      if(j+2 > n)
+        return(SCAN_SHORT);
+      unsigned int uh = (p[j]<<8) | p[j+1];
+      j += 2;
+      if(uh == 0xFFFF)
+        {
+        if(j+2 > n)
+          return(SCAN_SHORT);
+        *len = j+2-s;
+        return(Fletcher(p+s+2,j-s-2,p+j) ? SCAN_PACKET : SCAN_CKSUM);
+        }
+      if(((uh>>7)*2 > 999) || ((uh & 0x7F) == 0))
+        {
+        *len = j-s;
+        return(SCAN_FRAMING);
+        }
+      j += uh & 0x7F;
+      }
+    }
+  }
+
+//========================================================================
+//                            Report
+//========================================================================
+typedef struct
+  {
+  unsigned long long off;         //of the A3 packet
+  tTCP tcp;
+  double t;                       //RTC time, seconds since 1970
+  } tScanTCP;
+
+typedef struct
+  {
+  unsigned long long off, len;
+  int fill;                       //0x00 or 0xFF if erased, otherwise -1
+  } tRegion;
+
+static std::string TimeText(double t)
+  {
+  tTCP tcp = EpochTCP(t);
+  char buf[40];
+  sprintf(buf,"%04hu-%02hu-%02hu %02hu:%02hu:%02hu.%03hu",tcp.year,tcp.month,tcp.day,
+          tcp.hour,tcp.min,tcp.sec,tcp.msec);
+  return(std::string(buf));
+  }
+
+//Fill of the region: 0x00 or 0xFF if all its bytes are, otherwise -1.
+static int RegionFill(tMap &m, unsigned long long off, unsigned long long len)
+  {
+  unsigned char a = 0xFF, o = 0x00;
+  unsigned long long end = off + len;
+  while(off < end)
+    {
+    if(!m.p || off < m.off || off >= m.off + m.len)
+      MapView(m,off);
+    size_t i = (size_t)(off - m.off);
+    size_t n = (size_t)std::min<unsigned long long>(m.len - i,end - off);
+    for(size_t k=0; k<n; ++k)
+      {
+      a &= m.p[i+k];
+      o |= m.p[i+k];
+      }
+    if(a != 0xFF && o != 0x00)
+      return(-1);
+    off += n;
+    }
+  return((a == 0xFF) ? 0xFF : (o == 0x00) ? 0x00 : -1);
+  }
+
+//Prints up to SCAN_LIST offsets.
+static void ListOffsets(FILE *fp, std::vector<unsigned long long> &v)
+  {
+  for(size_t i=0; i<v.size() && i<SCAN_LIST; ++i)
+    fprintf(fp,"%s%llu",i ? ", " : "    at ",v[i]);
+  if(v.size() > SCAN_LIST)
+    fprintf(fp," and %lu more",(unsigned long)(v.size() - SCAN_LIST));
+  if(!v.empty())
+    fprintf(fp,"\n");
+  }
+
+//========================================================================
+//                           ScanPackets
+//========================================================================
+//Frames the archive path as GetPacket does, calling fn with each packet
+//(SCAN_PACKET), checksum failure and framing error, and a last packet cut
+//short by the end of the file (SCAN_SHORT), with the offset of its 0x82
+//and its bytes.  Returns the size of the file.
+unsigned long long ScanPackets(const char *path, tScanFn fn, void *ctx)
+  {
+  tMap m;
+  if(!MapOpen(m,path))
+    ExitError(1,"Unable to open input file %s\n",path);
+  unsigned long long pos = 0, remapped = ~0ULL;
+  while(pos < m.size)
+    {
+    if(!m.p || pos < m.off || pos >= m.off + m.len)
+      MapView(m,pos);
+    size_t s, len;
+    int r = NextPacket(m.p,m.len,(size_t)(pos - m.off),&s,&len);
+    unsigned long long at = m.off + s;
+    if(r == SCAN_SHORT)
+      {
+      //Map again from the packet, in a larger view if that was done
+      //already, unless the file ends.  GetPacket reads a damaged packet
+      //as far as its blocks chain, which can be further than a view.
+      if(m.off + m.len >= m.size)
+        {
+        fn(ctx,SCAN_SHORT,at,m.p + s,(size_t)(m.size - at));
+        break;
+        }
+      m.want = (remapped == at) ? 2*m.want : SCAN_VIEW;
+      remapped = at;
+      MapView(m,at);
+      pos = at;
+      continue;
+      }
+    if(r == SCAN_NONE)
+      {
+      pos = m.off + m.len;
+      continue;
+      }
+    fn(ctx,r,at,m.p + s,len);
+    pos = (r == SCAN_PACKET) ? at + len : at + 1;
+    }
+  unsigned long long size = m.size;
+  MapClose(m);
+  return(size);
+  }
+
+//========================================================================
+//                           ScanArchive
+//========================================================================
+typedef struct
+  {
+  unsigned long long na2, good, truncated;
+  std::vector<unsigned long long> cksum, framing;
+  std::vector<tRegion> skipped;
+  std::vector<tScanTCP> tcps;
+  std::vector<unsigned long long> restarts;     //offsets of packets where RT went back
+  std::vector<unsigned long> restartFrom, restartTo;
+  unsigned long long beforeTCP;
+  unsigned long lastRT;                         //seconds, of the last packet
+  } tScan;
+
+static void ScanOne(void *ctx, int kind, unsigned long long at, const unsigned char *p, size_t len)
+  {
+  tScan &sc = *(tScan *)ctx;
+  if(kind == SCAN_SHORT)
+    {
+    sc.truncated = len;
+    return;
+    }
+  if(kind == SCAN_CKSUM || kind == SCAN_FRAMING)
+    {
+    (kind == SCAN_CKSUM ? sc.cksum : sc.framing).push_back(at);
+    return;
+    }
+
+  //A good packet, after any bytes skipped since the last one.
+  if(at > sc.good)
+    {
+    tRegion g = {sc.good,at - sc.good,-1};
+    sc.skipped.push_back(g);
+    }
+  unsigned long rt;
+  if(p[1] == 0xA3)
+    {
+    tScanTCP t;
+    t.off = at;
+    t.tcp = ParseTCP(std::string((const char *)p,len));
+    t.t = TCPEpoch(t.tcp);
+    sc.tcps.push_back(t);
+    rt = t.tcp.RT/1000;
+    }
+  else
+    {
+    ++sc.na2;
+    if(sc.tcps.empty())
+      ++sc.beforeTCP;
+    rt = ((unsigned long)p[2]<<24) | ((unsigned long)p[3]<<16) | ((unsigned long)p[4]<<8) | p[5];
+    }
+  if(rt < sc.lastRT)
+    {
+    sc.restarts.push_back(at);
+    sc.restartFrom.push_back(sc.lastRT);
+    sc.restartTo.push_back(rt);
+    }
+  sc.lastRT = rt;
+  sc.good = at + len;
+  }
+
+//Scans the archive path, writing the report to fp.  Returns false if it
+//found damage (checksum failures, framing errors, skipped or truncated
+//data).
+bool ScanArchive(const char *path, FILE *fp)
+  {
+  typedef std::chrono::steady_clock clk;
+  clk::time_point t0 = clk::now();
+  tScan sc;
+  sc.na2 = sc.good = sc.truncated = sc.beforeTCP = 0;
+  sc.lastRT = 0;
+  unsigned long long size = ScanPackets(path,ScanOne,&sc);
+  tMap mr;
+  if(!MapOpen(mr,path))
+    ExitError(1,"Unable to open input file %s\n",path);
+  if(sc.good < size)
+    {
+    tRegion g = {sc.good,size - sc.good,-1};
+    sc.skipped.push_back(g);
+    }
+  unsigned long long nskipped = 0, erased = 0;
+  for(size_t i=0; i<sc.skipped.size(); ++i)
+    {
+    sc.skipped[i].fill = RegionFill(mr,sc.skipped[i].off,sc.skipped[i].len);
+    nskipped += sc.skipped[i].len;
+    if(sc.skipped[i].fill >= 0)
+      erased += sc.skipped[i].len;
+    }
+  MapClose(mr);
+  double dt = std::chrono::duration<double>(clk::now() - t0).count();
+
+  //Counts
+  fprintf(fp,"%s: %llu bytes scanned in %.2f s (%.1f MB/s)\n",path,size,dt,
+          dt > 0 ? size/dt/1e6 : 0);
+  fprintf(fp,"  A2 packets          %12llu\n",sc.na2);
+  fprintf(fp,"  A3 packets (TCPs)   %12lu\n",(unsigned long)sc.tcps.size());
+  if(sc.beforeTCP)
+    fprintf(fp,"  A2 before first TCP %12llu (not timed)\n",sc.beforeTCP);
+  fprintf(fp,"  checksum failures   %12lu\n",(unsigned long)sc.cksum.size());
+  ListOffsets(fp,sc.cksum);
+  fprintf(fp,"  framing errors      %12lu\n",(unsigned long)sc.framing.size());
+  ListOffsets(fp,sc.framing);
+  fprintf(fp,"  bytes skipped       %12llu in %lu region%s, %llu bytes erased (0xFF/0x00)\n",
+          nskipped,(unsigned long)sc.skipped.size(),sc.skipped.size() == 1 ? "" : "s",erased);
+  for(size_t i=0; i<sc.skipped.size() && i<SCAN_LIST; ++i)
+    fprintf(fp,"    at %llu, %llu bytes%s\n",sc.skipped[i].off,sc.skipped[i].len,
+            sc.skipped[i].fill == 0xFF ? ", erased 0xFF" : sc.skipped[i].fill == 0 ? ", erased 0x00" : "");
+  if(sc.skipped.size() > SCAN_LIST)
+    fprintf(fp,"    and %lu more\n",(unsigned long)(sc.skipped.size() - SCAN_LIST));
+  if(sc.truncated)
+    fprintf(fp,"  last packet cut short at %llu (%llu bytes)\n",size - sc.truncated,sc.truncated);
+
+  //Run time sc.restarts, with the time of the TCP after each if there is one.
+  fprintf(fp,"  run time restarts   %12lu (power cycles)\n",(unsigned long)sc.restarts.size());
+  for(size_t i=0; i<sc.restarts.size() && i<SCAN_LIST; ++i)
+    {
+    fprintf(fp,"    at %llu, run time %lu s to %lu s",sc.restarts[i],sc.restartFrom[i],sc.restartTo[i]);
+    for(size_t k=0; k<sc.tcps.size(); ++k)
+      if(sc.tcps[k].off >= sc.restarts[i])
+        {
+        fprintf(fp,", next TCP %s",TimeText(sc.tcps[k].t).c_str());
+        break;
+        }
+    fprintf(fp,"\n");
+    }
+
+  //TCP intervals and drift, over pairs of TCPs with the run time going on.
+  std::vector<double> dts, ppm;
+  for(size_t k=1; k<sc.tcps.size(); ++k)
+    if(sc.tcps[k].tcp.RT > sc.tcps[k-1].tcp.RT)
+      dts.push_back(sc.tcps[k].t - sc.tcps[k-1].t);
+  if(!dts.empty())
+    {
+    std::vector<double> sorted = dts;
+    std::sort(sorted.begin(),sorted.end());
+    double median = sorted[sorted.size()/2];
+    unsigned long gaps = 0;
+    for(size_t k=1; k<sc.tcps.size(); ++k)
+      {
+      if(sc.tcps[k].tcp.RT <= sc.tcps[k-1].tcp.RT)
+        continue;
+      double drtc = sc.tcps[k].t - sc.tcps[k-1].t;
+      double drt = (sc.tcps[k].tcp.RT - sc.tcps[k-1].tcp.RT)/1000.0;
+      if(drtc >= 10)
+        ppm.push_back((drt - drtc)/drtc*1e6);
+      if(drtc > 1.5*median || drtc < 0)
+        {
+        if(gaps++ < SCAN_LIST)
+          fprintf(fp,"%s    at %llu, %.0f s from %s\n",gaps == 1 ? "  TCP gaps:\n" : "",
+                  sc.tcps[k].off,drtc,TimeText(sc.tcps[k-1].t).c_str());
+        }
+      }
+    fprintf(fp,"  TCP interval        %12.0f s (median), %lu gap%s over 1.5 times that\n",
+            median,gaps,gaps == 1 ? "" : "s");
+    }
+  if(!ppm.empty())
+    {
+    double sum = 0, lo = ppm[0], hi = ppm[0];
+    for(size_t i=0; i<ppm.size(); ++i)
+      {
+      sum += ppm[i];
+      lo = std::min(lo,ppm[i]);
+      hi = std::max(hi,ppm[i]);
+      }
+    fprintf(fp,"  clock drift         %12.1f ppm mean over %lu TCP pairs, %.1f to %.1f\n",
+            sum/ppm.size(),(unsigned long)ppm.size(),lo,hi);
+    }
+  return(sc.cksum.empty() && sc.framing.empty() && !nskipped);
+  }
@@ -0,0 +1,264 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+//Sessions of an archive.  An SSR that goes on logging at the end of its
+//archive after a power cycle starts its run time clock (RT) again, so one
+//file can hold several sessions, each with its own RT and TCPs.  Before
+//an archive is decoded it is framed by ScanPackets (scan.cpp), which is
+//about as fast as the file can be read, and split into sessions where the
+//run time goes back and where a TCP is older than the one before it (the
+//RTC was set back).  When there is more than one, the table is written
+//to stderr, and with --sessions <file> it is written for every archive.
+//
+//Timestamps are never made from a TCP of another session.  Subpackets of
+//a session before its first TCP are timed back from that TCP, and those
+//after the last TCP of a session that another follows go on at the rate
+//of its last TCP interval, where interpolation would have used the first
+//TCP of the next session.  A single session archive is timed as before.
+//
+//The sessions are also the parts of the archive that can be decoded in
+//parallel (DecodeSessions in sttp.cpp).
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <math.h>
+#include "sttp.h"
+
+enum { SES_FIRST, SES_RESET, SES_RTC };
+
+typedef struct
+  {
+  unsigned long RT;               //ms
+  long long utc;                  //RTC, ms since 1970
+  } tSesTCP;
+
+typedef struct
+  {
+  unsigned long long start;       //offset of its first packet (the 0x82)
+  int cause;                      //SES_FIRST, SES_RESET or SES_RTC
+  unsigned long long packets;
+  unsigned long RT0, RT1;         //first and last run time, ms
+  std::vector<tSesTCP> tcps;
+  } tSession;
+
+static FILE *fpTable = NULL;      //--sessions
+static bool Interp = true;        //not --nointerp
+static std::vector<tSession> Sessions;
+static size_t Cur = 0;            //session of the packet being decoded
+static long TCPSes = -1;          //session of the decoder's last TCP
+static size_t TCPIdx = 0;         //and which of its TCPs that is
+
+//========================================================================
+//                           SessionSetup
+//========================================================================
+//Return false if we run into a problem, true if good to go.
+bool SessionSetup(std::string table, bool interp)
+  {
+  if(table.length())
+    {
+    fpTable = fopen(table.c_str(),"w");
+    if(!fpTable)
+      {
+      fprintf(stderr,"Unable to open session table file %s\n",table.c_str());
+      return(false);
+      }
+    }
+  Interp = interp;
+  return(true);
+  }
+
+//========================================================================
+//                          SessionArchive
+//========================================================================
+static void AddPacket(void *, int kind, unsigned long long at, const unsigned char *p, size_t len)
+  {
+  if(kind != SCAN_PACKET)
+    return;
+  int cause = Sessions.empty() ? SES_FIRST : -1;
+  unsigned long RT;
+  tSesTCP t;
+  if(p[1] == 0xA3)
+    {
+    tTCP tcp = ParseTCP(std::string((const char *)p,len));
+    t.RT = RT = tcp.RT;
+    t.utc = (long long)floor(TCPEpoch(tcp)*1000 + 0.5);
+    }
+  else
+    RT = (((unsigned long)p[2]<<24) | ((unsigned long)p[3]<<16) | ((unsigned long)p[4]<<8) | p[5])*1000;
+
+  //The run time of A2 packets is in whole seconds, so it goes back only
+  //if its second does.
+  if(cause < 0)
+    {
+    tSession &s = Sessions.back();
+    if(RT/1000 < s.RT1/1000)
+      cause = SES_RESET;
+    else if(p[1] == 0xA3 && !s.tcps.empty() && t.utc < s.tcps.back().utc)
+      cause = SES_RTC;
+    }
+  if(cause >= 0)
+    {
+    tSession s;
+    s.start = at;
+    s.cause = cause;
+    s.packets = 0;
+    s.RT0 = s.RT1 = RT;
+    Sessions.push_back(s);
+    }
+  tSession &s = Sessions.back();
+  ++s.packets;
+  s.RT1 = RT;
+  if(p[1] == 0xA3)
+    s.tcps.push_back(t);
+  }
+
+static std::string UTCText(long long ms)
+  {
+  tTCP t = EpochTCP(ms/1000.0);
+  char buf[40];
+  sprintf(buf,"%04hu-%02hu-%02hu %02hu:%02hu:%02hu.%03hu",t.year,t.month,t.day,
+          t.hour,t.min,t.sec,t.msec);
+  return(std::string(buf));
+  }
+
+static void Table(FILE *fp, const char *path)
+  {
+  static const char *Causes[] = {"start","run time reset","RTC set back"};
+  fprintf(fp,"%s: %lu session%s\n",path,(unsigned long)Sessions.size(),
+          Sessions.size() == 1 ? "" : "s");
+  for(size_t i=0; i<Sessions.size(); ++i)
+    {
+    tSession &s = Sessions[i];
+    fprintf(fp,"  %lu at %llu (%s): %llu packets, run time %lu to %lu s, %lu TCP%s",
+            (unsigned long)i+1,s.start,Causes[s.cause],s.packets,s.RT0/1000,s.RT1/1000,
+            (unsigned long)s.tcps.size(),s.tcps.size() == 1 ? "" : "s");
+    if(s.tcps.empty())
+      fprintf(fp,", not timed\n");
+    else
+      fprintf(fp,", %s to %s\n",UTCText(s.tcps.front().utc).c_str(),
+              UTCText(s.tcps.back().utc).c_str());
+    }
+  }
+
+//Makes the session table of the archive path before it is decoded.
+void SessionArchive(const char *path)
+  {
+  Sessions.clear();
+  Cur = 0;
+  TCPSes = -1;
+  TCPIdx = 0;
+  ScanPackets(path,AddPacket,NULL);
+  if(Sessions.size() > 1)
+    Table(stderr,path);
+  if(fpTable)
+    Table(fpTable,path);
+  }
+
+size_t SessionCount()
+  {
+  return(Sessions.size());
+  }
+
+//Offset of the first packet of session i, 0 for the first session.
+unsigned long long SessionStart(size_t i)
+  {
+  return(i ? Sessions[i].start : 0);
+  }
+
+//True if the archive has a TCP.
+bool SessionTimed()
+  {
+  for(size_t i=0; i<Sessions.size(); ++i)
+    if(!Sessions[i].tcps.empty())
+      return(true);
+  return(false);
+  }
+
+//========================================================================
+//                            Timing
+//========================================================================
+//The decoder found a packet at offset, as GetPacket gives it (after the
+//0x82).
+void SessionPacket(unsigned long offset)
+  {
+  while(Cur+1 < Sessions.size() && offset > Sessions[Cur+1].start)
+    ++Cur;
+  }
+
+//The packet was a TCP.
+void SessionTCP()
+  {
+  if(TCPSes == (long)Cur)
+    ++TCPIdx;
+  else
+    {
+    TCPSes = Cur;
+    TCPIdx = 0;
+    }
+  }
+
+//RTC ms per RT ms between two TCPs, 1 if they don't give one.
+static double Rate(tSesTCP &a, tSesTCP &b)
+  {
+  if(!Interp || b.RT <= a.RT || b.utc <= a.utc)
+    return(1);
+  return((double)(b.utc - a.utc)/(b.RT - a.RT));
+  }
+
+//Time of RT (ms) in the current session where interpolation between the
+//decoder's TCPs would cross into another session.  Returns false if it
+//doesn't, or the session has no TCP to time it by.
+bool SessionTime(unsigned long RT, tTCP *tcp)
+  {
+  if(Sessions.size() < 2 || TCPSes < 0)
+    return(false);
+  std::vector<tSesTCP> &t = Sessions[Cur].tcps;
+  size_t n = t.size();
+  tSesTCP *base;
+  double rate;
+  if(TCPSes != (long)Cur && n)
+    {
+    base = &t[0];
+    rate = (n > 1) ? Rate(t[0],t[1]) : 1;
+    }
+  else if(TCPSes == (long)Cur && TCPIdx+1 == n && Cur+1 < Sessions.size())
+    {
+    base = &t[n-1];
+    rate = (n > 1) ? Rate(t[n-2],t[n-1]) : 1;
+    }
+  else
+    return(false);
+  double ms = base->utc + floor(((double)RT - base->RT)*rate);
+  *tcp = EpochTCP(ms/1000);
+  tcp->RT = RT;
+  return(true);
+  }
+
+void SessionFinish()
+  {
+  if(fpTable)
+    fclose(fpTable);
+  fpTable = NULL;
+  }
@@ -0,0 +1,615 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+//Wave spectra per burst.  The pressure field of the timestamped lines is
+//resampled onto a uniform grid (same options as -g) and collected per
+//burst, where a burst is an interval window (-i/-w), or the whole archive
+//when no windows are given.  Each burst is handed to a pool of worker
+//threads which compute a Welch power spectral density of the pressure head
+//(pressure converted to metres of water).  Results are written in burst
+//order as they complete: the spectrum to the -s file and the bulk wave
+//parameters (Hm0, Tp, Tm01, Tm02) to the -b file.
+//
+//A bottom mounted sensor sees less of the short waves than the surface
+//does.  With --kp, the pressure head spectrum is divided by the square of
+//the linear wave theory transfer function Kp(f,h) = cosh(k z)/cosh(k h),
+//k from the dispersion relation for the burst's mean depth h, z the sensor
+//height above the bed.  Above --kp-fmax the correction would amplify
+//noise, so the corrected spectrum is set to zero there.  The -e file gets
+//the surface elevation series corrected the same way.
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "sttp.h"
+
+#define GRAVITY 9.81                  //m/s^2
+
+double WaterRho = 1025;               //water density (kg/m^3)
+int PressChan = 3;                    //field holding pressure in mbar (1 based)
+
+//Spectral stage configuration, from the command line
+static double SegLen = 128;           //Welch segment length (sec)
+static double Overlap = 0.5;          //segment overlap fraction
+static std::string WinName = "hann";  //segment window
+static unsigned NThreads = 0;         //worker threads, 0 = one per core
+static double FMin = 0.04;            //frequency band of the bulk
+static double FMax = 0.5;             //parameters (Hz)
+
+static bool KpCorrect = false;        //apply the Kp transfer function
+static double PAtm = 1013.25;         //atmospheric pressure (mbar)
+static double ZSensor = 0;            //sensor height above the bed (m)
+static double KpFMax = 0.5;           //highest frequency corrected (Hz)
+
+static FILE *fpSpec = NULL;           //-s output
+static FILE *fpBulk = NULL;           //-b output
+static FILE *fpEta = NULL;            //-e output
+static bool SpecHdrs = false;
+static size_t SegN;                   //segment length (grid points)
+static std::vector<double> Win;       //window coefficients
+static double WinSS;                  //sum of squared window coefficients
+
+//A burst of pressure on the uniform grid and its results
+typedef struct
+  {
+  unsigned long num;                  //burst number (interval window)
+  double t0;                          //time of the first grid point
+  std::vector<double> x;              //pressure (mbar), NaN in gaps
+  bool done;                          //results are ready
+  int nseg;                           //Welch segments averaged
+  double mean;                        //mean pressure (mbar)
+  double depth;                       //mean water depth (m)
+  std::vector<double> S;              //PSD of pressure head or, with --kp,
+                                      //of surface elevation (m^2/Hz)
+  std::vector<double> eta;            //surface elevation (m), NaN in gaps
+  } tBurst;
+
+//========================================================================
+//                        SpectraSetup
+//========================================================================
+//Parse the spectral options.  Empty strings keep the defaults.  Return
+//false if we run into a problem, true if good to go.
+bool SpectraSetup(std::string pchan, std::string seglen, std::string overlap, std::string taper,
+                  std::string threads, std::string fmin, std::string fmax, std::string rho)
+  {
+  if(pchan.length())    PressChan = atoi(pchan.c_str());
+  if(seglen.length())   SegLen = atof(seglen.c_str());
+  if(overlap.length())  Overlap = atof(overlap.c_str());
+  if(taper.length())    WinName = taper;
+  if(threads.length())  NThreads = atoi(threads.c_str());
+  if(fmin.length())     FMin = atof(fmin.c_str());
+  if(fmax.length())     FMax = atof(fmax.c_str());
+  if(rho.length())      WaterRho = atof(rho.c_str());
+
+  if(PressChan < 1 || SegLen <= 0 || Overlap < 0 || Overlap > 0.95 || FMin >= FMax || WaterRho <= 0)
+    {
+    fprintf(stderr,"Invalid spectral options\n");
+    return(false);
+    }
+  if(WinName != "hann" && WinName != "hamming" && WinName != "rect")
+    {
+    fprintf(stderr,"Unknown window '%s', use hann, hamming or rect\n",WinName.c_str());
+    return(false);
+    }
+  return(true);
+  }
+
+//========================================================================
+//                        TransferSetup
+//========================================================================
+//Parse the --kp options.  Return false if we run into a problem.
+bool TransferSetup(bool kp, std::string patm, std::string zsensor, std::string kpfmax)
+  {
+  KpCorrect = kp;
+  if(patm.length())     PAtm = atof(patm.c_str());
+  if(zsensor.length())  ZSensor = atof(zsensor.c_str());
+  if(kpfmax.length())   KpFMax = atof(kpfmax.c_str());
+  if(ZSensor < 0 || KpFMax <= 0)
+    {
+    fprintf(stderr,"Invalid --kp options\n");
+    return(false);
+    }
+  return(true);
+  }
+
+//========================================================================
+//                        Dispersion
+//========================================================================
+//Wavenumbers k[i] of the frequencies f[i] at depth h from the linear
+//dispersion relation w^2 = g k tanh(k h).  The explicit approximation of
+//Guo (2002) is refined with Newton steps, so every bin takes the same
+//fixed amount of work and the loop has no data dependent iteration count.
+static void Dispersion(const double *f, size_t n, double h, double *k)
+  {
+  for(size_t i=0; i<n; ++i)
+    {
+    double w = 2*M_PI*f[i];
+    double x = w*sqrt(h/GRAVITY);
+    double kk = (x > 0) ? x*x*pow(1 - exp(-pow(x,2.5)),-0.4)/h : 0;
+    for(int it=0; it<3; ++it)
+      {
+      double t = tanh(kk*h);
+      double dF = GRAVITY*(t + kk*h*(1 - t*t));
+      if(dF > 0)
+        kk -= (GRAVITY*kk*t - w*w)/dF;
+      }
+    k[i] = kk;
+    }
+  }
+
+//========================================================================
+//                        KpTable
+//========================================================================
+//Kp for bins 0..N/2 of an N point transform at depth h.  Bursts from the
+//same deployment sit at nearly the same depth, so the table is cached by
+//depth to the centimetre and transform length and shared by the workers.
+//Kp is written with exponentials so it doesn't overflow in deep water:
+//  cosh(kz)/cosh(kh) = exp(k(z-h)) (1+exp(-2kz))/(1+exp(-2kh))
+static std::mutex KpLock;
+static std::map<std::pair<long,size_t>,std::vector<double> > KpCache;
+
+static const std::vector<double> &KpTable(double h, size_t N)
+  {
+  long hcm = (long)floor(h*100 + 0.5);
+  std::lock_guard<std::mutex> lk(KpLock);
+  std::vector<double> &kp = KpCache[std::make_pair(hcm,N)];
+  if(kp.empty())
+    {
+    size_t nf = N/2+1;
+    double hm = hcm/100.0;
+    double z = (ZSensor < hm) ? ZSensor : hm;
+    std::vector<double> f(nf), k(nf);
+    for(size_t i=0; i<nf; ++i)
+      f[i] = i*GridRate/N;
+    Dispersion(&f[0],nf,hm,&k[0]);
+    kp.resize(nf);
+    for(size_t i=0; i<nf; ++i)
+      kp[i] = exp(k[i]*(z-hm))*(1 + exp(-2*k[i]*z))/(1 + exp(-2*k[i]*hm));
+    }
+  return(kp);
+  }
+
+//========================================================================
+//                        BurstSpectrum
+//========================================================================
+//Welch PSD of a burst.  Segments that include a gap are skipped.  Each
+//segment has its linear trend removed, is converted from mbar to metres of
+//water, windowed and transformed.  Runs on a worker thread.
+static void BurstSpectrum(tBurst *b, tFFT &fft)
+  {
+  size_t N = SegN;
+  size_t step = N - (size_t)(Overlap*N);
+  double scale = 100.0/(WaterRho*GRAVITY);
+  std::vector<double> seg(N), re(N/2+1), im(N/2+1);
+
+  double sum = 0;
+  size_t n = 0;
+  for(size_t i=0; i<b->x.size(); ++i)
+    if(!isnan(b->x[i]))
+      {
+      sum += b->x[i];
+      ++n;
+      }
+  b->mean = n ? sum/n : NAN;
+  b->S.assign(N/2+1,0);
+  b->nseg = 0;
+
+  //Sum of (i-(N-1)/2)^2 for the trend fit
+  double c = (N-1)/2.0;
+  double sii = N*(N*(double)N-1)/12.0;
+
+  for(size_t s0=0; s0+N <= b->x.size(); s0+=step)
+    {
+    const double *xs = &b->x[s0];
+    bool ok = true;
+    double sx = 0, six = 0;
+    for(size_t i=0; i<N; ++i)
+      {
+      if(isnan(xs[i]))
+        {
+        ok = false;
+        break;
+        }
+      sx += xs[i];
+      six += (i-c)*xs[i];
+      }
+    if(!ok)
+      continue;
+
+    double mean = sx/N;
+    double slope = six/sii;
+    for(size_t i=0; i<N; ++i)
+      seg[i] = (xs[i] - mean - slope*(i-c))*scale*Win[i];
+
+    fft.Forward(&seg[0],&re[0],&im[0]);
+    for(size_t k=0; k<=N/2; ++k)
+      b->S[k] += re[k]*re[k] + im[k]*im[k];
+    ++b->nseg;
+    }
+
+  //One sided density: 2|X|^2/(fs*sum(w^2)) averaged over the segments.
+  //The DC and Nyquist bins are not doubled.
+  if(b->nseg)
+    {
+    double norm = 2.0/(GridRate*WinSS*b->nseg);
+    for(size_t k=0; k<=N/2; ++k)
+      b->S[k] *= norm;
+    b->S[0] /= 2;
+    b->S[N/2] /= 2;
+    }
+
+  //Pressure head to surface elevation
+  b->depth = (b->mean - PAtm)*scale + ZSensor;
+  if(KpCorrect && b->nseg)
+    {
+    if(b->depth > 0)
+      {
+      const std::vector<double> &kp = KpTable(b->depth,N);
+      double df = GridRate/N;
+      for(size_t k=0; k<=N/2; ++k)
+        b->S[k] = (k*df <= KpFMax) ? b->S[k]/(kp[k]*kp[k]) : 0;
+      }
+    else
+      b->nseg = 0;
+    }
+  }
+
+//========================================================================
+//                        BurstSeries
+//========================================================================
+//Surface elevation series of a burst for the -e file.  Each gap free run
+//of the burst has its mean removed and is transformed as a whole (zero
+//padded to a power of two).  With --kp, each bin is divided by Kp and bins
+//above --kp-fmax are dropped before transforming back; otherwise the
+//result is the hydrostatic pressure head.
+static void BurstSeries(tBurst *b, tFFT &fft)
+  {
+  double scale = 100.0/(WaterRho*GRAVITY);
+  b->eta.assign(b->x.size(),NAN);
+  size_t i = 0;
+  while(i < b->x.size())
+    {
+    if(isnan(b->x[i]))
+      {
+      ++i;
+      continue;
+      }
+    size_t j = i;
+    double sum = 0;
+    while(j < b->x.size() && !isnan(b->x[j]))
+      sum += b->x[j++];
+    size_t L = j-i;
+    double mean = sum/L;
+
+    if(!KpCorrect)
+      for(size_t n=0; n<L; ++n)
+        b->eta[i+n] = (b->x[i+n] - mean)*scale;
+    else if(b->depth > 0)
+      {
+      size_t N = 4;
+      while(N < L)
+        N *= 2;
+      fft.Setup(N);
+      std::vector<double> x(N,0), re(N/2+1), im(N/2+1);
+      for(size_t n=0; n<L; ++n)
+        x[n] = (b->x[i+n] - mean)*scale;
+      fft.Forward(&x[0],&re[0],&im[0]);
+      const std::vector<double> &kp = KpTable(b->depth,N);
+      double df = GridRate/N;
+      for(size_t k=0; k<=N/2; ++k)
+        {
+        double g = (k*df <= KpFMax) ? 1/kp[k] : 0;
+        re[k] *= g;
+        im[k] *= g;
+        }
+      fft.Inverse(&re[0],&im[0],&x[0]);
+      for(size_t n=0; n<L; ++n)
+        b->eta[i+n] = x[n];
+      }
+    i = j;
+    }
+  }
+
+//========================================================================
+//                        SpectraWrite
+//========================================================================
+//Write a finished burst: its spectrum and its bulk wave parameters.
+static void SpectraWrite(tBurst *b)
+  {
+  size_t nf = SegN/2+1;
+  double df = GridRate/SegN;
+  tTCP tcp = EpochTCP(b->t0);
+  std::string ts = ColumnTimeStamp(tcp);
+
+  if(fpSpec)
+    {
+    if(SpecHdrs)
+      {
+      fprintf(fpSpec,"Burst Time Segments");
+      for(size_t k=0; k<nf; ++k)
+        fprintf(fpSpec," %.5f",k*df);
+      fprintf(fpSpec,"\n");
+      }
+    fprintf(fpSpec,"%lu %s %d",b->num,ts.c_str(),b->nseg);
+    for(size_t k=0; k<nf; ++k)
+      WriteNumber(fpSpec,b->nseg ? b->S[k] : NAN);
+    fprintf(fpSpec,"\n");
+    }
+
+  if(fpBulk)
+    {
+    if(SpecHdrs)
+      fprintf(fpBulk,"Burst Time Segments MeanP Depth Hm0 Tp Tm01 Tm02\n");
+
+    //Spectral moments and peak over the band
+    double m0 = 0, m1 = 0, m2 = 0, sp = 0, fp = 0;
+    for(size_t k=1; k<nf; ++k)
+      {
+      double f = k*df;
+      if(f < FMin || f > FMax)
+        continue;
+      m0 += b->S[k]*df;
+      m1 += b->S[k]*f*df;
+      m2 += b->S[k]*f*f*df;
+      if(b->S[k] > sp)
+        {
+        sp = b->S[k];
+        fp = f;
+        }
+      }
+    bool ok = b->nseg && m0 > 0;
+    fprintf(fpBulk,"%lu %s %d",b->num,ts.c_str(),b->nseg);
+    WriteNumber(fpBulk,b->mean);
+    WriteNumber(fpBulk,b->depth);
+    WriteNumber(fpBulk,ok ? 4*sqrt(m0) : NAN);
+    WriteNumber(fpBulk,ok ? 1/fp : NAN);
+    WriteNumber(fpBulk,ok ? m0/m1 : NAN);
+    WriteNumber(fpBulk,ok ? sqrt(m0/m2) : NAN);
+    fprintf(fpBulk,"\n");
+    }
+
+  if(fpEta)
+    {
+    if(SpecHdrs)
+      fprintf(fpEta,"Time Eta\n");
+    for(size_t i=0; i<b->eta.size(); ++i)
+      {
+      if(isnan(b->eta[i]))
+        continue;
+      tTCP tcp = EpochTCP(b->t0 + i/GridRate);
+      std::string ts = ColumnTimeStamp(tcp);
+      fprintf(fpEta,"%s",ts.c_str());
+      WriteNumber(fpEta,b->eta[i]);
+      fprintf(fpEta,"\n");
+      }
+    }
+  SpecHdrs = false;
+  }
+
+//========================================================================
+//                        Worker pool
+//========================================================================
+//Bursts are queued for the workers and also kept in order in Pending until
+//they are written.  At most MaxPending bursts are held, so memory stays
+//bounded when the workers fall behind the decoder.
+static std::vector<std::thread> Workers;
+static std::mutex PoolLock;
+static std::condition_variable PoolWork;   //a burst was queued, or stop
+static std::condition_variable PoolDone;   //a burst was finished
+static std::deque<tBurst*> Queue;          //bursts waiting for a worker
+static std::deque<tBurst*> Pending;        //bursts waiting to be written
+static size_t MaxPending;
+static bool PoolStop = false;
+
+static void Worker()
+  {
+  tFFT fft, fftSeries;
+  fft.Setup(SegN);
+  std::unique_lock<std::mutex> lk(PoolLock);
+  for(;;)
+    {
+    while(Queue.empty() && !PoolStop)
+      PoolWork.wait(lk);
+    if(Queue.empty())
+      break;
+    tBurst *b = Queue.front();
+    Queue.pop_front();
+
+    lk.unlock();
+    BurstSpectrum(b,fft);
+    if(fpEta)
+      BurstSeries(b,fftSeries);
+    lk.lock();
+
+    b->done = true;
+    PoolDone.notify_all();
+    }
+  }
+
+//Write the finished bursts at the head of Pending.  If all is set, or too
+//many bursts are held, wait for the head burst to finish.
+static void WriteReady(bool all)
+  {
+  std::unique_lock<std::mutex> lk(PoolLock);
+  for(;;)
+    {
+    while(!Pending.empty() && !Pending.front()->done && (all || Pending.size() > MaxPending))
+      PoolDone.wait(lk);
+    if(Pending.empty() || !Pending.front()->done)
+      break;
+    tBurst *b = Pending.front();
+    Pending.pop_front();
+
+    lk.unlock();
+    SpectraWrite(b);
+    delete b;
+    lk.lock();
+    }
+  }
+
+static void Submit(tBurst *b)
+  {
+    {
+    std::lock_guard<std::mutex> lk(PoolLock);
+    Pending.push_back(b);
+    Queue.push_back(b);
+    }
+  PoolWork.notify_one();
+  WriteReady(false);
+  }
+
+//========================================================================
+//                        Burst collection
+//========================================================================
+//Resampler that collects the pressure grid of each burst.  Grid points
+//skipped over by a gap are filled with NaN so that the samples keep their
+//place on the grid.  Where the time goes back or jumps ahead by more than
+//a segment (an RTC step, or a new session), the burst is closed and the
+//next one starts instead.
+class tBurstGrid : public tResampler
+  {
+  public:
+    tBurst *Cur;
+    long long K0;                 //grid index of the first point in Cur
+
+    tBurstGrid() : Cur(NULL), K0(0) {}
+
+    virtual void GridPoint(double t, unsigned long win, const std::vector<double> &v, bool)
+      {
+      long long k = (long long)floor(t*Rate + 0.5);
+      if(Cur)
+        {
+        long long gap = k - K0 - (long long)Cur->x.size();
+        if(win != Cur->num || gap < 0 || gap > (long long)SegN)
+          Close();
+        }
+      if(!Cur)
+        {
+        Cur = new tBurst;
+        Cur->num = win;
+        Cur->t0 = t;
+        Cur->done = false;
+        K0 = k;
+        }
+      size_t idx = k - K0;
+      if(idx > Cur->x.size())
+        Cur->x.resize(idx,NAN);
+      Cur->x.push_back(v.size() ? v[0] : NAN);
+      }
+
+    void Close()
+      {
+      if(Cur)
+        Submit(Cur);
+      Cur = NULL;
+      }
+  };
+
+static tBurstGrid BurstGrid;
+
+//========================================================================
+//                        SpectraStart
+//========================================================================
+void SpectraStart(FILE *fps, FILE *fpb, FILE *fpe, bool WriteHdrs)
+  {
+  fpSpec = fps;
+  fpBulk = fpb;
+  fpEta = fpe;
+  SpecHdrs = WriteHdrs;
+  BurstGrid.Setup(GridRate,GridOrder,GridMaxGap);
+
+  //Segment length rounded up to a power of two grid points
+  SegN = 4;
+  while(SegN < SegLen*GridRate)
+    SegN *= 2;
+
+  //Window coefficients (periodic form)
+  Win.resize(SegN);
+  WinSS = 0;
+  for(size_t i=0; i<SegN; ++i)
+    {
+    double a = 2*M_PI*i/SegN;
+    if(WinName == "hann")
+      Win[i] = 0.5 - 0.5*cos(a);
+    else if(WinName == "hamming")
+      Win[i] = 0.54 - 0.46*cos(a);
+    else
+      Win[i] = 1;
+    WinSS += Win[i]*Win[i];
+    }
+
+  unsigned n = NThreads ? NThreads : std::thread::hardware_concurrency();
+  if(n < 1)
+    n = 1;
+  MaxPending = 2*n;
+  for(unsigned i=0; i<n; ++i)
+    Workers.push_back(std::thread(Worker));
+  }
+
+//========================================================================
+//                        SpectraAddSample
+//========================================================================
+//Feed the pressure field of a timestamped line to the burst grid.  Lines
+//without a numeric pressure field are skipped.
+void SpectraAddSample(const tSample &s)
+  {
+  static tSample p;
+  if(!fpSpec && !fpBulk && !fpEta)
+    return;
+  if(s.vals.size() < (size_t)PressChan || isnan(s.vals[PressChan-1]))
+    return;
+  p.tcp = s.tcp;
+  p.t = s.t;
+  p.win = s.win;
+  p.vals.assign(1,s.vals[PressChan-1]);
+  BurstGrid.Add(p);
+  }
+
+//========================================================================
+//                        SpectraFinish
+//========================================================================
+//Close the last burst, wait for the workers and write the remaining results.
+void SpectraFinish()
+  {
+  if(!fpSpec && !fpBulk && !fpEta)
+    return;
+  BurstGrid.Flush();
+  BurstGrid.Close();
+  WriteReady(true);
+
+    {
+    std::lock_guard<std::mutex> lk(PoolLock);
+    PoolStop = true;
+    }
+  PoolWork.notify_all();
+  for(size_t i=0; i<Workers.size(); ++i)
+    Workers[i].join();
+  Workers.clear();
+  }
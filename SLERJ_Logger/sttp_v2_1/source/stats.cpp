@@ -0,0 +1,224 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+//Windowed statistics for timestamped line output.  Each timestamped line is
+//split into numeric channel values which are accumulated per interval window
+//(-i/-w, or the whole archive when no windows are given) and written as one
+//row per window when the window closes.  Only running sums are kept, so the
+//memory needed does not depend on the window length.
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sttp.h"
+
+//========================================================================
+//                        Welford accumulator
+//========================================================================
+//Welford's method updates the mean and the sum of squared differences from
+//the mean one value at a time.  Unlike summing x and x^2, it does not lose
+//precision when the variance is small relative to the mean (e.g. wave
+//pressure fluctuations riding on ~1000 mbar of water and atmosphere).
+void WelfordReset(tWelford &w)
+  {
+  w.n = 0;
+  w.mean = 0;
+  w.m2 = 0;
+  w.min = 0;
+  w.max = 0;
+  }
+
+void WelfordAdd(tWelford &w, double x)
+  {
+  ++w.n;
+  double delta = x - w.mean;
+  w.mean += delta/w.n;
+  w.m2 += delta*(x - w.mean);
+  if((w.n == 1) || (x < w.min))
+    w.min = x;
+  if((w.n == 1) || (x > w.max))
+    w.max = x;
+  }
+
+//Sample standard deviation (n-1).  Zero if fewer than two values.
+double WelfordStd(tWelford &w)
+  {
+  if(w.n < 2)
+    return(0);
+  return(sqrt(w.m2/(w.n-1)));
+  }
+
+//========================================================================
+//                        ParseLineValues
+//========================================================================
+//Split a line into fields and convert each to a number.  If the line has a
+//comma or semicolon, those separate the fields (CSV, as written by the
+//BRPT) and empty fields keep their position.  Otherwise fields are separated
+//by runs of spaces/tabs.  vals[i] holds the value of field i, or NaN if the
+//field was not numeric.  Returns the number of numeric fields found.
+int ParseLineValues(const std::string &line, std::vector<double> &vals)
+  {
+  vals.clear();
+  bool csv = line.find_first_of(",;") != std::string::npos;
+  const char *seps = csv ? ",;" : " \t";
+  int nvalid = 0;
+
+  size_t pos = 0;
+  while(pos <= line.length())
+    {
+    //Skip leading whitespace (and, for whitespace separated lines, the
+    //separators themselves).
+    while(pos < line.length() && (line[pos]==' ' || line[pos]=='\t'))
+      ++pos;
+    if(!csv && pos >= line.length())
+      break;
+
+    //Find the end of the field and trim trailing whitespace.
+    size_t end = line.find_first_of(seps,pos);
+    if(end == std::string::npos)
+      end = line.length();
+    size_t last = end;
+    while(last > pos && (line[last-1]==' ' || line[last-1]=='\t'))
+      --last;
+
+    //A field is numeric only if strtod consumes all of it.
+    std::string field = line.substr(pos,last-pos);
+    char *ep;
+    double v = strtod(field.c_str(),&ep);
+    if(!field.empty() && (*ep == 0))
+      {
+      vals.push_back(v);
+      ++nvalid;
+      }
+    else
+      vals.push_back(NAN);
+
+    pos = end+1;
+    }
+  return(nvalid);
+  }
+
+//========================================================================
+//                        WriteNumber
+//========================================================================
+//Write a value preceded by a space, or NaN for a missing value.  NaN is
+//written explicitly since the C library spelling of it differs between
+//platforms.
+void WriteNumber(FILE *fp, double v)
+  {
+  if(isnan(v))
+    fprintf(fp," NaN");
+  else
+    fprintf(fp," %.8g",v);
+  }
+
+//========================================================================
+//                        Windowed statistics
+//========================================================================
+static FILE *fpStats = NULL;          //-a output file
+static bool StatsHdrs = false;        //write a header before the first row
+static bool StatsOpen = false;        //a window has accumulated data
+static unsigned long StatsWin;        //interval number of the open window
+static unsigned long StatsLines;      //numeric lines in the open window
+static tTCP StatsFirst;               //time of the first line in the window
+static tTCP StatsLast;                //time of the last line in the window
+static std::vector<tWelford> StatsCh; //one accumulator per channel
+
+//Write the row for the open window and close it.
+static void StatsWriteRow()
+  {
+  if(!StatsOpen)
+    return;
+
+  if(StatsHdrs)
+    {
+    fprintf(fpStats,"Window First Last Lines");
+    for(unsigned c=1; c<=StatsCh.size(); ++c)
+      fprintf(fpStats," N%u Mean%u Std%u Min%u Max%u",c,c,c,c,c);
+    fprintf(fpStats,"\n");
+    StatsHdrs = false;
+    }
+
+  std::string first = ColumnTimeStamp(StatsFirst);
+  std::string last = ColumnTimeStamp(StatsLast);
+  fprintf(fpStats,"%lu %s %s %lu",StatsWin,first.c_str(),last.c_str(),StatsLines);
+  for(size_t i=0; i<StatsCh.size(); ++i)
+    {
+    tWelford &w = StatsCh[i];
+    fprintf(fpStats," %lu",w.n);
+    WriteNumber(fpStats,w.n ? w.mean : NAN);
+    WriteNumber(fpStats,w.n ? WelfordStd(w) : NAN);
+    WriteNumber(fpStats,w.n ? w.min : NAN);
+    WriteNumber(fpStats,w.n ? w.max : NAN);
+    }
+  fprintf(fpStats,"\n");
+  StatsOpen = false;
+  }
+
+void StatsSetup(FILE *fp, bool WriteHdrs)
+  {
+  fpStats = fp;
+  StatsHdrs = WriteHdrs;
+  StatsOpen = false;
+  }
+
+//Add a completed timestamped line.  Lines are only handed over if they
+//have at least one numeric field, so e.g. the BRPT column header is ignored.
+void StatsAddSample(const tSample &s)
+  {
+  if(!fpStats)
+    return;
+
+  //Starting a new window writes out the previous one.
+  if(StatsOpen && (s.win != StatsWin))
+    StatsWriteRow();
+  if(!StatsOpen)
+    {
+    StatsOpen = true;
+    StatsWin = s.win;
+    StatsFirst = s.tcp;
+    StatsLines = 0;
+    StatsCh.clear();
+    }
+
+  StatsLast = s.tcp;
+  ++StatsLines;
+  if(StatsCh.size() < s.vals.size())
+    {
+    tWelford w;
+    WelfordReset(w);
+    StatsCh.resize(s.vals.size(),w);
+    }
+  for(size_t i=0; i<s.vals.size(); ++i)
+    if(!isnan(s.vals[i]))
+      WelfordAdd(StatsCh[i],s.vals[i]);
+  }
+
+//Write out the last window at the end of the archive.
+void StatsFinish()
+  {
+  if(fpStats)
+    StatsWriteRow();
+  }
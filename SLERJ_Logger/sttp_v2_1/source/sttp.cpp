@@ -20,9 +20,122 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
-#define __STTP_VERSION__ "2.1"
+#define __STTP_VERSION__ "2.2"
 
 /*
+Version 2.2 - 18 Oct 2026
+  Added -a option to write per-window statistics (count, mean, standard
+  deviation, min, max, first/last time) of the numeric fields in each
+  timestamped line.  Windows are set with the interval options (-i/-w).
+  Times are written as one ISO 8601 column, whatever the -N format.
+
+  Added -g option to resample the numeric fields of timestamped lines onto
+  a uniform time grid (--rate, default 16 Hz) with linear or cubic
+  interpolation (--interp).  Gaps longer than --maxgap are not bridged.
+
+  Added -s and -b options to write Welch wave spectra and bulk wave
+  parameters (Hm0, Tp, Tm01, Tm02) of the pressure field for each burst
+  (interval window).  Bursts are processed in parallel (--threads).
+
+  Added --kp to correct the wave spectra for depth attenuation of the
+  pressure signal using linear wave theory, and -e to write the surface
+  elevation series of each burst.
+
+  Added -z option for wave-by-wave (zero-crossing) statistics of the
+  pressure field per burst: Hmax, H1/3, T1/3, mean height and period.
+
+  Lua scripts may provide ParseBatch(runtimes, timestamps, bufs) instead of
+  ParseData to receive the subpackets of a whole A2 packet, or --lua-batch
+  KB of them, per call.  The parser function is looked up once at load.
+
+  Lua scripts that set sttp_buffers = true receive subpacket data as
+  read-only buffers over sttp's packet data instead of new Lua strings.
+  Buffers support buf[i], #buf, byte, sub, unpack and (plain) find, and are
+  only valid during the call.
+
+  Lua scripts may declare their frame format in a table sttp_frame (sync
+  bytes, length field, maximum length and a Fletcher, CRC16, CRC32, XOR,
+  NMEA or newline check).  sttp then reassembles the frames across
+  subpackets and calls ParseFrame only with complete, valid frames and the
+  times of their first and last bytes.  See luaparse.cpp for the fields.
+
+  Added the sttp Lua module with native helpers for parser scripts:
+  sttp.hex, sttp.fletcher16, sttp.crc16, sttp.crc32, sttp.nmea_checksum,
+  sttp.unpack (arrays of binary records) and sttp.writer (buffered output
+  files with printf style formatting).  See luamod.cpp.
+
+  Added --lua-workers N to parse with N Lua states in parallel, for
+  scripts that declare sttp_parallel = {overlap_bytes=K}.  Each state
+  parses contiguous chunks of the data and output written with sttp.writer
+  is merged in time order.  See luapar.cpp.
+
+  Added -X to hand the data to a native parser plugin (a .dll exporting
+  init, parse_batch and finish functions, see sttp_plugin.h) instead of,
+  or as well as, a Lua script.  --plugin-args passes a string to it.
+  Reference BRPT and MIP plugins are in examples/Plugins.
+
+  sttp can be built against LuaJIT 2.1 instead of the bundled Lua 5.3
+  (make LUA=luajit, see luacompat.h).  Scripts that set sttp_ffi = true
+  then get the data as an FFI const uint8_t* and a length, and Lua 5.3
+  scripts get string.unpack, math.type and math.tointeger.  See
+  examples/Lua/mipffi.lua.
+
+  Added sttp.open(path) to the Lua module: an archive object with
+  tcps(), range(t0,t1) and a chunks(n) iterator giving blocks of data
+  with the time of each subpacket, decoded by the same code as the
+  command line.  make sttp.dll builds the module for a separate Lua 5.3
+  interpreter (require "sttp").  See luaarch.cpp and examples/Lua/archive.lua.
+
+  Added --cache <file> to keep the decoded data stream of the archive in
+  a cache file.  Later -x, -X and -r runs on the same archive read the
+  subpackets and their times from the cache instead of decoding the
+  archive again.  See cache.cpp.
+
+  sttp takes several archives on the command line and decodes them in
+  turn into the same outputs.  A Lua script that provides Reset(paths) is
+  called with the paths of each next archive instead of being loaded
+  again.  Scripts are compiled once per run, and with --lua-cache <dir>
+  the bytecode is kept in dir for later runs.
+
+  sttp built with make PROFILE=1 takes --profile, printing at exit the
+  time spent in each stage (framing, checksums, TCP look-ahead, timestamps,
+  formatting, Lua and plugin calls, writes) with the packet, subpacket,
+  line, Lua call and byte counts.  See profile.cpp.
+
+  Added --scan to check the integrity of archives without decoding them:
+  valid A2 and A3 packets, checksum failures, framing errors, the regions
+  skipped (and how much of them is erased flash), run time restarts, TCP
+  gaps and the clock drift between TCPs.  See scan.cpp.
+
+  Static tracepoints (USDT) for bpftrace and perf where sys/sdt.h is
+  found: packet accepted and rejected, resync, TCP, line, Lua call enter
+  and exit, and batch flushes.  Example bpftrace scripts are in
+  tools/probes.
+
+  Added --progress to show percent done, MB/s, packets/s, the time left
+  and the archive's UTC time while converting, and --status <file|fd:N>
+  to write the same as JSON lines for a job runner.  See progress.cpp.
+
+  Added --drift <file> to report the clock drift from the TCP series: the
+  drift over each interval, a least squares fit of UTC to run time between
+  resets and RTC steps with the residuals, and the steps and resets found.
+  --drift-fit timestamps with the fit instead of interpolating between
+  neighbouring TCPs, and --drift-model <file> keeps the fit for later runs.
+  See drift.cpp.
+
+  Archives appended to after power cycles are split into sessions where
+  the run time resets or the RTC goes back, found by a quick framing pass
+  before decoding.  Each session is timestamped from its own TCPs only, so
+  data before a session's first TCP is no longer stamped from the last
+  TCP of the one before.  The sessions are listed on stderr, and with
+  --sessions <file> for every archive, and when only -r, -t, -d and -m are
+  written they are decoded in parallel (--threads).  See sessions.cpp.
+
+  Erased or preallocated flash between packets (runs of 0xFF or 0x00) is
+  passed over in 64 KB blocks compared a 4 KB page at a time instead of a
+  byte at a time, so archives that are mostly empty convert in a fraction
+  of the time.  --profile counts the bytes skipped.
+
 Version 2.1 - 26 Apr 2019
   Fixed exception on exit if Lua script isn't used.
   
@@ -61,86 +174,82 @@ Version 1.1 - 19 Feb 2015
 */
 
 #include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <stdarg.h>
 #include <unistd.h>
+#ifdef _WIN32
 #include <conio.h>
+#endif
 #include <time.h>
+#include <math.h>
 #include "anyoption.h"
-#include "lua.hpp"
-
-//Causes the program to exit with the given return value.
-//Does a printf to stderr with the given arguments.  
-void ExitError(int retval, const char *fmt, ...);
-
-//Given a path, return just the filename and extension.
-std::string BaseFileName(const char *path);
-
-//Structure to hold Time Correlation Packet contents
-typedef struct
-  {
-  unsigned long RT;           //SSR Runtime in msec
-  unsigned short year;        //year  1-4095
-  unsigned short month;       //month 1-12
-  unsigned short day;         //day   1-31
-  unsigned short hour;        //hour  0-23
-  unsigned short min;         //min   0-59
-  unsigned short sec;         //sec   0-59
-  unsigned short msec;        //msec  0-999
-  } tTCP;
-
-//Packet fetch, parse, and validation routines.
-std::string GetPacket(FILE *fpi, unsigned long *loc);
-bool ValidateCksum(std::string s);
-tTCP ParseTCP(std::string pkt);
-tTCP GetNextTCP(FILE *fp);
-
-//Functions to calculate times and create text timestamps
-tTCP GetSubPacketTime(tTCP &PrevTCP, tTCP &NextTCP, unsigned long RT_sec, unsigned short msec);
-std::string GetLineTimeStamp(tTCP &tcp, std::string &format, bool SuppressMSec);
-unsigned long ScaledDT(unsigned long RT, tTCP &PrevTCP, tTCP &NextTCP);
-unsigned long GetTCPDiff_msec(tTCP &newer, tTCP &older);
-
-bool IntervalSetup(std::string skip, std::string interval, std::string window, std::string nwins);
-bool IntervalWriteEnabled(tTCP &tcp, unsigned long TSLinesGenerated);
-
-//Convience function for writing data and mixed file information
-void WriteDMLine(FILE *fpd, FILE *fpm, const char *fmt, ...);
-
-//Functions to implement external Lua Script parser support
-lua_State *LuaSetup(char *fname);
-void LuaParse(lua_State *L, std::string &subpkt, double RT, std::string &timestamp);
+#include "luacompat.h"
+#include "sttp.h"
 
 //Global Data referenced by Lua environment
 std::string TFormat;        //format string for custom timestamp generation
 bool SuppressMSec;
 std::string ArchFilePath;   //Complete path to the archive file being parsed
 
+//Timestamped line being collected for the analysis stages.  A line can
+//carry on from one archive into the next.
+static std::string LineBuf;     //content of the current timestamped line
+static tTCP LineTCP;            //timestamp of the current line
+static unsigned long LineWin = 0;   //interval window of the current line
+
 //========================================================================
 //                             main
 //========================================================================
+//Left out when sttp is built as a Lua module (make sttp.dll).
+#ifndef STTP_MODULE
 int main(int argc, char *argv[])
   {
   //----------------------- command line processing ----------------------
   //command line processing
   AnyOption *opt = new AnyOption();
-  opt->addUsage("usage: %s [options] <infile>\n", BaseFileName(argv[0]).c_str());
+  opt->addUsage("usage: %s [options] <infile> [<infile> ...]\n", BaseFileName(argv[0]).c_str());
   opt->addUsage("    Version " __STTP_VERSION__ ", " __DATE__ " " __TIME__ "\n");
   opt->addUsage("    options:\n");
   opt->addUsage("      -h                Include headers in tcp and dat files.\n");
   opt->addUsage("      -r <raw_file>     Write raw stream data to raw_file\n");
   opt->addUsage("      -x <lua_file>     Send data to an external lua script for parsing\n");
+  opt->addUsage("      -X <plugin>       Send data to a native parser plugin (.dll) for parsing\n");
   opt->addUsage("      -t <tcp_file>     Write Time Correlation Packets to tcp_file\n");
   opt->addUsage("      -d <dat_file>     Write Tagged data to dat_file\n");
   opt->addUsage("      -m <mxd_file>     Write both TCPs and tagged data to mxd_file\n");
   opt->addUsage("      -n <txt_file>     Write timestamped line text file\n");
+  opt->addUsage("      -a <stats_file>   Write per-window statistics of timestamped line values to stats_file\n");
+  opt->addUsage("      -g <grid_file>    Write timestamped line values resampled to a uniform time grid\n");
+  opt->addUsage("      -s <spec_file>    Write the wave spectrum of each burst (interval window) to spec_file\n");
+  opt->addUsage("      -b <bulk_file>    Write bulk wave parameters of each burst to bulk_file\n");
+  opt->addUsage("      -e <eta_file>     Write the surface elevation series of each burst to eta_file\n");
+  opt->addUsage("      -z <zc_file>      Write zero-crossing wave statistics of each burst to zc_file\n");
+  opt->addUsage("      --lua-batch K     Batch size in KB for scripts with ParseBatch (default=one A2 packet)\n");
+  opt->addUsage("      --lua-workers N   Parse with N Lua states in parallel, if the script declares sttp_parallel\n");
+  opt->addUsage("      --lua-chunk K     Data per parallel chunk in KB (default=1024)\n");
+  opt->addUsage("      --lua-cache <dir> Keep the compiled Lua script in dir, for faster startup\n");
+  opt->addUsage("      --plugin-args \"s\" String passed to the plugin's init function\n");
+  opt->addUsage("      --cache <file>    Keep the decoded data in file, for faster repeat -x, -X and -r runs\n");
   opt->addUsage("      -N \"string\"       Date format string for tagged line output (strftime)\n");
   opt->addUsage("      -S                Suppress milliseconds in tagged line output\n");
   opt->addUsage("      --nointerp        Use pre-v1.6 behavior, not interpolating timestamps in -n output\n");
   opt->addUsage("      --dat-bpl         Modified Tagged data (-d) output to give one data byte per line\n");
-  opt->addUsage("    Interval extraction options for timestamped line output:\n");
+  opt->addUsage("      --drift <file>    Write the clock drift of the TCP series, fitted by least squares, to file\n");
+  opt->addUsage("      --drift-fit       Timestamp with the least squares fit of the TCPs instead of interpolating\n");
+  opt->addUsage("      --drift-model <file>  Keep the TCPs and the fit in file, for faster later runs\n");
+  opt->addUsage("      --sessions <file> Write the sessions of each archive between power cycles to file\n");
+  opt->addUsage("      --progress        Show percent done, MB/s, packets/s, time left and archive time on stderr\n");
+  opt->addUsage("      --status <file>   Write the progress as JSON lines to file, or to descriptor N with fd:N\n");
+  opt->addUsage("      --progress-every T  Seconds between progress reports (default=1)\n");
+  opt->addUsage("      --scan            Only check the integrity of the archives, printing a report of each\n");
+  opt->addUsage("      --profile         Print the time of each stage and the counts at exit (make PROFILE=1)\n");
+  opt->addUsage("    Interval extraction options for timestamped line output (-n) and statistics (-a):\n");
   opt->addUsage("         For the arguments below, 'N' is assumed to be in seconds unless suffixed with 'L', which\n");
   opt->addUsage("         denotes lines.  For example '-i 30' denotes an interval of 30 seconds, where '-i 30L' denotes\n");
   opt->addUsage("         an interval of 30 timestamped lines of data.\n");
@@ -148,31 +257,89 @@ int main(int argc, char *argv[])
   opt->addUsage("      -i,--interval N   Extract excerpts at intervals of N seconds/lines\n");
   opt->addUsage("      -w,--window N     Extract N seconds/lines at each interval\n");
   opt->addUsage("      -v,--nwins M      Process M windows (default=0, which means to end of file)\n");
+  opt->addUsage("    Resampling options for -g, -s and -b:\n");
+  opt->addUsage("      --rate F          Grid rate in Hz (default=16)\n");
+  opt->addUsage("      --interp linear|cubic  Interpolation between samples (default=linear)\n");
+  opt->addUsage("      --maxgap T        Don't interpolate across gaps longer than T seconds (default=0.5)\n");
+  opt->addUsage("    Spectral options for -s, -b and -e:\n");
+  opt->addUsage("      --pchan N         Field of the timestamped lines holding pressure in mbar (default=3)\n");
+  opt->addUsage("      --seglen T        Welch segment length in seconds, rounded up to 2^n points (default=128)\n");
+  opt->addUsage("      --overlap F       Welch segment overlap fraction (default=0.5)\n");
+  opt->addUsage("      --taper W         Segment window hann, hamming or rect (default=hann)\n");
+  opt->addUsage("      --fmin F,--fmax F Frequency band for bulk parameters in Hz (default=0.04 to 0.5)\n");
+  opt->addUsage("      --rho R           Water density in kg/m^3 (default=1025)\n");
+  opt->addUsage("      --threads N       Worker threads, also for decoding sessions (default=0, which means one per core)\n");
+  opt->addUsage("      --kp              Correct for depth attenuation of pressure (linear wave theory)\n");
+  opt->addUsage("      --patm P          Atmospheric pressure in mbar, for the water depth (default=1013.25)\n");
+  opt->addUsage("      --zsensor Z       Sensor height above the bed in m (default=0)\n");
+  opt->addUsage("      --kp-fmax F       Highest frequency corrected in Hz, higher ones are dropped (default=0.5)\n");
+  opt->addUsage("    Zero-crossing options for -z (--pchan, --rho and --maxgap also apply):\n");
+  opt->addUsage("      --zc-tau T        Time constant in seconds of the running mean water level (default=60)\n");
+  opt->addUsage("      --zc-down         Use zero down-crossings instead of up-crossings\n");
   
   opt->autoUsagePrint(true);
   opt->setVerbose();
   
   opt->setOption('r');
   opt->setOption('x');
+  opt->setOption('X');
   opt->setOption('t');
   opt->setOption('d');
   opt->setOption('m');
   opt->setOption('n');
+  opt->setOption('a');
+  opt->setOption('g');
+  opt->setOption('s');
+  opt->setOption('b');
+  opt->setOption('e');
+  opt->setOption('z');
   opt->setOption('N');
   opt->setFlag('S');
   opt->setFlag('O');    //include packet offset (archive file bytes) in t,d,and m files.
   opt->setFlag('h');
   opt->setFlag("nointerp");
   opt->setFlag("dat-bpl");
+  opt->setFlag("profile");
+  opt->setFlag("scan");
+  opt->setFlag("progress");
+  opt->setOption("drift");
+  opt->setFlag("drift-fit");
+  opt->setOption("drift-model");
+  opt->setOption("sessions");
+  opt->setOption("status");
+  opt->setOption("progress-every");
+  opt->setOption("lua-batch");
+  opt->setOption("lua-workers");
+  opt->setOption("lua-chunk");
+  opt->setOption("lua-cache");
+  opt->setOption("plugin-args");
+  opt->setOption("cache");
   opt->setOption("skip",'k');
   opt->setOption("interval",'i');
   opt->setOption("window",'w');
   opt->setOption("nwins",'v');
+  opt->setOption("rate");
+  opt->setOption("interp");
+  opt->setOption("maxgap");
+  opt->setOption("pchan");
+  opt->setOption("seglen");
+  opt->setOption("overlap");
+  opt->setOption("taper");
+  opt->setOption("threads");
+  opt->setOption("fmin");
+  opt->setOption("fmax");
+  opt->setOption("rho");
+  opt->setFlag("kp");
+  opt->setOption("patm");
+  opt->setOption("zsensor");
+  opt->setOption("kp-fmax");
+  opt->setOption("zc-tau");
+  opt->setFlag("zc-down");
   opt->processCommandArgs(argc,argv);
 
   //validate required arguments.  At a minumum, the input file must be
   //specified.
-	if((opt->getArgc()!=1))
+	if(opt->getArgc()<1)
     {
     opt->printUsage();
     delete opt;
@@ -193,30 +360,73 @@ int main(int argc, char *argv[])
 		return(0);
     }
 
-  //Open the input file.
-  FILE *fpi = stdin;
-  fpi = fopen(opt->getArgv(0),"rb");
-  if(!fpi)
-    ExitError(1,"Unable to open input file %s\n",opt->getArgv(0));
-  if(setvbuf (fpi, 0, _IOFBF, 1024*1024))
-    ExitError(1,"Unable to set input stream buffer size\n");
-  ArchFilePath = opt->getArgv(0);
-  
-  //Unless inhibited by the --nointerp option, open a second pointer to the 
-  //input file that will be used to look ahead for TCP packets for the purpose 
-  //of interpolating the free running clock in a way that compensates for 
-  //clock drift using the RTC clock as truth.
-  bool InterpTCP = !opt->getFlag("nointerp");
-  FILE *fp2 = NULL;
-  if(InterpTCP)
+  //Same for the resampling options.
+  c = opt->getValue("rate");    std::string rate = c?c:"";
+  c = opt->getValue("interp");  std::string interp = c?c:"";
+  c = opt->getValue("maxgap");  std::string maxgap = c?c:"";
+  if(!ResampleSetup(rate,interp,maxgap))
     {
-    //fp2 = fdopen (dup (fileno (fpi)), "rb");
-    fp2 = fopen(opt->getArgv(0),"rb");
-    if(!fp2)
-      ExitError(1,"Unable to open read-ahead on input file %s\n",opt->getArgv(0));
-    if(setvbuf (fp2, 0, _IOFBF, 1024*1024))
-      ExitError(1,"Unable to set input read-ahead stream buffer size\n");
+    opt->printUsage();
+    delete opt;
+    return(0);
+    }
+  c = opt->getValue("pchan");   std::string pchan = c?c:"";
+  c = opt->getValue("seglen");  std::string seglen = c?c:"";
+  c = opt->getValue("overlap"); std::string overlap = c?c:"";
+  c = opt->getValue("taper");   std::string taper = c?c:"";
+  c = opt->getValue("threads"); std::string threads = c?c:"";
+  c = opt->getValue("fmin");    std::string fmin = c?c:"";
+  c = opt->getValue("fmax");    std::string fmax = c?c:"";
+  c = opt->getValue("rho");     std::string rho = c?c:"";
+  c = opt->getValue("patm");    std::string patm = c?c:"";
+  c = opt->getValue("zsensor"); std::string zsensor = c?c:"";
+  c = opt->getValue("kp-fmax"); std::string kpfmax = c?c:"";
+  c = opt->getValue("zc-tau");  std::string zctau = c?c:"";
+  if(!SpectraSetup(pchan,seglen,overlap,taper,threads,fmin,fmax,rho) ||
+     !TransferSetup(opt->getFlag("kp"),patm,zsensor,kpfmax) ||
+     !ZeroCrossSetup(zctau,opt->getFlag("zc-down")))
+    {
+    opt->printUsage();
+    delete opt;
+    return(0);
+    }
+  c = opt->getValue("lua-batch");   std::string luabatch = c?c:"";
+  c = opt->getValue("lua-workers"); std::string luaworkers = c?c:"";
+  c = opt->getValue("lua-chunk");   std::string luachunk = c?c:"";
+  c = opt->getValue("lua-cache");   std::string luacache = c?c:"";
+  if(!LuaBatchSetup(luabatch) || !LuaWorkersSetup(luaworkers,luachunk) ||
+     !LuaCacheSetup(luacache))
+    {
+    opt->printUsage();
+    delete opt;
+    return(0);
+    }
+
+  c = opt->getValue("status");          std::string status = c?c:"";
+  c = opt->getValue("progress-every");  std::string every = c?c:"";
+  c = opt->getValue("drift");           std::string drift = c?c:"";
+  c = opt->getValue("drift-model");     std::string driftmodel = c?c:"";
+  c = opt->getValue("sessions");        std::string sessions = c?c:"";
+  if(!ProgressSetup(opt->getFlag("progress"),status,every) ||
+     !DriftSetup(drift,driftmodel,opt->getFlag("drift-fit")) ||
+     !SessionSetup(sessions,!opt->getFlag("nointerp")))
+    {
+    opt->printUsage();
+    delete opt;
+    return(0);
     }
+
+  ArchFilePath = opt->getArgv(0);
+  
+  //Unless inhibited by the --nointerp option, timestamps are interpolated
+  //between TCPs, compensating for drift of the free running clock using
+  //the RTC clock as truth.  With --drift-fit they come from the fit of all
+  //the TCPs instead, so there is no look-ahead.
+  bool InterpTCP = !opt->getFlag("nointerp") && !DriftFitting();
+  if(opt->getFlag("nointerp") && DriftFitting())
+    ExitError(1,"--drift-fit and --nointerp can't be used together\n");
+  if(driftmodel.length() && opt->getArgc() > 1)
+    ExitError(1,"--drift-model takes a single archive\n");
   
   //Find out if we need to write headers into the TCP and Data files.
   bool WriteHdrs = opt->getFlag('h');
@@ -228,6 +438,16 @@ int main(int argc, char *argv[])
   //string in timestamped-line mode.
   SuppressMSec = opt->getFlag('S');
 
+  //Stage timing, if built in.
+  if(opt->getFlag("profile"))
+    {
+#ifdef STTP_PROFILE
+    ProfileStart();
+#else
+    ExitError(1,"--profile needs sttp built with make PROFILE=1\n");
+#endif
+    }
+
   //Find out if dat files (-d) should have only a single byte per line.
   bool DatBytePerLine = opt->getFlag("dat-bpl");
   
@@ -242,6 +462,17 @@ int main(int argc, char *argv[])
   putenv ("TZ=UTC+0");
   tzset ();
 
+  //An integrity scan writes only its report, and the other output options
+  //are ignored.  The exit code is 3 if any archive is damaged.
+  if(opt->getFlag("scan"))
+    {
+    bool clean = true;
+    for(int a=0; a<opt->getArgc(); ++a)
+      clean = ScanArchive(opt->getArgv(a),stdout) && clean;
+    delete opt;
+    return(clean ? 0 : 3);
+    }
+
   //Open the possible output files based on user specification.
   char *fname;
   FILE *fpr=NULL;        //raw output
@@ -249,6 +480,12 @@ int main(int argc, char *argv[])
   FILE *fpd=NULL;        //data output
   FILE *fpm=NULL;        //mixed output
   FILE *fpn=NULL;        //timestamped line output
+  FILE *fpa=NULL;        //windowed statistics output
+  FILE *fpg=NULL;        //uniform grid output
+  FILE *fps=NULL;        //wave spectra output
+  FILE *fpb=NULL;        //bulk wave parameter output
+  FILE *fpe=NULL;        //surface elevation output
+  FILE *fpz=NULL;        //zero-crossing output
   lua_State *L=NULL;    //external lua parser
 
   //raw output file
@@ -262,7 +499,18 @@ int main(int argc, char *argv[])
   //lua parser script  
   fname = opt->getValue('x');
   if(fname)
+    {
     L = LuaSetup(fname);
+    LuaWorkersStart(L,fname);
+    }
+
+  //native parser plugin
+  fname = opt->getValue('X');
+  if(fname)
+    {
+    c = opt->getValue("plugin-args");
+    PluginLoad(fname,c?c:"");
+    }
      
   //Time correlation output file
   fname = opt->getValue('t');
@@ -303,7 +551,202 @@ int main(int argc, char *argv[])
     if(!fpn) ExitError(1,"Unable to open tagged line output file %s\n",fname);
     }
 
+  //Windowed statistics output
+  fname = opt->getValue('a');
+  if(fname)
+    {
+    fpa = fopen(fname,"wt");
+    if(!fpa) ExitError(1,"Unable to open statistics output file %s\n",fname);
+    StatsSetup(fpa,WriteHdrs);
+    }
+
+  //Uniform grid output
+  fname = opt->getValue('g');
+  if(fname)
+    {
+    fpg = fopen(fname,"wt");
+    if(!fpg) ExitError(1,"Unable to open grid output file %s\n",fname);
+    GridSetup(fpg,WriteHdrs);
+    }
+
+  //Wave spectra and bulk parameter outputs
+  fname = opt->getValue('s');
+  if(fname)
+    {
+    fps = fopen(fname,"wt");
+    if(!fps) ExitError(1,"Unable to open spectra output file %s\n",fname);
+    }
+  fname = opt->getValue('b');
+  if(fname)
+    {
+    fpb = fopen(fname,"wt");
+    if(!fpb) ExitError(1,"Unable to open bulk parameter output file %s\n",fname);
+    }
+  fname = opt->getValue('e');
+  if(fname)
+    {
+    fpe = fopen(fname,"wt");
+    if(!fpe) ExitError(1,"Unable to open surface elevation output file %s\n",fname);
+    }
+  if(fps || fpb || fpe)
+    SpectraStart(fps,fpb,fpe,WriteHdrs);
+
+  //Zero-crossing output
+  fname = opt->getValue('z');
+  if(fname)
+    {
+    fpz = fopen(fname,"wt");
+    if(!fpz) ExitError(1,"Unable to open zero-crossing output file %s\n",fname);
+    ZeroCrossStart(fpz,WriteHdrs);
+    }
+
+  //Line content is only collected if an analysis stage will use it.
+  bool LineStages = fpa || fpg || fps || fpb || fpe || fpz;
+
+  //Sessions are decoded in parallel if only -r, -t, -d and -m are written,
+  //as none of them is timestamped or depends on what came before.
+  bool Parallel = !(L || PluginLoaded() || fpn || LineStages || opt->getValue("cache") ||
+                    opt->getFlag("profile") || DriftFitting());
+  FILE *out[4] = {fpr,fpt,fpd,fpm};
+  const char *names[4] = {opt->getValue('r'),opt->getValue('t'),opt->getValue('d'),opt->getValue('m')};
+
+  //Decoded data cache.  If it already holds this archive and only the
+  //parsers and raw output are wanted, the archive isn't decoded again.
+  bool Replay = false;
+  c = opt->getValue("cache");
+  if(c)
+    {
+    if(opt->getArgc() > 1)
+      ExitError(1,"--cache takes a single archive\n");
+    Replay = CacheSetup(c,opt->getArgv(0),DriftFitting() ? 2 : InterpTCP,
+                        !(fpt || fpd || fpm || fpn || LineStages));
+    }
+
   //------------------------ data processing ----------------------------    
+  //The archives are decoded in turn, into the same outputs.  Before each
+  //one after the first, the Lua parser is readied for it by its Reset
+  //function, or failing that loaded again, and the plugin is loaded again.
+  std::vector<std::string> paths;
+  for(int a=0; a<opt->getArgc(); ++a)
+    paths.push_back(opt->getArgv(a));
+  ProgressStart(paths);
+  for(int a=0; a<opt->getArgc(); ++a)
+    {
+    if(a)
+      {
+      ArchFilePath = opt->getArgv(a);
+      if(L)
+        {
+        LuaFlush(L);
+        if(!LuaReset(L))
+          {
+          LuaClose(L);
+          L = LuaSetup(opt->getValue('x'));
+          }
+        LuaWorkersStart(L,opt->getValue('x'));
+        }
+      if(PluginLoaded())
+        {
+        PluginFinish();
+        c = opt->getValue("plugin-args");
+        PluginLoad(opt->getValue('X'),c?c:"");
+        }
+      }
+    ProgressArchive(a);
+
+    //The clock model and the sessions are made from the whole archive
+    //before decoding.
+    if(DriftOn())
+      DriftArchive(opt->getArgv(a));
+    if(!Replay)
+      SessionArchive(opt->getArgv(a));
+    if(!Parallel || !DecodeSessions(opt->getArgv(a),InterpTCP,out,names,InclOffset,
+                                    DatBytePerLine,atoi(threads.c_str())))
+      DecodeArchive(opt->getArgv(a),InterpTCP,Replay,L,fpr,fpt,fpd,fpm,fpn,
+                    LineStages,InclOffset,DatBytePerLine);
+    }
+
+  //A last line without a trailing newline still counts in the analysis.
+  if(LineStages)
+    {
+    PROFILE_SCOPE(PROF_ANALYSIS);
+    if(!LineBuf.empty())
+      LineComplete(LineTCP,LineWin,LineBuf);
+    StatsFinish();
+    GridFinish();
+    SpectraFinish();
+    ZeroCrossFinish();
+    }
+  ProgressFinish();
+  DriftFinish();
+  SessionFinish();
+
+  //Clean up
+  delete opt;
+  if(fpr) fclose(fpr);
+  if(fpt) fclose(fpt);
+  if(fpd) fclose(fpd);
+  if(fpm) fclose(fpm);
+  if(fpn) fclose(fpn);
+  if(fpa) fclose(fpa);
+  if(fpg) fclose(fpg);
+  if(fps) fclose(fps);
+  if(fpb) fclose(fpb);
+  if(fpe) fclose(fpe);
+  if(fpz) fclose(fpz);
+
+  if(L)
+    {
+    LuaFlush(L);
+    LuaClose(L);
+    }
+  PluginFinish();
+  CacheFinish();
+#ifdef STTP_PROFILE
+  ProfileReport(stderr);
+#endif
+
+  return(0);
+  }
+
+//========================================================================
+//                           DecodeArchive
+//========================================================================
+//Decodes the archive path into the outputs opened by main, or with Replay
+//hands the parsers its data from the cache (--cache) instead.  Given start
+//and stop, only the packets starting from start and before stop are
+//decoded, which is a session decoded by a worker of DecodeSessions.
+void DecodeArchive(const char *path, bool InterpTCP, bool Replay, lua_State *L,
+                   FILE *fpr, FILE *fpt, FILE *fpd, FILE *fpm, FILE *fpn,
+                   bool LineStages, bool InclOffset, bool DatBytePerLine,
+                   unsigned long long start, unsigned long long stop)
+  {
+  //Open the input file.
+  FILE *fpi = fopen(path,"rb");
+  if(!fpi)
+    ExitError(1,"Unable to open input file %s\n",path);
+  if(setvbuf (fpi, 0, _IOFBF, 1024*1024))
+    ExitError(1,"Unable to set input stream buffer size\n");
+  if(start && fseek(fpi,(long)start,SEEK_SET))
+    ExitError(1,"Unable to seek in input file %s\n",path);
+  bool Whole = !start && stop == ~0ULL;
+  unsigned long long done = start;      //bytes passed, for the progress of a part
+  
+  //Unless inhibited by the --nointerp option, open a second pointer to the 
+  //input file that will be used to look ahead for TCP packets for the purpose 
+  //of interpolating the free running clock in a way that compensates for 
+  //clock drift using the RTC clock as truth.
+  FILE *fp2 = NULL;
+  if(InterpTCP)
+    {
+    //fp2 = fdopen (dup (fileno (fpi)), "rb");
+    fp2 = fopen(path,"rb");
+    if(!fp2)
+      ExitError(1,"Unable to open read-ahead on input file %s\n",path);
+    if(setvbuf (fp2, 0, _IOFBF, 1024*1024))
+      ExitError(1,"Unable to set input read-ahead stream buffer size\n");
+    }
+  
   std::string pkt;
   int ch;
   int state = 0;
@@ -313,6 +756,7 @@ int main(int argc, char *argv[])
   unsigned long offset;
   tTCP PrevTCP = {0,2000,1,1,0,0,0,0}; //Latest Time Correlation Pkt encountered
   tTCP NextTCP = {0};
+  std::vector<tSubPacket> Subs;   //subpackets of the current data packet
 
   //Using the look-ahead pointer, fetch the next TCP.  There must be at least
   //one, so if a null year is returned, that is an error.
@@ -320,30 +764,60 @@ int main(int argc, char *argv[])
     {
     NextTCP = GetNextTCP(fp2);
     if(NextTCP.RT == 0)
-      ExitError(1,"Error: A TCP was not found in %s\n",opt->getArgv(0));
+      ExitError(1,"Error: A TCP was not found in %s\n",path);
     }
     
-  for(;;)
+  if(Replay)
+    CacheReplay(L,fpr);
+  while(!Replay)
     {
     //Get the next packet from the archive file.
-    pkt = GetPacket(fpi,&offset);
-    if(pkt.empty())
+      {
+      PROFILE_SCOPE(PROF_FRAMING);
+      pkt = GetPacket(fpi,&offset);
+      }
+    if(pkt.empty() || offset > stop)
       break;
+    STTP_PROBE4(packet_accept,offset,(unsigned char)pkt[1],
+                ((unsigned char)pkt[1] == 0xA3) ? 0 :
+                (((unsigned long)(unsigned char)pkt[2]<<24) | ((unsigned long)(unsigned char)pkt[3]<<16) |
+                 ((unsigned long)(unsigned char)pkt[4]<<8) | (unsigned char)pkt[5])*1000,
+                pkt.length());
+    if(Whole)
+      {
+      ProgressPacket(pkt,offset);
+      SessionPacket(offset);
+      }
+    else
+      {
+      ProgressPartPacket(offset - 1 + pkt.length() - done);
+      done = offset - 1 + pkt.length();
+      }
     
     //Good packet.  Parse it, writing output as appropriate.
     if(((unsigned char)pkt[1]) == 0xA3)
       {
       //Set this as the previous TCP and fetch the next one with 
       //the look-ahead pointer.
-      PrevTCP = ParseTCP(pkt);
+      tTCP tcp = ParseTCP(pkt);
+      STTP_PROBE3(tcp,offset,tcp.RT,PrevTCP.RT);
+      PrevTCP = tcp;
+      if(Whole)
+        {
+        SessionTCP();
+        if(DriftOn())
+          DriftTCP();
+        }
       if(InterpTCP)
         NextTCP = GetNextTCP(fp2);
+      PROFILE_COUNT(PROF_A3,1);
 
       //Only bother creating output if we have a file to write to.
       if(fpt || fpm)
         {
         //Write to files
         char buf[200];
+        PROFILE_SCOPE(PROF_FORMAT);
         if(InclOffset)
           sprintf(buf,"%lu %lu %hu %hu %hu %hu %hu %hu.%03hu",
                   PrevTCP.RT, offset,
@@ -354,10 +828,12 @@ int main(int argc, char *argv[])
                   PrevTCP.RT,
                   PrevTCP.year, PrevTCP.month, PrevTCP.day,
                   PrevTCP.hour, PrevTCP.min, PrevTCP.sec, PrevTCP.msec);
+        PROFILE_SCOPE(PROF_WRITE);
         if(fpt)
           fprintf(fpt,"%s\n",buf);
         if(fpm)
           fprintf(fpm,"A3 %s\n",buf);
+        PROFILE_COUNT(PROF_BYTES_OUT,(strlen(buf) + 1)*((fpt?1:0) + (fpm?1:0)) + (fpm?3:0));
         }
       }
     else if(((unsigned char)pkt[1]) == 0xA2)
@@ -374,87 +850,57 @@ int main(int argc, char *argv[])
       //    0xFFFF    2       End sequence (something disambiguous with ms/count)
       //    cksum     2       Fletcher checksum, starting with rt_sec through end seq.
       //Only bother parsing if we have a file to write to.
-      if(fpr || fpd || fpm || fpn || L)
+      PROFILE_COUNT(PROF_A2,1);
+      if(fpr || fpd || fpm || fpn || LineStages || L || PluginLoaded() || CacheWriting())
         {
         unsigned long RT_sec;
-        unsigned short uh;
-        int index;
-
-        //Extract Run Time (sec)
-        RT_sec =   (((unsigned char)pkt[2])<<24)
-                 | (((unsigned char)pkt[3])<<16)
-                 | (((unsigned char)pkt[4])<<8)
-                 | (((unsigned char)pkt[5]));
-
-        //Get the ms/count field.
-        index = 6;
-        uh =   (((unsigned char)pkt[index])<<8)
-             | (((unsigned char)pkt[index+1]));
-        index += 2;
-
-        //Parse the sub blocks until we reach the end
-        while(uh != 0xFFFF)
+        size_t nsubs;
           {
-          //Break the sub-packet header into msec/count
-          unsigned short msec, count;
-          msec = (uh>>7)*2;
-          count = uh & 0x7F;
-
-          //Get the characters
-          std:string subpkt = pkt.substr(index,count);
-          index += count;
-
-          //Since the high speed unit (bauds > 635k) can write more than
-          //one block per frame, we need to peek into the next block to see
-          //if it has same msec stamp.  If it does, consider it part of this
-          //frame.
-          uh =   (((unsigned char)pkt[index])<<8)
-               | (((unsigned char)pkt[index+1]));
-          if((uh>>7)*2 == msec)
-            {
-            //This sub block is part of the same frame.  Add it to our data.
-            index += 2;
-            
-            unsigned short ncount = uh&0x7F;
-            subpkt += pkt.substr(index,ncount);
-            index += ncount;
-            count += ncount;
-            }
-          
+          PROFILE_SCOPE(PROF_FRAMING);
+          nsubs = GetSubPackets(pkt,&RT_sec,Subs);
+          }
+        PROFILE_COUNT(PROF_SUBPACKETS,nsubs);
+
+        //Handle the sub packets in turn
+        for(size_t k=0; k<nsubs; ++k)
+          {
+          unsigned short msec = Subs[k].msec;
+          std::string &subpkt = Subs[k].data;
+          unsigned short count = subpkt.length();
+
           //Write raw data
           if(fpr)
+            {
+            PROFILE_SCOPE(PROF_WRITE);
             fwrite(subpkt.c_str(), 1, count, fpr);
+            PROFILE_COUNT(PROF_BYTES_OUT,count);
+            }
 
-          //Parse with external parser
-          if(L)
+          //Parse with external parser and/or plugin, and keep for the cache
+          if(L || PluginLoaded() || CacheWriting())
             {
             //Get a timestamp string for this subpacket to provide to the
             //external parser along with the subpacket data.  The parser
             //will receive a double with RT(sec.msec), a string with the
             //formatted timestamp, and the subpacket data.
             tTCP tcp = GetSubPacketTime(PrevTCP, NextTCP, RT_sec, msec);
-            std::string ts = GetLineTimeStamp(tcp, TFormat, SuppressMSec);
-            
-            LuaParse(L,subpkt,RT_sec+msec/1000.0L,ts);
+            if(CacheWriting())
+              CacheAdd(subpkt,RT_sec,msec,tcp);
+            if(L || PluginLoaded())
+              {
+              std::string ts = GetLineTimeStamp(tcp, TFormat, SuppressMSec);
+              if(L)
+                LuaParse(L,subpkt,RT_sec+msec/1000.0L,ts);
+              if(PluginLoaded())
+                PluginAdd(subpkt,RT_sec+msec/1000.0L,tcp,ts);
+              }
             }
           
           //Now handle the time tagged output
           if(fpd || fpm)
             {
             //Create a hex equivalend of the data in subpkt.
-            std::string hexpkt;
-            std::string::iterator it;
-            for(it = subpkt.begin(); it < subpkt.end(); ++it)
-              {
-              unsigned char uc, uch, ucl;
-              uc = (unsigned char)(*it);
-              uch = uc>>4;      //high nibble
-              ucl = uc&0xF;     //low nibble
-              uch = (uch < 10)?(uch+48):(uch+65-10);  //To Hex
-              ucl = (ucl < 10)?(ucl+48):(ucl+65-10);  //To Hex
-              hexpkt.push_back(uch);
-              hexpkt.push_back(ucl);
-              }
+            std::string hexpkt = HexString(subpkt);
 
             //Now write the output line
             if(InclOffset)
@@ -475,7 +921,7 @@ int main(int argc, char *argv[])
               }
 
             }
-          else if(fpn)       //Handle timestamped line output
+          else if(fpn || LineStages)       //Handle timestamped line output
             {
             //Firstly, if we have data packets without having gotten a
             //TCP, then we have a problem.  Discard those instead of trying
@@ -483,6 +929,7 @@ int main(int argc, char *argv[])
             //is valid.
             if(PrevTCP.RT)
               {
+              PROFILE_SCOPE(PROF_LINES);
               //The subpackets should contain text lines that need to be stamped.
               //Assume, for the moment, that we need only to stamp lines that
               //have content.  If we encounter an newline, we will set a flag
@@ -497,8 +944,16 @@ int main(int argc, char *argv[])
                 unsigned char uc = (unsigned char)(*it);
   
                 //Whenever a newline/CR is received, arm StampOnNextContent
+                //and hand the completed line to the analysis stages.
                 if(uc==0xA || uc==0xD)
+                  {
                   StampOnNextContent=true;
+                  if(!LineBuf.empty())
+                    {
+                    LineComplete(LineTCP,LineWin,LineBuf);
+                    LineBuf.clear();
+                    }
+                  }
                 else if(StampOnNextContent)
                   {
                   //StampOnNextContent is armed, and a non NL/CR byte has been
@@ -514,76 +969,196 @@ int main(int argc, char *argv[])
                   std::string ts = GetLineTimeStamp(tcp, TFormat, SuppressMSec);
                   ts.push_back(' ');
                   ++TSLinesGenerated;
+                  PROFILE_COUNT(PROF_LINES_OUT,1);
+                  STTP_PROBE3(line,offset,RT_sec*1000 + msec,TSLinesGenerated);
   
                   //Process intervals for the possibility of disabling output.
-                  OutputEnabled = IntervalWriteEnabled(tcp,TSLinesGenerated);
+                  OutputEnabled = IntervalWriteEnabled(tcp,TSLinesGenerated,&LineWin);
+                  LineTCP = tcp;
   
                   //Write the timestamp to file, and disarm StampOnNextContent
-                  if(OutputEnabled)
+                  if(OutputEnabled && fpn)
+                    {
                     fputs(ts.c_str(),fpn);
+                    PROFILE_COUNT(PROF_BYTES_OUT,ts.length());
+                    }
                   StampOnNextContent = false;
                   }
   
-                //Put all subpacket bytes into the output file.
+                //Put all subpacket bytes into the output file.  Line
+                //content (not newlines) is kept for the analysis stages.
                 if(OutputEnabled)
-                  fputc((int)uc,fpn);
+                  {
+                  if(fpn)
+                    {
+                    STTP_PUTC((int)uc,fpn);
+                    PROFILE_COUNT(PROF_BYTES_OUT,1);
+                    }
+                  if(LineStages && !StampOnNextContent)
+                    LineBuf.push_back(uc);
+                  }
                 }
               }
             }
-
-
-          //Read the next ms/count or 0xFFFF word.
-          uh =   (((unsigned char)pkt[index])<<8)
-               | (((unsigned char)pkt[index+1]));
-          index += 2;
           }
+
+        //A batching Lua parser and a plugin get the subpackets of the packet now.
+        if(L)
+          LuaPacketEnd(L);
+        if(PluginLoaded())
+          PluginPacketEnd();
+        if(CacheWriting())
+          CachePacketEnd();
         }
       }
     }
 
-  //Clean up
-  delete opt;
-  if(fpi) fclose(fpi);
+  PROFILE_COUNT(PROF_BYTES_IN,ftell(fpi));
+  fclose(fpi);
   if(fp2) fclose(fp2);
-  if(fpr) fclose(fpr);
-  if(fpt) fclose(fpt);
-  if(fpd) fclose(fpd);
-  if(fpm) fclose(fpm);
-  if(fpn) fclose(fpn);
+  }
 
-  if(L) lua_close(L);
+//========================================================================
+//                           DecodeSessions
+//========================================================================
+//The sessions being decoded in parallel, taken in turn by the workers.
+typedef struct
+  {
+  const char *path;
+  FILE **out;
+  std::vector<std::string> parts; //4 file names per session, "" for no output
+  bool InclOffset, DatBytePerLine;
+  size_t n;
+  std::atomic<size_t> next;
+  } tSessionJob;
+
+static void SessionWorker(tSessionJob *job)
+  {
+  for(size_t i; (i = job->next.fetch_add(1)) < job->n; )
+    {
+    FILE *fp[4] = {NULL,NULL,NULL,NULL};
+    for(int k=0; k<4; ++k)
+      if(job->out[k] && !(fp[k] = fopen(job->parts[4*i+k].c_str(),"wb")))
+        ExitError(1,"Unable to open part file %s\n",job->parts[4*i+k].c_str());
+    DecodeArchive(job->path,false,false,NULL,fp[0],fp[1],fp[2],fp[3],NULL,false,
+                  job->InclOffset,job->DatBytePerLine,SessionStart(i),
+                  (i+1 < job->n) ? SessionStart(i+1) : ~0ULL);
+    for(int k=0; k<4; ++k)
+      if(fp[k])
+        fclose(fp[k]);
+    }
+  }
 
-  return(0);
+//Decodes the sessions of the archive path (sessions.cpp) in parallel into
+//the -r, -t, -d and -m outputs out, whose file names are names, when they
+//are the only outputs.  None of them is timestamped, so each session is
+//decoded by a worker into part files beside the outputs, which are then
+//appended to them in order.  Returns false, having done nothing, if there
+//is one session or one thread.
+bool DecodeSessions(const char *path, bool InterpTCP, FILE *out[4], const char *names[4],
+                    bool InclOffset, bool DatBytePerLine, unsigned threads)
+  {
+  size_t n = SessionCount();
+  if(!threads)
+    threads = std::thread::hardware_concurrency();
+  if(n < 2 || threads < 2)
+    return(false);
+  if(InterpTCP && !SessionTimed())
+    ExitError(1,"Error: A TCP was not found in %s\n",path);
+
+  //The parts are written in binary, and turned to text as they are appended.
+  tSessionJob job;
+  job.path = path;
+  job.out = out;
+  job.parts.resize(4*n);
+  job.InclOffset = InclOffset;
+  job.DatBytePerLine = DatBytePerLine;
+  job.n = n;
+  job.next = 0;
+  for(size_t i=0; i<n; ++i)
+    for(int k=0; k<4; ++k)
+      if(out[k])
+        {
+        char buf[32];
+        sprintf(buf,".part%lu",(unsigned long)i+1);
+        job.parts[4*i+k] = std::string(names[k]) + buf;
+        }
+  std::vector<std::thread> workers;
+  for(unsigned w=0; w<threads && w<n; ++w)
+    workers.push_back(std::thread(SessionWorker,&job));
+  for(size_t w=0; w<workers.size(); ++w)
+    workers[w].join();
+
+  std::vector<char> buf(1024*1024);
+  for(size_t i=0; i<job.parts.size(); ++i)
+    if(job.parts[i].length())
+      {
+      FILE *fp = fopen(job.parts[i].c_str(),"rb");
+      if(!fp)
+        ExitError(1,"Unable to open part file %s\n",job.parts[i].c_str());
+      size_t got;
+      while((got = fread(&buf[0],1,buf.size(),fp)) > 0)
+        fwrite(&buf[0],1,got,out[i%4]);
+      fclose(fp);
+      remove(job.parts[i].c_str());
+      }
+  return(true);
   }
+#endif
 
 //========================================================================
 //                             GetPacket
 //========================================================================
 //Gets a packet from fpi and returns it in a string.  'loc' is filled with
-//the start location of the packet (ftell).
-std::string GetPacket(FILE *fpi, unsigned long *loc)
+//the start location of the packet (ftell).  Trace is false for the TCP
+//look-ahead, so the reject and resync probes fire once per archive byte.
+std::string GetPacket(FILE *fpi, unsigned long *loc, bool Trace)
   {
   unsigned char uc;
   unsigned short uh;
   int ch;
-  int count;
+  int count=0;
   int state=0;
+  unsigned long skipped=0;              //bytes passed over, for the resync probe
+  int prev=-1, run=0;                   //last byte passed over, and how many of it
   std::string os;                       //empty output string.
   
-  while((ch=fgetc(fpi)) != EOF)
+  while((ch=STTP_GETC(fpi)) != EOF)
     {
     switch(state)
       {
       case 0:             //waiting for start char 0x82
         if(ch != 0x82)
+          {
+          ++skipped;
+
+          //A run of 0xFF or 0x00 is erased or preallocated flash, which
+          //can go on for MBs.  Pass over the rest of it in blocks.
+          run = (ch == prev) ? run+1 : 0;
+          prev = ch;
+          if(run == SKIP_RUN && (ch == 0xFF || ch == 0x00))
+            {
+            unsigned long n = SkipFill(fpi,ch);
+            skipped += n;
+            if(Trace)
+              PROFILE_COUNT(PROF_ERASED,SKIP_RUN+1+n);
+            run = 0;
+            }
           continue;
+          }
         *loc = ftell(fpi);
+        if(skipped)
+          {
+          if(Trace) STTP_PROBE2(resync,*loc,skipped);
+          skipped = 0;
+          }
         os.push_back((char)ch);
         ++state;
         break;
       case 1:             //waiting for next char 0xA2 or 0xA3
         if((ch != 0xA2) && (ch != 0xA3))
           {
+          skipped += 2;
           os.clear();
           state = 0;
           continue;
@@ -633,6 +1208,7 @@ std::string GetPacket(FILE *fpi, unsigned long *loc)
           int msec = (uh>>7)*2;
           if(msec > 999)
             {
+            if(Trace) STTP_PROBE4(packet_reject,*loc,0xA2,os.size(),PROBE_MSEC);
             state = 0;
             fseek(fpi, -(os.size()-1), SEEK_CUR);
             os.clear();
@@ -642,6 +1218,7 @@ std::string GetPacket(FILE *fpi, unsigned long *loc)
             count = uh&0x7F;
             if(count <= 0)
               {
+              if(Trace) STTP_PROBE4(packet_reject,*loc,0xA2,os.size(),PROBE_COUNT);
               state = 0;
               fseek(fpi, -(os.size()-1), SEEK_CUR);
               os.clear();
@@ -669,6 +1246,7 @@ std::string GetPacket(FILE *fpi, unsigned long *loc)
           }
         else
           {
+          if(Trace) STTP_PROBE4(packet_reject,*loc,0xA2,os.size(),PROBE_CKSUM);
           fseek(fpi, -(os.size()-1), SEEK_CUR);
           os.clear();
           state = 0;
@@ -693,6 +1271,7 @@ std::string GetPacket(FILE *fpi, unsigned long *loc)
             }
           else
             {
+            if(Trace) STTP_PROBE4(packet_reject,*loc,0xA3,os.size(),PROBE_CKSUM);
             fseek(fpi, -(os.size()-1), SEEK_CUR);
             os.clear();
             state = 0;
@@ -709,11 +1288,45 @@ std::string GetPacket(FILE *fpi, unsigned long *loc)
   return(os);
   }
 
+//========================================================================
+//                             SkipFill
+//========================================================================
+//Passes over the bytes c from the read position of fp, reading them a
+//block at a time and comparing 4 KB pages against a page of c, which the
+//C library does with its widest loads.  Returns how many there were, and
+//leaves fp at the first byte that isn't c.
+unsigned long SkipFill(FILE *fp, int c)
+  {
+  unsigned char page[SKIP_PAGE];
+  memset(page,c,SKIP_PAGE);
+  std::vector<unsigned char> buf(SKIP_BLOCK);
+  unsigned long n = 0;
+  for(;;)
+    {
+    size_t got = fread(&buf[0],1,buf.size(),fp);
+    size_t i = 0;
+    while(i+SKIP_PAGE <= got && !memcmp(&buf[i],page,SKIP_PAGE))
+      i += SKIP_PAGE;
+    while(i < got && buf[i] == c)
+      ++i;
+    n += i;
+    if(i < got)
+      {
+      fseek(fp,-(long)(got - i),SEEK_CUR);
+      break;
+      }
+    if(got < buf.size())
+      break;
+    }
+  return(n);
+  }
+
 //========================================================================
 //                             ValidateCksum
 //========================================================================
 bool ValidateCksum(std::string s)
   {
+  PROFILE_SCOPE(PROF_CHECKSUM);
   //This assumes s holds a packet, with the first two bytes as the packet
   //header (not included in the checksum) and the last two bytes are the
   //packet checksum.  So, we need to calculate a checksum on everything
@@ -752,6 +1365,57 @@ std::string BaseFileName(const char *path)
 	return(std::string(name) + std::string(ext));
   }
 
+#ifndef _WIN32
+//========================================================================
+//                        _splitpath
+//========================================================================
+//As the Windows one: dir keeps its trailing '/' and ext its '.'.  Any of
+//the parts may be NULL.
+static void PathPart(char *out, size_t max, const char *p, size_t n)
+  {
+  if(!out)
+    return;
+  if(n > max-1)
+    n = max-1;
+  memcpy(out,p,n);
+  out[n] = 0;
+  }
+
+void _splitpath(const char *path, char *drive, char *dir, char *fname, char *ext)
+  {
+  const char *slash = strrchr(path,'/');
+  const char *base = slash ? slash+1 : path;
+  const char *dot = strrchr(base,'.');
+  if(!dot)
+    dot = base + strlen(base);
+  PathPart(drive,_MAX_DRIVE,path,0);
+  PathPart(dir,_MAX_DIR,path,base-path);
+  PathPart(fname,_MAX_FNAME,base,dot-base);
+  PathPart(ext,_MAX_EXT,dot,strlen(dot));
+  }
+
+//========================================================================
+//                        _fullpath
+//========================================================================
+//rel made absolute from the working directory, which, as on Windows, needn't
+//exist.  Returns NULL if it doesn't fit in n.
+char *_fullpath(char *abs, const char *rel, size_t n)
+  {
+  std::string p = rel;
+  if(p.empty() || p[0] != '/')
+    {
+    char cwd[_MAX_PATH];
+    if(!getcwd(cwd,sizeof(cwd)))
+      return(NULL);
+    p = std::string(cwd) + "/" + p;
+    }
+  if(p.length() >= n)
+    return(NULL);
+  strcpy(abs,p.c_str());
+  return(abs);
+  }
+#endif
+
 //========================================================================
 //                        ParseTCP
 //========================================================================
@@ -806,6 +1470,70 @@ tTCP ParseTCP(std::string pkt)
   return(TCP);
   } 
 
+//========================================================================
+//                        GetSubPackets
+//========================================================================
+//Given a data packet (A2) fetched with GetPacket, split it into its
+//subpackets.  The first n entries of subs are filled and n is returned;
+//subs only grows, so its strings keep their storage from packet to packet.
+//RT_sec is set to the run time (sec) of the packet.
+size_t GetSubPackets(std::string &pkt, unsigned long *RT_sec, std::vector<tSubPacket> &subs)
+  {
+  unsigned short uh;
+  size_t index, n = 0;
+
+  //Extract Run Time (sec)
+  *RT_sec =   (((unsigned char)pkt[2])<<24)
+            | (((unsigned char)pkt[3])<<16)
+            | (((unsigned char)pkt[4])<<8)
+            | (((unsigned char)pkt[5]));
+
+  //Get the ms/count field.
+  index = 6;
+  uh =   (((unsigned char)pkt[index])<<8)
+       | (((unsigned char)pkt[index+1]));
+  index += 2;
+
+  //Parse the sub blocks until we reach the end
+  while(uh != 0xFFFF)
+    {
+    //Break the sub-packet header into msec/count
+    unsigned short msec, count;
+    msec = (uh>>7)*2;
+    count = uh & 0x7F;
+
+    //Get the characters
+    if(n == subs.size())
+      subs.push_back(tSubPacket());
+    tSubPacket &sub = subs[n++];
+    sub.msec = msec;
+    sub.data.assign(pkt,index,count);
+    index += count;
+
+    //Since the high speed unit (bauds > 635k) can write more than
+    //one block per frame, we need to peek into the next block to see
+    //if it has same msec stamp.  If it does, consider it part of this
+    //frame.
+    uh =   (((unsigned char)pkt[index])<<8)
+         | (((unsigned char)pkt[index+1]));
+    if((uh>>7)*2 == msec)
+      {
+      //This sub block is part of the same frame.  Add it to our data.
+      index += 2;
+
+      unsigned short ncount = uh&0x7F;
+      sub.data.append(pkt,index,ncount);
+      index += ncount;
+      }
+
+    //Read the next ms/count or 0xFFFF word.
+    uh =   (((unsigned char)pkt[index])<<8)
+         | (((unsigned char)pkt[index+1]));
+    index += 2;
+    }
+  return(n);
+  }
+
 //========================================================================
 //                        GetNextTCP
 //========================================================================
@@ -814,6 +1542,7 @@ tTCP ParseTCP(std::string pkt)
 //that isn't a TCP
 tTCP GetNextTCP(FILE *fp)
   {
+  PROFILE_SCOPE(PROF_LOOKAHEAD);
   std::string pkt;
   unsigned long offset;
   tTCP TCP={0};
@@ -821,7 +1550,7 @@ tTCP GetNextTCP(FILE *fp)
   //Get packets from the file until we get a TCP, or we hit the end of file.
   for(;;)
     {
-    pkt = GetPacket(fp,&offset);
+    pkt = GetPacket(fp,&offset,false);
     if(pkt.empty())
       break;
     
@@ -852,9 +1581,30 @@ tTCP firstTCP={0};           //Log the earliest time in the file.
 //  Also in the middle case if next TCP timestamp < Prev TCP timestamp, then
 //  perhaps power was cycled and file append was enabled.  Treat like Next=0
 //  same as end of file and interpolate only from Prev using slope of 1.
+//  Since v2.2 the archive is split into sessions at such points first, and
+//  SessionTime times those subpackets from their own session's TCPs.
 
 tTCP GetSubPacketTime(tTCP &PrevTCP, tTCP &NextTCP, unsigned long RT_sec, unsigned short msec)
   {
+  PROFILE_SCOPE(PROF_TIMESTAMP);
+  //The fit of all the TCPs (--drift-fit) replaces the interpolation.
+  if(DriftFitting())
+    {
+    tTCP tcp = DriftTime(RT_sec*1000 + msec);
+    if(firstTCP.RT == 0)
+      firstTCP = tcp;
+    return(tcp);
+    }
+
+  //Interpolation doesn't cross into another session (sessions.cpp).
+  tTCP st;
+  if(SessionTime(RT_sec*1000 + msec,&st))
+    {
+    if(firstTCP.RT == 0)
+      firstTCP = st;
+    return(st);
+    }
+
   //Get the time delta between the last TCP and the current time stamp.
   //Note that RT in tTCP is in msec.
   //unsigned long dt = (RT_sec*1000 + msec) - PrevTCP.RT;
@@ -887,7 +1637,7 @@ tTCP GetSubPacketTime(tTCP &PrevTCP, tTCP &NextTCP, unsigned long RT_sec, unsign
 
   //Get time_t corresponding to PrevTCP (whole second)
   T.tm_isdst=0;                    //prevent use of daylight savings time
-  time_t tt = mktime(&T);
+  time_t tt = UTCMakeTime(&T);
 
   //Increment to the current subpacket time (whole second).
   tt += dt_sec;
@@ -897,6 +1647,7 @@ tTCP GetSubPacketTime(tTCP &PrevTCP, tTCP &NextTCP, unsigned long RT_sec, unsign
 
   //Create and return a tTCP struct with the new time
   tTCP tcp;
+  tcp.RT = RT_sec*1000 + msec;
   tcp.year = T.tm_year + 1900;
   tcp.month = T.tm_mon + 1;
   tcp.day = T.tm_mday;
@@ -962,7 +1713,7 @@ unsigned long GetTCPDiff_msec(tTCP &newer, tTCP &older)
   Tn.tm_min  = newer.min;          //tm_min  int minutes after the hour 0-59
   Tn.tm_sec  = newer.sec;          //tm_sec  int seconds after the minute	0-60*
   Tn.tm_isdst=0;                    //prevent use of daylight savings time
-  time_t tn = mktime(&Tn);
+  time_t tn = UTCMakeTime(&Tn);
 
   //Create a tm struct and time_t from older.
   struct tm To;
@@ -973,7 +1724,7 @@ unsigned long GetTCPDiff_msec(tTCP &newer, tTCP &older)
   To.tm_min  = older.min;          //tm_min  int minutes after the hour 0-59
   To.tm_sec  = older.sec;          //tm_sec  int seconds after the minute	0-60*
   To.tm_isdst=0;                    //prevent use of daylight savings time
-  time_t to = mktime(&To);
+  time_t to = UTCMakeTime(&To);
 
   unsigned long msec_diff = (tn-to)*1000;
   
@@ -982,6 +1733,72 @@ unsigned long GetTCPDiff_msec(tTCP &newer, tTCP &older)
   return(msec_diff);
   }
   
+//========================================================================
+//                        UTCMakeTime
+//========================================================================
+//mktime for a UTC time, whatever TZ is, so the module needn't set it for
+//its host.  The day number is counted from 1 Mar of year 0 (proleptic
+//Gregorian), as in UTCText of progress.cpp.
+time_t UTCMakeTime(struct tm *T)
+  {
+  long long y = T->tm_year + 1900LL + T->tm_mon/12;
+  int m = T->tm_mon%12;
+  if(m < 0)
+    {
+    m += 12;
+    --y;
+    }
+  if(m < 2)
+    --y;
+  long long era = (y >= 0 ? y : y - 399)/400;
+  long long yoe = y - era*400;
+  long long mp = (m + 10)%12;
+  long long doy = (153*mp + 2)/5 + T->tm_mday - 1;
+  long long doe = yoe*365 + yoe/4 - yoe/100 + doy;
+  long long days = era*146097 + doe - 719468;
+  return((time_t)(days*86400 + T->tm_hour*3600LL + T->tm_min*60LL + T->tm_sec));
+  }
+
+//========================================================================
+//                        TCPEpoch
+//========================================================================
+//Seconds since 1970 (UTC) of the time in a tTCP, including milliseconds.
+double TCPEpoch(tTCP &tcp)
+  {
+  struct tm T;
+  T.tm_year = tcp.year - 1900;  //tm_year int years since 1900
+  T.tm_mon  = tcp.month - 1;    //tm_mon int months since January 0-11
+  T.tm_mday = tcp.day;          //tm_mday int day of the month 1-31
+  T.tm_hour = tcp.hour;         //tm_hour int hours since midnight 0-23
+  T.tm_min  = tcp.min;          //tm_min  int minutes after the hour 0-59
+  T.tm_sec  = tcp.sec;          //tm_sec  int seconds after the minute	0-60*
+  T.tm_isdst=0;                 //prevent use of daylight savings time
+  return(UTCMakeTime(&T) + tcp.msec/1000.0);
+  }
+
+//========================================================================
+//                        EpochTCP
+//========================================================================
+//Inverse of TCPEpoch, rounded to the nearest millisecond.  RT is not known
+//and is left zero.
+tTCP EpochTCP(double t)
+  {
+  long long ms = (long long)floor(t*1000 + 0.5);
+  time_t tt = ms/1000;
+  struct tm T = *gmtime(&tt);
+
+  tTCP tcp;
+  tcp.RT = 0;
+  tcp.year = T.tm_year + 1900;
+  tcp.month = T.tm_mon + 1;
+  tcp.day = T.tm_mday;
+  tcp.hour = T.tm_hour;
+  tcp.min = T.tm_min;
+  tcp.sec = T.tm_sec;
+  tcp.msec = ms%1000;
+  return(tcp);
+  }
+
 //========================================================================
 //                        GetLineTimeStamp
 //========================================================================
@@ -989,6 +1806,7 @@ unsigned long GetTCPDiff_msec(tTCP &newer, tTCP &older)
 //create a text representation based on the specified format.
 std::string GetLineTimeStamp(tTCP &tcp, std::string &format, bool SuppressMSec)
   {
+  PROFILE_SCOPE(PROF_FORMAT);
   int n;
   struct tm T;
   char tbuf[128];
@@ -1019,6 +1837,40 @@ std::string GetLineTimeStamp(tTCP &tcp, std::string &format, bool SuppressMSec)
   return(ts);
   }
 
+//========================================================================
+//                        ColumnTimeStamp
+//========================================================================
+//The time of a tTCP as one ISO 8601 token (2019-03-07T14:02:09.250) for
+//the columns of the analysis outputs, which must not depend on -N.
+std::string ColumnTimeStamp(tTCP &tcp)
+  {
+  char tbuf[40];
+  sprintf(tbuf,"%04hu-%02hu-%02huT%02hu:%02hu:%02hu.%03hu",tcp.year,tcp.month,tcp.day,
+          tcp.hour,tcp.min,tcp.sec,tcp.msec);
+  return(std::string(tbuf));
+  }
+
+
+//========================================================================
+//                          LineComplete
+//========================================================================
+//Hand a completed timestamped line to the analysis stages.  Each stage
+//ignores the line if its output isn't enabled.
+void LineComplete(tTCP &tcp, unsigned long win, std::string &line)
+  {
+  PROFILE_SCOPE(PROF_ANALYSIS);
+  static tSample s;
+  if(ParseLineValues(line,s.vals) == 0)
+    return;
+  s.tcp = tcp;
+  s.t = TCPEpoch(tcp);
+  s.win = win;
+
+  StatsAddSample(s);
+  GridAddSample(s);
+  SpectraAddSample(s);
+  ZeroCrossAddSample(s);
+  }
 
 //If Skip, Interval, or Window is negative, then the mode is to skip lines 
 //instead of seconds.  NWins is always an integer - number of windows.
@@ -1056,7 +1908,9 @@ bool IntervalSetup(std::string skip, std::string interval, std::string window, s
 //                        IntervalWriteEnabled
 //========================================================================
 //Returns true if we should perform the write represented by the arguments.
-bool IntervalWriteEnabled(tTCP &tcp, unsigned long TSLinesGenerated)
+//If WinNum is given, it is set to the number of the interval window the
+//write falls in (always 0 when no intervals are in use).
+bool IntervalWriteEnabled(tTCP &tcp, unsigned long TSLinesGenerated, unsigned long *WinNum)
   {
   //If we are less than the appropriate distance into the file (skip) then
   //return false.
@@ -1084,6 +1938,8 @@ bool IntervalWriteEnabled(tTCP &tcp, unsigned long TSLinesGenerated)
 
   //Next, if we are not inside a window at a valid interval, return false.
   //To begin with, if interval or window is zero, then return true.
+  if(WinNum)
+    *WinNum = 0;
   if(Interval==0 or Window==0)
     return(true);
     
@@ -1117,6 +1973,9 @@ bool IntervalWriteEnabled(tTCP &tcp, unsigned long TSLinesGenerated)
       }
     }
 
+  if(WinNum)
+    *WinNum = CurrentIntervalNumber;
+
   //If the current interval number is greater than the number of windows
   //we want to capture, we're done writing output.
   if(NWins && (CurrentIntervalNumber >= NWins))
@@ -1140,6 +1999,29 @@ bool IntervalWriteEnabled(tTCP &tcp, unsigned long TSLinesGenerated)
   return(true);
   }
     
+//========================================================================
+//                          HexString
+//========================================================================
+//Returns the bytes of s as upper case ASCII hex, two characters per byte.
+std::string HexString(std::string &s)
+  {
+  PROFILE_SCOPE(PROF_FORMAT);
+  std::string hex;
+  std::string::iterator it;
+  for(it = s.begin(); it < s.end(); ++it)
+    {
+    unsigned char uc, uch, ucl;
+    uc = (unsigned char)(*it);
+    uch = uc>>4;      //high nibble
+    ucl = uc&0xF;     //low nibble
+    uch = (uch < 10)?(uch+48):(uch+65-10);  //To Hex
+    ucl = (ucl < 10)?(ucl+48):(ucl+65-10);  //To Hex
+    hex.push_back(uch);
+    hex.push_back(ucl);
+    }
+  return(hex);
+  }
+
 //========================================================================
 //                          WriteDMLine
 //========================================================================
@@ -1151,102 +2033,15 @@ void WriteDMLine(FILE *fpd, FILE *fpm, const char *fmt, ...)
   {
   char buf[600];
   va_list argp;
-  va_start(argp,fmt);
-  vsprintf(buf,fmt,argp);
+    {
+    PROFILE_SCOPE(PROF_FORMAT);
+    va_start(argp,fmt);
+    vsprintf(buf,fmt,argp);
+    }
+  PROFILE_SCOPE(PROF_WRITE);
   if(fpd)
     fprintf(fpd,"%s\n",buf);
   if(fpm)
     fprintf(fpm,"A2 %s\n",buf);
-  }
-
-//========================================================================
-//                    Lua Environment Functions
-//========================================================================
-//A few functions that we'd like to make available to the Lua scripts.
-//  sttp_setTSFormat(<strftime format string>)
-//  sttp_getPaths()  returns a table with relevant paths in fields:
-//          ArchiveFile, ArchivePath, ArchiveName, ArchiveExt, cwd
-
-extern "C" {
-
-//Sets TFormat from the lua script to control the timestamp format without
-//having to provide the -N argument to the sttp command line. 
-static int sttp_setTSFormat(lua_State *L)  //[-2,+0]
-  {
-  TFormat = luaL_checkstring(L,-2);         //get string provided on stack
-  SuppressMSec = lua_toboolean(L,-1);   //bool, SuppressMSec
-  return(0);                            //no results pushed to stack
-  }
-
-
-static int sttp_getPaths(lua_State *L)  //[-0,+1]
-  {
-  char drive[_MAX_DRIVE], dir[_MAX_DIR], name[_MAX_FNAME], ext[_MAX_EXT];
-  char absPath[_MAX_PATH];
-  _fullpath(absPath,ArchFilePath.c_str(),_MAX_PATH);
-  _splitpath(absPath,drive,dir,name,ext);
-  
-  lua_newtable(L);
-  lua_pushstring(L,absPath);
-  lua_setfield(L,-2,"ArchiveFile");
-  lua_pushstring(L,(std::string(drive)+std::string(dir)).c_str());
-  lua_setfield(L,-2,"ArchivePath");
-  lua_pushstring(L,name);
-  lua_setfield(L,-2,"ArchiveName");
-  lua_pushstring(L,ext);
-  lua_setfield(L,-2,"ArchiveExt");
-  
-  _getcwd(absPath,_MAX_PATH);
-  lua_pushstring(L,absPath);
-  lua_setfield(L,-2,"cwd");
-  
-  return(1);                          //one result pushed to stack
-  }
-
-} //End extern "C"
-  
-//========================================================================
-//                          LuaSetup
-//========================================================================
-//LuaSetup encapsulates the code needed to setup the Lua parser, install
-//the custom sttp functions for scripts to use, and load the user script.
-lua_State *LuaSetup(char *fname)
-  {
-  lua_State *L = luaL_newstate();
-  luaL_openlibs(L);
-  
-  //Install custom functions
-  lua_pushcfunction(L, sttp_setTSFormat);
-  lua_setglobal(L,"sttp_setTSFormat");
-  lua_pushcfunction(L, sttp_getPaths);
-  lua_setglobal(L,"sttp_getPaths");
-  
-  if(luaL_dofile(L,fname))
-    {
-    fprintf(stderr,"Error loading external parser file %s\n",fname);
-    ExitError(2,lua_tostring(L,-1));
-    }
-  return(L);
-  }
-
-
-//========================================================================
-//                          LuaParse
-//========================================================================
-void LuaParse(lua_State *L, std::string &subpkt, double RT, std::string &TS)
-  {
-  //Get the function onto the stack
-  lua_getglobal(L,"ParseData");
-  if(!lua_isfunction(L,-1))
-    ExitError(2,"ParseData function not found in external parser.");
-
-  //Push the parameters onto the stack
-  lua_pushnumber(L,RT);                               //RT as double
-  lua_pushstring(L,TS.c_str());                       //Timestamp str
-  lua_pushlstring(L,subpkt.c_str(),subpkt.length());  //Data
-  
-  //Call the parser function in the Lua module
-  if(lua_pcall(L,3,0,0))
-    ExitError(2,lua_tostring(L,-1));
-  lua_settop(L,0);
+  PROFILE_COUNT(PROF_BYTES_OUT,(strlen(buf) + 1)*((fpd?1:0) + (fpm?1:0)) + (fpm?3:0));
   }
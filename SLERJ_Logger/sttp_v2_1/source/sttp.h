@@ -0,0 +1,452 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef __STTP_H__
+#define __STTP_H__
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <time.h>
+#include "luacompat.h"
+
+//Causes the program to exit with the given return value.
+//Does a printf to stderr with the given arguments.  
+void ExitError(int retval, const char *fmt, ...);
+
+//Given a path, return just the filename and extension.
+std::string BaseFileName(const char *path);
+
+//The path functions of the Windows C library, for builds on Linux (as for
+//the USDT probes).  There are no drives, so the drive is always empty.
+#ifndef _WIN32
+#include <unistd.h>
+#define _MAX_PATH 4096
+#define _MAX_DRIVE 3
+#define _MAX_DIR 4096
+#define _MAX_FNAME 256
+#define _MAX_EXT 256
+void _splitpath(const char *path, char *drive, char *dir, char *fname, char *ext);
+char *_fullpath(char *abs, const char *rel, size_t n);
+#define _getcwd getcwd
+#endif
+
+//Structure to hold Time Correlation Packet contents
+typedef struct
+  {
+  unsigned long RT;           //SSR Runtime in msec
+  unsigned short year;        //year  1-4095
+  unsigned short month;       //month 1-12
+  unsigned short day;         //day   1-31
+  unsigned short hour;        //hour  0-23
+  unsigned short min;         //min   0-59
+  unsigned short sec;         //sec   0-59
+  unsigned short msec;        //msec  0-999
+  } tTCP;
+
+//Packet fetch, parse, and validation routines.
+std::string GetPacket(FILE *fpi, unsigned long *loc, bool Trace=true);
+unsigned long SkipFill(FILE *fp, int c);
+bool ValidateCksum(std::string s);
+tTCP ParseTCP(std::string pkt);
+tTCP GetNextTCP(FILE *fp);
+
+//Erased flash between packets: after a run of SKIP_RUN more of the same
+//0xFF or 0x00 byte, GetPacket passes over the rest SKIP_BLOCK bytes at a
+//time, comparing SKIP_PAGE bytes at once (SkipFill).
+#define SKIP_RUN 64
+#define SKIP_PAGE 4096
+#define SKIP_BLOCK (64*1024)
+
+//One subpacket of a data packet: the bytes of a sub block, with the next
+//block appended if it has the same msec (high speed units).
+typedef struct
+  {
+  unsigned short msec;        //msec within the packet's run time second
+  std::string data;
+  } tSubPacket;
+size_t GetSubPackets(std::string &pkt, unsigned long *RT_sec, std::vector<tSubPacket> &subs);
+
+//Functions to calculate times and create text timestamps
+tTCP GetSubPacketTime(tTCP &PrevTCP, tTCP &NextTCP, unsigned long RT_sec, unsigned short msec);
+std::string GetLineTimeStamp(tTCP &tcp, std::string &format, bool SuppressMSec);
+std::string ColumnTimeStamp(tTCP &tcp);
+unsigned long ScaledDT(unsigned long RT, tTCP &PrevTCP, tTCP &NextTCP);
+unsigned long GetTCPDiff_msec(tTCP &newer, tTCP &older);
+
+bool IntervalSetup(std::string skip, std::string interval, std::string window, std::string nwins);
+bool IntervalWriteEnabled(tTCP &tcp, unsigned long TSLinesGenerated, unsigned long *WinNum=NULL);
+void LineComplete(tTCP &tcp, unsigned long win, std::string &line);
+
+//Hex text of data bytes, for the data and mixed files
+std::string HexString(std::string &s);
+
+//Convience function for writing data and mixed file information
+void WriteDMLine(FILE *fpd, FILE *fpm, const char *fmt, ...);
+
+//Decoding of one archive into the outputs of the command line
+void DecodeArchive(const char *path, bool InterpTCP, bool Replay, lua_State *L,
+                   FILE *fpr, FILE *fpt, FILE *fpd, FILE *fpm, FILE *fpn,
+                   bool LineStages, bool InclOffset, bool DatBytePerLine,
+                   unsigned long long start=0, unsigned long long stop=~0ULL);
+bool DecodeSessions(const char *path, bool InterpTCP, FILE *out[4], const char *names[4],
+                    bool InclOffset, bool DatBytePerLine, unsigned threads);
+
+//Numerically stable (Welford) running statistics for a single channel.
+typedef struct
+  {
+  unsigned long n;            //number of values accumulated
+  double mean;                //running mean
+  double m2;                  //running sum of squared differences from mean
+  double min;                 //smallest value seen
+  double max;                 //largest value seen
+  } tWelford;
+
+void WelfordReset(tWelford &w);
+void WelfordAdd(tWelford &w, double x);
+double WelfordStd(tWelford &w);
+
+//A completed timestamped line, split into numeric channel values, as handed
+//to the analysis stages (statistics, resampling, ...).
+typedef struct
+  {
+  tTCP tcp;                   //SSR time of the line
+  double t;                   //same time in seconds since 1970 (UTC)
+  unsigned long win;          //interval window the line fell in
+  std::vector<double> vals;   //one value per field, NaN if not numeric
+  } tSample;
+
+time_t UTCMakeTime(struct tm *T);
+double TCPEpoch(tTCP &tcp);
+tTCP EpochTCP(double t);
+int ParseLineValues(const std::string &line, std::vector<double> &vals);
+void WriteNumber(FILE *fp, double v);
+
+//Windowed statistics of timestamped line values (-a)
+void StatsSetup(FILE *fp, bool WriteHdrs);
+void StatsAddSample(const tSample &s);
+void StatsFinish();
+
+//Resampling of timestamped line values onto a uniform time grid (-g).
+//Derived classes receive each grid point through GridPoint().
+class tResampler
+  {
+  public:
+    tResampler();
+    virtual ~tResampler() {}
+    void Setup(double rate, int order, double maxgap);
+    void Add(const tSample &s);
+    void Flush();
+    virtual void GridPoint(double t, unsigned long win, const std::vector<double> &v, bool gap) = 0;
+
+  protected:
+    double Rate;                  //grid rate (Hz)
+    int Order;                    //1=linear, 3=cubic
+    double MaxGap;                //longest sample spacing bridged (sec)
+
+  private:
+    void Emit(size_t i, size_t p0, size_t p1, bool inclusive);
+    std::vector<tSample> S;       //sliding window of the last 4 samples
+    long long NextGrid;           //index (t*Rate) of the next grid point
+    bool Gap;                     //a gap precedes the next grid point
+    std::vector<double> V;        //interpolated values of a grid point
+  };
+
+extern double GridRate;            //uniform grid rate (Hz)
+extern int GridOrder;              //interpolation order, 1=linear, 3=cubic
+extern double GridMaxGap;          //longest sample spacing bridged (sec)
+bool ResampleSetup(std::string rate, std::string interp, std::string maxgap);
+void GridSetup(FILE *fp, bool WriteHdrs);
+void GridAddSample(const tSample &s);
+void GridFinish();
+
+//Real FFT of a power of two length, used by the spectral stage.  Each
+//instance has its own work buffers, so use one per thread.
+class tFFT
+  {
+  public:
+    tFFT() : N(0), M(0) {}
+    void Setup(size_t n);
+    size_t Size() { return(N); }
+    void Forward(const double *x, double *re, double *im);
+    void Inverse(const double *re, const double *im, double *x);
+
+  private:
+    void Complex(double *re, double *im, bool inverse);
+    size_t N;                     //real transform length
+    size_t M;                     //complex transform length, N/2
+    std::vector<size_t> Rev;      //bit reversed index for M points
+    std::vector<double> TwRe;     //twiddles of all stages, stage by stage
+    std::vector<double> TwIm;
+    std::vector<double> RotRe;    //exp(-2*pi*i*k/N), k=0..M, for the real split
+    std::vector<double> RotIm;
+    std::vector<double> Zr;       //work buffer
+    std::vector<double> Zi;
+  };
+
+//Welch wave spectra per burst of timestamped line pressure (-s/-b/-e)
+extern double WaterRho;            //water density (kg/m^3)
+extern int PressChan;              //field holding pressure (1 based)
+bool SpectraSetup(std::string pchan, std::string seglen, std::string overlap, std::string taper,
+                  std::string threads, std::string fmin, std::string fmax, std::string rho);
+bool TransferSetup(bool kp, std::string patm, std::string zsensor, std::string kpfmax);
+void SpectraStart(FILE *fps, FILE *fpb, FILE *fpe, bool WriteHdrs);
+void SpectraAddSample(const tSample &s);
+void SpectraFinish();
+
+//Wave-by-wave zero-crossing analysis of the pressure field (-z)
+bool ZeroCrossSetup(std::string tau, bool down);
+void ZeroCrossStart(FILE *fp, bool WriteHdrs);
+void ZeroCrossAddSample(const tSample &s);
+void ZeroCrossFinish();
+
+//Checksums shared by the framing engine and the Lua environment
+unsigned short Fletcher16(const unsigned char *p, size_t n);
+unsigned short Crc16(const unsigned char *p, size_t n);
+unsigned long Crc32(const unsigned char *p, size_t n);
+unsigned char Xor8(const unsigned char *p, size_t n);
+bool NmeaValid(const unsigned char *p, size_t n);
+
+//Frame format for the framing engine.  Binary frames start with the sync
+//bytes and carry a length field; text frames run from the sync bytes (or
+//any byte if there are none) to a line feed.
+enum { CK_NONE, CK_FLETCHER, CK_CRC16, CK_CRC32, CK_XOR, CK_NMEA, CK_NEWLINE };
+typedef struct
+  {
+  std::string sync;           //bytes every frame starts with
+  int lenpos;                 //offset of the length field in the frame
+  int lensize;                //length field size, 1, 2 or 4 bytes
+  bool lenbig;                //length field is big endian
+  int lenadd;                 //frame length = length field + lenadd
+  size_t maxlen;              //longest frame accepted
+  int cktype;                 //CK_xxx
+  bool ckbig;                 //CRC is stored big endian
+  int ckfrom;                 //offset of the first byte covered by the checksum
+  } tFrameSpec;
+
+//Reassembles frames across subpackets.  Derived classes receive each
+//complete, validated frame through Frame().
+class tFramer
+  {
+  public:
+    tFramer();
+    virtual ~tFramer() {}
+    std::string Setup(const tFrameSpec &spec);
+    void Reset();
+    void Add(const char *data, size_t n, double RT, const std::string &TS);
+    virtual void Frame(const char *p, size_t n, double RT0, const std::string &TS0,
+                       double RT1, const std::string &TS1) = 0;
+
+  private:
+    typedef struct
+      {
+      size_t off;                 //offset in Buf of the subpacket's data
+      double RT;
+      std::string TS;
+      } tRun;
+    int CkSize();
+    bool CkValid(const unsigned char *p, size_t n);
+    void Deliver(size_t start, size_t flen, size_t last);
+    size_t RunOf(size_t off);
+    void Compact();
+    tFrameSpec Spec;
+    std::string Buf;              //data not yet consumed, from Start
+    size_t Start;                 //first unconsumed byte in Buf
+    std::vector<tRun> Runs;       //one per subpacket with bytes in Buf
+  };
+
+//Read-only view of subpacket data handed to Lua scripts (sttp_buffers)
+#define BUFFER_MT "sttp.buffer"
+typedef struct
+  {
+  const unsigned char *p;     //first byte, NULL once invalidated
+  size_t n;                   //number of bytes
+  } tBuffer;
+
+//The sttp Lua module (luamod.cpp)
+extern "C" int luaopen_sttp(lua_State *L);
+int LuaUnpack(lua_State *L, const char *fmt, const unsigned char *data, size_t n, size_t *at);
+const unsigned char *LuaCheckBytes(lua_State *L, int arg, size_t *n);
+FILE *LuaSinkFile(int sink);
+void LuaSinksClose();
+void LuaCompatSetup(lua_State *L);
+
+//Archive objects for Lua, sttp.open() (luaarch.cpp)
+void LuaArchiveSetup(lua_State *L);
+int LuaArchiveOpen(lua_State *L);
+
+//Functions to implement external Lua Script parser support
+lua_State *LuaSetup(char *fname);
+void LuaClose(lua_State *L);
+bool LuaBatchSetup(std::string kb);
+bool LuaCacheSetup(std::string dir);
+bool LuaReset(lua_State *L);
+void LuaParse(lua_State *L, std::string &subpkt, double RT, std::string &timestamp);
+void LuaPacketEnd(lua_State *L);
+void LuaFlush(lua_State *L);
+
+//The same for one parser state, as used by the parallel workers
+void LuaStateParse(lua_State *L, const char *data, size_t n, double RT, const std::string &TS);
+void LuaStatePacketEnd(lua_State *L);
+void LuaStateFlush(lua_State *L);
+void LuaStateReset(lua_State *L);
+bool LuaParallelSpec(lua_State *L, size_t *overlap);
+
+//Parallel parser states (--lua-workers, luapar.cpp)
+bool LuaWorkersSetup(std::string workers, std::string chunk);
+void LuaWorkersStart(lua_State *L, char *fname);
+bool LuaWorkersRunning();
+bool LuaWorkersCapturing();
+bool LuaWorkersCapture(lua_State *L, int sink, const char *p, size_t n);
+void LuaWorkersAdd(const char *data, size_t n, double RT, const std::string &TS);
+void LuaWorkersPacketEnd();
+void LuaWorkersFinish();
+
+//Native parser plugins (-X, plugin.cpp, interface in sttp_plugin.h)
+void PluginLoad(const char *path, std::string args);
+bool PluginLoaded();
+void PluginAdd(std::string &subpkt, double rt, tTCP &tcp, std::string &timestamp);
+void PluginPacketEnd();
+void PluginFinish();
+
+//Cache of the decoded data stream (--cache, cache.cpp)
+bool CacheSetup(std::string path, std::string archive, unsigned int interp, bool CanReplay);
+bool ArchiveId(const std::string &archive, unsigned long long *size, long long *mtime,
+               unsigned int *crc);
+bool CacheWriting();
+void CacheAdd(std::string &subpkt, unsigned long RT_sec, unsigned short msec, tTCP &tcp);
+void CachePacketEnd();
+void CacheReplay(lua_State *L, FILE *fpr);
+void CacheFinish();
+
+//Integrity scan of an archive (--scan, scan.cpp).  ScanPackets frames an
+//archive as GetPacket does, without decoding, calling fn for each of the
+//SCAN_ results with the offset of its 0x82 and its bytes.
+enum { SCAN_PACKET, SCAN_CKSUM, SCAN_FRAMING, SCAN_SHORT, SCAN_NONE };
+typedef void (*tScanFn)(void *ctx, int kind, unsigned long long off, const unsigned char *p,
+                        size_t len);
+unsigned long long ScanPackets(const char *path, tScanFn fn, void *ctx);
+bool ScanArchive(const char *path, FILE *fp);
+
+//Clock drift model of the TCP series (--drift, --drift-fit and
+//--drift-model, drift.cpp)
+bool DriftSetup(std::string report, std::string model, bool fit);
+bool DriftOn();
+bool DriftFitting();
+void DriftArchive(const char *path);
+void DriftTCP();
+tTCP DriftTime(unsigned long RT);
+void DriftFinish();
+
+//Sessions of an archive between power cycles, each timed by its own TCPs
+//(--sessions, sessions.cpp)
+bool SessionSetup(std::string table, bool interp);
+void SessionArchive(const char *path);
+size_t SessionCount();
+unsigned long long SessionStart(size_t i);
+bool SessionTimed();
+void SessionPacket(unsigned long offset);
+void SessionTCP();
+bool SessionTime(unsigned long RT, tTCP *tcp);
+void SessionFinish();
+
+//Progress reports (--progress and --status, progress.cpp).  glibc locks
+//each stdio call once another thread runs, such as the reporter, so the
+//per byte reads and writes of the decoder, whose streams no other thread
+//uses, are made without the lock.
+#ifdef _WIN32
+#define STTP_GETC(fp) fgetc(fp)
+#define STTP_PUTC(c,fp) fputc(c,fp)
+#else
+#define STTP_GETC(fp) getc_unlocked(fp)
+#define STTP_PUTC(c,fp) putc_unlocked(c,fp)
+#endif
+bool ProgressSetup(bool show, std::string status, std::string every);
+void ProgressStart(const std::vector<std::string> &paths);
+void ProgressArchive(int a);
+void ProgressPacket(std::string &pkt, unsigned long offset);
+void ProgressPartPacket(unsigned long long bytes);
+void ProgressFinish();
+
+//Stage timers and counters for --profile (profile.cpp), built in with
+//make PROFILE=1.  Otherwise PROFILE_SCOPE and PROFILE_COUNT are empty, and
+//their arguments aren't evaluated.
+enum { PROF_FRAMING, PROF_CHECKSUM, PROF_LOOKAHEAD, PROF_TIMESTAMP, PROF_FORMAT,
+       PROF_LUA, PROF_PLUGIN, PROF_WRITE, PROF_LINES, PROF_ANALYSIS, PROF_NSTAGES };
+enum { PROF_BYTES_IN, PROF_BYTES_OUT, PROF_A2, PROF_A3, PROF_SUBPACKETS,
+       PROF_LINES_OUT, PROF_LUA_CALLS, PROF_ERASED, PROF_NCOUNTS };
+#ifdef STTP_PROFILE
+//Times its stage from construction to the end of the enclosing block.
+//A scope started inside another one is taken off the time of the outer.
+class tProfileScope
+  {
+  public:
+    tProfileScope(int stage);
+    ~tProfileScope();
+
+  private:
+    int Stage;                    //-1 when not profiling
+    long long T0;                 //clock ticks at the start
+    long long Child;              //ticks spent in scopes inside this one
+    tProfileScope *Parent;
+  };
+void ProfileStart();
+void ProfileReport(FILE *fp);
+void ProfileCount(int counter, unsigned long long n);
+#define PROFILE_CAT2(a,b) a##b
+#define PROFILE_CAT(a,b) PROFILE_CAT2(a,b)
+#define PROFILE_SCOPE(stage) tProfileScope PROFILE_CAT(ProfileScope_,__LINE__)(stage)
+#define PROFILE_COUNT(counter,n) ProfileCount(counter,n)
+#else
+#define PROFILE_SCOPE(stage) ((void)0)
+#define PROFILE_COUNT(counter,n) ((void)0)
+#endif
+
+//Static tracepoints (USDT) for bpftrace and perf, built in where the system
+//has sys/sdt.h (systemtap-sdt-dev) unless made with USDT=0.  A probe is a
+//nop until a tracer attaches to it.  Provider sttp; the probes and their
+//arguments are in tools/probes/readme.txt.  Elsewhere they are empty.
+#if defined(__has_include) && !defined(STTP_NO_USDT)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define STTP_USDT
+#endif
+#endif
+#ifdef STTP_USDT
+#define STTP_PROBE2(name,a,b) DTRACE_PROBE2(sttp,name,a,b)
+#define STTP_PROBE3(name,a,b,c) DTRACE_PROBE3(sttp,name,a,b,c)
+#define STTP_PROBE4(name,a,b,c,d) DTRACE_PROBE4(sttp,name,a,b,c,d)
+#else
+#define STTP_PROBE2(name,a,b) ((void)0)
+#define STTP_PROBE3(name,a,b,c) ((void)0)
+#define STTP_PROBE4(name,a,b,c,d) ((void)0)
+#endif
+enum { PROBE_CKSUM=1, PROBE_MSEC, PROBE_COUNT };                  //packet_reject reasons
+enum { PROBE_PARSEDATA=1, PROBE_PARSEBATCH, PROBE_PARSEFRAME };   //lua_enter/lua_exit
+enum { PROBE_LUABATCH=1, PROBE_PLUGINBATCH, PROBE_CACHEBLOCK };    //flush
+
+//Global Data referenced by Lua environment and the analysis modules
+extern std::string TFormat;        //format string for custom timestamp generation
+extern bool SuppressMSec;
+extern std::string ArchFilePath;   //Complete path to the archive file being parsed
+
+#endif
@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+//Native parser plugin interface (-X).  A plugin is a shared library (.dll,
+//or .so on Linux) exporting the three functions below with C linkage.  It
+//gets the same subpackets a Lua parser gets, a batch (one A2 packet) per
+//call, with the SSR run time, the formatted timestamp and the time in ms
+//since 1970.  Build a plugin with e.g.
+//  g++ -O2 -shared -o brpt.dll brpt.cpp
+//This header is plain C so plugins may be written in C or C++.  A plugin
+//that returns an error stops sttp.
+
+#ifndef __STTP_PLUGIN_H__
+#define __STTP_PLUGIN_H__
+
+#include <stddef.h>
+
+//Bumped whenever a structure below changes.  sttp refuses a plugin that
+//reports a different version from init.
+#define STTP_PLUGIN_ABI 1
+
+//Handed to init.  Fields marked [in/out] may be changed by the plugin and
+//are read back by sttp after init returns.
+typedef struct
+  {
+  int abi;                    //[in/out] host's STTP_PLUGIN_ABI; set to the plugin's
+  const char *archive;        //full path of the archive file
+  const char *archive_path;   //directory of the archive, with trailing separator
+  const char *archive_name;   //archive file name without extension
+  const char *args;           //--plugin-args string, "" if none
+  const char *ts_format;      //[in/out] strftime format of the timestamps (-N)
+  int suppress_msec;          //[in/out] leave milliseconds off the timestamps (-S)
+  } sttp_plugin_info;
+
+//One subpacket.  Pointers are only valid during the parse_batch call.
+typedef struct
+  {
+  double rt;                  //SSR run time (sec.msec)
+  long long epoch_ms;         //time of the subpacket in ms since 1970
+  const char *ts;             //formatted timestamp, NUL terminated
+  const unsigned char *data;  //subpacket data
+  size_t len;                 //number of data bytes
+  } sttp_subpacket;
+
+#ifdef __cplusplus
+#define STTP_EXTERN extern "C"
+#else
+#define STTP_EXTERN
+#endif
+#ifdef _WIN32
+#define STTP_EXPORT STTP_EXTERN __declspec(dllexport)
+#else
+#define STTP_EXPORT STTP_EXTERN __attribute__((visibility("default")))
+#endif
+
+//The plugin's exports.  Each returns 0 on success.  init may set *ctx to
+//per-run state, which is passed back to the other two.
+#define STTP_PLUGIN_INIT   "sttp_plugin_init"
+#define STTP_PLUGIN_PARSE  "sttp_plugin_parse_batch"
+#define STTP_PLUGIN_FINISH "sttp_plugin_finish"
+typedef int (*sttp_plugin_init_fn)(sttp_plugin_info *info, void **ctx);
+typedef int (*sttp_plugin_parse_fn)(void *ctx, const sttp_subpacket *subs, size_t n);
+typedef int (*sttp_plugin_finish_fn)(void *ctx);
+
+#endif
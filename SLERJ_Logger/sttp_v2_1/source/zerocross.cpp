@@ -0,0 +1,243 @@
+/*
+Copyright (c) 2019 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+//Wave-by-wave (zero-crossing) analysis of the pressure field of the
+//timestamped lines.  Pressure is converted to hydrostatic head and the
+//slowly varying water level (tide, setup) is removed with an exponential
+//running mean of time constant --zc-tau.  A wave runs from one zero
+//up-crossing (or down-crossing with --zc-down) to the next; its height is
+//crest minus trough and its period the time between the crossings, with
+//crossing times interpolated between samples.
+//
+//Everything is done in one pass as the lines are decoded.  Per burst
+//(interval window) only running sums and a fixed size histogram of wave
+//heights are kept, which is enough for H1/3 without storing the waves.
+
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "sttp.h"
+
+#define GRAVITY 9.81                  //m/s^2
+#define ZC_BIN 0.002                  //height histogram bin (m)
+#define ZC_NBINS 4000                 //bins, up to 8 m waves
+
+static double Tau = 60;               //running mean time constant (sec)
+static bool Down = false;             //use zero down-crossings
+
+static FILE *fpZC = NULL;             //-z output
+static bool ZCHdrs = false;
+
+//Running state of the detector
+static bool Open = false;             //a burst is open
+static unsigned long Win;             //burst (interval window) number
+static tTCP T0;                       //time of the first sample in the burst
+static double Level;                  //running mean water level (m)
+static bool PrevValid = false;        //PrevT/PrevX hold a usable sample
+static double PrevT, PrevX;           //previous sample time and elevation
+static bool InWave = false;           //a crossing has started a wave
+static double TCross;                 //time of that crossing
+static double Crest, Trough;          //extremes since that crossing
+
+//Per burst reductions
+static unsigned long NWaves;
+static double HMax, THMax;            //highest wave and its period
+static double SumH, SumT;
+static unsigned long HCount[ZC_NBINS];//waves per height bin
+static double HSum[ZC_NBINS];         //sum of the heights in each bin
+static double TSum[ZC_NBINS];         //sum of the periods in each bin
+
+//========================================================================
+//                        ZeroCrossSetup
+//========================================================================
+//Parse the zero-crossing options.  Return false if we run into a problem.
+bool ZeroCrossSetup(std::string tau, bool down)
+  {
+  if(tau.length())
+    Tau = atof(tau.c_str());
+  Down = down;
+  if(Tau <= 0)
+    {
+    fprintf(stderr,"Invalid --zc-tau\n");
+    return(false);
+    }
+  return(true);
+  }
+
+void ZeroCrossStart(FILE *fp, bool WriteHdrs)
+  {
+  fpZC = fp;
+  ZCHdrs = WriteHdrs;
+  }
+
+//========================================================================
+//                        Burst reductions
+//========================================================================
+static void ZCReset()
+  {
+  NWaves = 0;
+  HMax = THMax = 0;
+  SumH = SumT = 0;
+  for(int i=0; i<ZC_NBINS; ++i)
+    {
+    HCount[i] = 0;
+    HSum[i] = 0;
+    TSum[i] = 0;
+    }
+  }
+
+static void ZCAddWave(double H, double T)
+  {
+  ++NWaves;
+  SumH += H;
+  SumT += T;
+  if(H > HMax)
+    {
+    HMax = H;
+    THMax = T;
+    }
+  int bin = (int)(H/ZC_BIN);
+  if(bin >= ZC_NBINS)
+    bin = ZC_NBINS-1;
+  ++HCount[bin];
+  HSum[bin] += H;
+  TSum[bin] += T;
+  }
+
+//Write the row of the open burst.  H1/3 and T1/3 are the mean height and
+//period of the highest third of the waves, taken from the top of the
+//histogram.  Only the bin that straddles the third is approximated (by its
+//mean), so the error is well under one bin.
+static void ZCWriteRow()
+  {
+  if(!Open)
+    return;
+  if(ZCHdrs)
+    {
+    fprintf(fpZC,"Burst Time Waves Hmax THmax H1/3 T1/3 Hmean Tmean\n");
+    ZCHdrs = false;
+    }
+
+  double H3 = NAN, T3 = NAN;
+  unsigned long n3 = NWaves/3;
+  if(n3)
+    {
+    unsigned long left = n3;
+    double sh = 0, st = 0;
+    for(int i=ZC_NBINS-1; i>=0 && left; --i)
+      {
+      if(!HCount[i])
+        continue;
+      unsigned long take = (HCount[i] < left) ? HCount[i] : left;
+      sh += HSum[i]*take/HCount[i];
+      st += TSum[i]*take/HCount[i];
+      left -= take;
+      }
+    H3 = sh/n3;
+    T3 = st/n3;
+    }
+
+  std::string ts = ColumnTimeStamp(T0);
+  fprintf(fpZC,"%lu %s %lu",Win,ts.c_str(),NWaves);
+  WriteNumber(fpZC,NWaves ? HMax : NAN);
+  WriteNumber(fpZC,NWaves ? THMax : NAN);
+  WriteNumber(fpZC,H3);
+  WriteNumber(fpZC,T3);
+  WriteNumber(fpZC,NWaves ? SumH/NWaves : NAN);
+  WriteNumber(fpZC,NWaves ? SumT/NWaves : NAN);
+  fprintf(fpZC,"\n");
+  Open = false;
+  }
+
+//========================================================================
+//                        ZeroCrossAddSample
+//========================================================================
+void ZeroCrossAddSample(const tSample &s)
+  {
+  if(!fpZC)
+    return;
+  if(s.vals.size() < (size_t)PressChan || isnan(s.vals[PressChan-1]))
+    return;
+  double h = s.vals[PressChan-1]*100/(WaterRho*GRAVITY);
+
+  //A new interval window starts a new burst.
+  if(Open && (s.win != Win))
+    ZCWriteRow();
+  if(!Open)
+    {
+    ZCReset();
+    Open = true;
+    Win = s.win;
+    T0 = s.tcp;
+    Level = h;
+    PrevValid = false;
+    InWave = false;
+    }
+  else
+    {
+    //Two lines stamped in the same SSR frame carry the same time.  Keep the
+    //first.  A gap or a clock step drops the wave in progress.
+    double dt = s.t - PrevT;
+    if(dt == 0)
+      return;
+    if(dt > GridMaxGap || dt < 0)
+      {
+      PrevValid = false;
+      InWave = false;
+      }
+    else
+      Level += (h - Level)*(1 - exp(-dt/Tau));
+    }
+  double x = h - Level;
+
+  if(PrevValid)
+    {
+    bool cross = Down ? (PrevX >= 0 && x < 0) : (PrevX < 0 && x >= 0);
+    if(cross)
+      {
+      double tc = PrevT + (s.t - PrevT)*PrevX/(PrevX - x);
+      if(InWave)
+        ZCAddWave(Crest - Trough, tc - TCross);
+      InWave = true;
+      TCross = tc;
+      Crest = Trough = x;
+      }
+    }
+  if(InWave)
+    {
+    if(x > Crest)
+      Crest = x;
+    if(x < Trough)
+      Trough = x;
+    }
+  PrevT = s.t;
+  PrevX = x;
+  PrevValid = true;
+  }
+
+void ZeroCrossFinish()
+  {
+  if(fpZC)
+    ZCWriteRow();
+  }
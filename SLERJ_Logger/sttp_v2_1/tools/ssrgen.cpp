@@ -0,0 +1,529 @@
+/*
+Copyright (c) 2026 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+
+//ssrgen: writes synthetic SSR-1 time tagged archives for testing and
+//benchmarking sttp at sizes beyond the example archives.
+//
+//The archive is what the SSR would record from one serial line: A2 data
+//packets, one per second of SSR run time, holding the bytes received in
+//each 2 ms slot as ms/count blocks, and A3 time correlation packets every
+//few minutes pairing the run time with the RTC.  Bytes arrive at the baud
+//rate: messages that come faster than the line can carry queue up.
+//
+//  --payload brpt    BRPT logger lines "TSYS,TBAR,PBAR\r\n" at --rate Hz
+//                    (default 16), pressure carrying a few wave components
+//  --payload mip     MicroStrain MIP packets (Euler angles and GPS time) at
+//                    --rate Hz (default 100)
+//  --payload binary  random bytes, the line kept busy at the full baud
+//
+//The run time clock can drift from the RTC (--drift ppm), the RTC can be
+//set forward or back halfway through (--rtc-step), the recording can be
+//cut by power cycles after which the SSR appends with its run time
+//starting over, packets can be damaged (a byte changed or the packet cut
+//short) and erased flash regions (0xFF or 0x00 blocks) can be put between
+//packets.  The output depends only on the options and --seed.
+//
+//  ssrgen --payload mip --duration 20m mip.dat
+//  ssrgen --payload binary --baud 460800 --duration 100h --size 4G big.dat
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "anyoption.h"
+
+#define RT_START 1000             //run time (ms) when the SSR powers up
+
+enum { PAY_BRPT, PAY_MIP, PAY_BINARY };
+
+//Options
+static int Payload = PAY_BRPT;
+static double Baud = 115200;
+static double Rate = 0;           //messages per second, 0 = payload default
+static double Duration = 3600;    //seconds of recording
+static double MaxSize = 0;        //stop at this many bytes, 0 = no limit
+static double TCPInterval = 600;  //seconds between TCPs
+static double Drift = 0;          //run time clock error, ppm
+static double Corrupt = 0;        //fraction of packets damaged
+static int PowerCycles = 0;
+static double OffTime = 60;       //seconds off at each power cycle
+static double RTCStep = 0;        //seconds the RTC is set by halfway through
+static int Erases = 0;
+static int EraseKB = 64;
+static unsigned long long Seed = 1;
+static time_t Start;              //RTC time at the start, UTC
+
+static FILE *fpo = NULL;
+static double Written = 0;        //bytes written
+
+//Counts for the summary
+static unsigned long NumA2 = 0, NumA3 = 0, NumDamaged = 0;
+static double DataBytes = 0;
+
+static void Fatal(const char *fmt, const char *arg)
+  {
+  fprintf(stderr,fmt,arg);
+  exit(1);
+  }
+
+//========================================================================
+//                         Random numbers
+//========================================================================
+//splitmix64, so the archive for a seed is the same on every platform.
+static unsigned long long RandNext()
+  {
+  unsigned long long z = (Seed += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return(z ^ (z >> 31));
+  }
+
+//Uniform in [0,1)
+static double Uniform()
+  {
+  return((RandNext() >> 11) * (1.0/9007199254740992.0));
+  }
+
+static double Gauss()
+  {
+  double u = Uniform(), v = Uniform();
+  return(sqrt(-2*log(1 - u))*cos(2*M_PI*v));
+  }
+
+//========================================================================
+//                          Option values
+//========================================================================
+//Seconds, with an optional s, m, h or d suffix.
+static double ParseTime(const char *s, const char *opt)
+  {
+  char *end;
+  double v = strtod(s,&end);
+  if(*end == 'm') v *= 60;
+  else if(*end == 'h') v *= 3600;
+  else if(*end == 'd') v *= 86400;
+  else if(*end && *end != 's') Fatal("Invalid %s\n",opt);
+  if(v <= 0) Fatal("Invalid %s\n",opt);
+  return(v);
+  }
+
+//Bytes, with an optional K, M or G suffix.
+static double ParseSize(const char *s, const char *opt)
+  {
+  char *end;
+  double v = strtod(s,&end);
+  if(*end == 'K' || *end == 'k') v *= 1024;
+  else if(*end == 'M' || *end == 'm') v *= 1024*1024;
+  else if(*end == 'G' || *end == 'g') v *= 1024.0*1024*1024;
+  else if(*end) Fatal("Invalid %s\n",opt);
+  if(v <= 0) Fatal("Invalid %s\n",opt);
+  return(v);
+  }
+
+//========================================================================
+//                            Packets
+//========================================================================
+static void Put16(std::string &s, unsigned v)
+  {
+  s.push_back((char)(v>>8));
+  s.push_back((char)v);
+  }
+
+static void Put32(std::string &s, unsigned long v)
+  {
+  Put16(s,(unsigned)(v>>16) & 0xFFFF);
+  Put16(s,(unsigned)v & 0xFFFF);
+  }
+
+//Fletcher checksum of s from 'from' on, appended.
+static void PutFletcher(std::string &s, size_t from)
+  {
+  unsigned char ck0 = 0, ck1 = 0;
+  for(size_t i=from; i<s.length(); ++i)
+    {
+    ck0 += (unsigned char)s[i];
+    ck1 += ck0;
+    }
+  s.push_back((char)ck0);
+  s.push_back((char)ck1);
+  }
+
+//Write a packet, damaging it first if its turn has come.
+static void WritePacket(std::string &pkt)
+  {
+  if(Corrupt > 0 && Uniform() < Corrupt)
+    {
+    ++NumDamaged;
+    size_t i = (size_t)(Uniform()*pkt.length());
+    if(Uniform() < 0.5)
+      pkt[i] ^= (char)(1 + (RandNext() % 255));   //a byte changed
+    else
+      pkt.resize(i ? i : 1);                     //cut short
+    }
+  fwrite(pkt.data(),1,pkt.length(),fpo);
+  Written += pkt.length();
+  }
+
+//A3: run time (ms) and RTC time t (s since Start).
+static void WriteTCP(unsigned long rt, double t)
+  {
+  if(t >= Duration/2)
+    t += RTCStep;
+  long long ms = (long long)floor(t*1000 + 0.5);
+  time_t tt = Start + (time_t)(ms/1000);
+  struct tm T = *gmtime(&tt);
+  std::string pkt("\x82\xA3",2);
+  Put32(pkt,rt);
+  Put16(pkt,((T.tm_year+1900)<<4) | (T.tm_mon+1));
+  Put16(pkt,(T.tm_mday<<11) | (T.tm_hour<<6) | T.tm_min);
+  Put16(pkt,(T.tm_sec<<10) | (unsigned)(ms%1000));
+  PutFletcher(pkt,2);
+  WritePacket(pkt);
+  ++NumA3;
+  }
+
+//The A2 packet of the current run time second, built up slot by slot.
+static std::string A2;
+
+static void StartA2(unsigned long rt_sec)
+  {
+  A2.assign("\x82\xA2",2);
+  Put32(A2,rt_sec);
+  }
+
+//Bytes received in the 2 ms slot at msec, in blocks of up to 127.
+static void AddBlock(unsigned msec, const char *p, size_t n)
+  {
+  while(n > 0)
+    {
+    size_t k = n < 127 ? n : 127;
+    Put16(A2,((msec/2)<<7) | (unsigned)k);
+    A2.append(p,k);
+    p += k;
+    n -= k;
+    }
+  }
+
+static void FlushA2()
+  {
+  if(A2.length() <= 6)              //no data this second
+    return;
+  Put16(A2,0xFFFF);
+  PutFletcher(A2,2);
+  WritePacket(A2);
+  ++NumA2;
+  }
+
+//Erased flash between packets.
+static void WriteErased(int k)
+  {
+  std::string blk(EraseKB*1024,(k & 1) ? '\x00' : '\xFF');
+  fwrite(blk.data(),1,blk.length(),fpo);
+  Written += blk.length();
+  }
+
+//========================================================================
+//                            Payloads
+//========================================================================
+//Bytes waiting to go out on the serial line, from Head on.
+static std::string Line;
+static size_t Head = 0;
+static double NextMsg = 0;        //RTC time (s) of the next message
+static unsigned long NumMsg = 0;
+
+static void Queue(const std::string &s)
+  {
+  if(Head > 65536 && Head > Line.length()/2)
+    {
+    Line.erase(0,Head);
+    Head = 0;
+    }
+  Line += s;
+  }
+
+//BRPT logger line: system and barometer temperature and pressure (mbar)
+//of a sensor 2 m under waves of 8, 5 and 3 s.
+static std::string BRPTLine(double t)
+  {
+  static const double amp[3] = {0.3, 0.15, 0.05}, per[3] = {8, 5, 3}, ph[3] = {0.1, 1.0, 2.0};
+  double eta = 0;
+  for(int i=0; i<3; ++i)
+    eta += amp[i]*cos(2*M_PI*t/per[i] + ph[i]);
+  double p = 1013.25 + 2.0*1029*9.81/100 + eta*1029*9.81/100*0.8 + 0.05*Gauss();
+  char buf[64];
+  sprintf(buf,"%.2f,%.2f,%.2f\r\n",15 + 0.01*t/60,15.2 + 0.02*Gauss(),p);
+  return(std::string(buf));
+  }
+
+static void PutFloat(std::string &s, float f)
+  {
+  unsigned long u;
+  memcpy(&u,&f,4);
+  Put32(s,u & 0xFFFFFFFFUL);
+  }
+
+//MIP packet of Euler angles and GPS time, every 500th a different field
+//set, as from a 3DM-GX5-25.
+static std::string MIPPacket(unsigned long k)
+  {
+  std::string p("\x75\x65\x80",3);
+  std::string f;
+  if(k % 500 == 7)
+    {
+    f.append("\x04\x0A\x01\x02",4);
+    f.append("\x0E\x0C",2);
+    PutFloat(f,0.1f); PutFloat(f,0.2f); PutFloat(f,0.3f);
+    }
+  else
+    {
+    f.append("\x0E\x0C",2);
+    PutFloat(f,(float)(0.1*sin(k/50.0)));
+    PutFloat(f,(float)(0.05*cos(k/70.0)));
+    PutFloat(f,(float)(fmod(k/1000.0,6.28) - 3.14));
+    f.append("\x0E\x12",2);
+    double tow = 302400.0 + k/Rate;
+    unsigned long long u;
+    memcpy(&u,&tow,8);
+    Put32(f,(unsigned long)(u>>32));
+    Put32(f,(unsigned long)(u & 0xFFFFFFFFUL));
+    Put16(f,2213);
+    Put16(f,6);
+    }
+  p.push_back((char)f.length());
+  p += f;
+  PutFletcher(p,0);
+  return(p);
+  }
+
+//Queue the messages due by RTC time t.
+static void Generate(double t)
+  {
+  if(Payload == PAY_BINARY)
+    {
+    //Keep the line busy.
+    while(Line.length() - Head < 4096)
+      {
+      unsigned long long r = RandNext();
+      Line.append((const char *)&r,8);
+      }
+    return;
+    }
+  while(NextMsg < t)
+    {
+    if(Payload == PAY_BRPT)
+      {
+      Queue(BRPTLine(NextMsg));
+      NextMsg += (1 + 0.05*(2*Uniform() - 1))/Rate;
+      }
+    else
+      {
+      Queue(MIPPacket(NumMsg));
+      NextMsg += 1/Rate;
+      }
+    ++NumMsg;
+    }
+  }
+
+//========================================================================
+//                             main
+//========================================================================
+int main(int argc, char *argv[])
+  {
+  AnyOption *opt = new AnyOption();
+  opt->addUsage("usage: ssrgen [options] <outfile>\n");
+  opt->addUsage("    Writes a synthetic SSR-1 time tagged archive.\n");
+  opt->addUsage("    options:\n");
+  opt->addUsage("      --payload P       brpt (text lines), mip (MIP packets) or binary (default=brpt)\n");
+  opt->addUsage("      --baud B          Serial line baud rate (default=115200)\n");
+  opt->addUsage("      --rate F          Messages per second for brpt and mip (default=16 brpt, 100 mip)\n");
+  opt->addUsage("      --duration T      Recording length, s, m, h or d suffix (default=1h)\n");
+  opt->addUsage("      --size S          Stop when the archive reaches S bytes, K, M or G suffix\n");
+  opt->addUsage("      --tcp T           Time between TCPs (default=10m)\n");
+  opt->addUsage("      --start \"Y-M-D H:M:S\" RTC time at the start, UTC (default=2022-07-01 12:00:00)\n");
+  opt->addUsage("      --drift PPM       Run time clock error against the RTC in ppm (default=0)\n");
+  opt->addUsage("      --corrupt F       Fraction of packets damaged (default=0)\n");
+  opt->addUsage("      --rtc-step T      Set the RTC forward by T, or back with -T, halfway through (default=0)\n");
+  opt->addUsage("      --power-cycles N  Power cycles spread over the recording, each appending with a new run time (default=0)\n");
+  opt->addUsage("      --off T           Time off at each power cycle (default=60s)\n");
+  opt->addUsage("      --erase N         Erased regions put between packets, alternately 0xFF and 0x00 (default=0)\n");
+  opt->addUsage("      --erase-kb K      Size of each erased region in KB (default=64)\n");
+  opt->addUsage("      --seed S          Random seed (default=1)\n");
+  opt->autoUsagePrint(true);
+  opt->setVerbose();
+  opt->setOption("payload");
+  opt->setOption("baud");
+  opt->setOption("rate");
+  opt->setOption("duration");
+  opt->setOption("size");
+  opt->setOption("tcp");
+  opt->setOption("start");
+  opt->setOption("drift");
+  opt->setOption("corrupt");
+  opt->setOption("rtc-step");
+  opt->setOption("power-cycles");
+  opt->setOption("off");
+  opt->setOption("erase");
+  opt->setOption("erase-kb");
+  opt->setOption("seed");
+  opt->processCommandArgs(argc,argv);
+  if(opt->getArgc() != 1)
+    {
+    opt->printUsage();
+    delete opt;
+    return(0);
+    }
+
+  char *c;
+  if((c = opt->getValue("payload")))
+    {
+    if(!strcmp(c,"brpt")) Payload = PAY_BRPT;
+    else if(!strcmp(c,"mip")) Payload = PAY_MIP;
+    else if(!strcmp(c,"binary")) Payload = PAY_BINARY;
+    else Fatal("Unknown --payload %s\n",c);
+    }
+  Rate = (Payload == PAY_MIP) ? 100 : 16;
+  if((c = opt->getValue("baud")) && (Baud = atof(c)) < 300) Fatal("Invalid %s\n","--baud");
+  if((c = opt->getValue("rate")) && (Rate = atof(c)) <= 0) Fatal("Invalid %s\n","--rate");
+  if((c = opt->getValue("duration"))) Duration = ParseTime(c,"--duration");
+  if((c = opt->getValue("size"))) MaxSize = ParseSize(c,"--size");
+  if((c = opt->getValue("tcp"))) TCPInterval = ParseTime(c,"--tcp");
+  if((c = opt->getValue("drift"))) Drift = atof(c);
+  if((c = opt->getValue("corrupt")) && ((Corrupt = atof(c)) < 0 || Corrupt > 1)) Fatal("Invalid %s\n","--corrupt");
+  if((c = opt->getValue("rtc-step")))
+    RTCStep = (*c == '-') ? -ParseTime(c+1,"--rtc-step") : ParseTime(c,"--rtc-step");
+  if((c = opt->getValue("power-cycles")) && (PowerCycles = atoi(c)) < 0) Fatal("Invalid %s\n","--power-cycles");
+  if((c = opt->getValue("off"))) OffTime = ParseTime(c,"--off");
+  if((c = opt->getValue("erase")) && (Erases = atoi(c)) < 0) Fatal("Invalid %s\n","--erase");
+  if((c = opt->getValue("erase-kb")) && (EraseKB = atoi(c)) <= 0) Fatal("Invalid %s\n","--erase-kb");
+  if((c = opt->getValue("seed"))) Seed = strtoull(c,NULL,10);
+
+  //The SSR doesn't use timezones, so all times are UTC.
+  putenv((char *)"TZ=UTC+0");
+  tzset();
+  struct tm T;
+  memset(&T,0,sizeof(T));
+  const char *start = opt->getValue("start") ? opt->getValue("start") : "2022-07-01 12:00:00";
+  if(sscanf(start,"%d-%d-%d %d:%d:%d",&T.tm_year,&T.tm_mon,&T.tm_mday,
+            &T.tm_hour,&T.tm_min,&T.tm_sec) != 6)
+    Fatal("Invalid --start %s\n",start);
+  T.tm_year -= 1900;
+  T.tm_mon -= 1;
+  T.tm_isdst = 0;
+  Start = mktime(&T);
+
+  fpo = fopen(opt->getArgv(0),"wb");
+  if(!fpo)
+    Fatal("Unable to open output file %s\n",opt->getArgv(0));
+  setvbuf(fpo,0,_IOFBF,1024*1024);
+
+  //RTC times of the power cycles and erased regions, spread at random.
+  std::vector<double> Cycles, Erased;
+  for(int i=0; i<PowerCycles; ++i)
+    Cycles.push_back(Duration*Uniform());
+  for(int i=0; i<Erases; ++i)
+    Erased.push_back(Duration*Uniform());
+  std::sort(Cycles.begin(),Cycles.end());
+  std::sort(Erased.begin(),Erased.end());
+  size_t nc = 0, ne = 0;
+
+  //Walk the run time clock in 2 ms slots.  Session is the RTC time the
+  //SSR last powered up at, and each run time ms is Scale RTC ms.
+  double Scale = 1 + Drift*1e-6;
+  double BytesPerSec = Baud/10;
+  double Session = 0;
+  double NextTCP = TCPInterval;
+  double Credit = 0;              //bytes the line can carry now
+  unsigned long rt = RT_START;
+  WriteTCP(rt,0);
+  StartA2(rt/1000);
+  for(;;)
+    {
+    double t0 = Session + (rt - RT_START)/(1000*Scale);
+    double t1 = Session + (rt + 2 - RT_START)/(1000*Scale);
+
+    //Second boundary: the packet of the last second is complete, and the
+    //TCPs, erased regions and power cycles due are written before the
+    //next one.
+    if(rt % 1000 == 0)
+      {
+      FlushA2();
+      if(t0 >= Duration || (MaxSize && Written >= MaxSize))
+        break;
+      if(t0 >= NextTCP)
+        {
+        WriteTCP(rt,t0);
+        NextTCP += TCPInterval;
+        }
+      while(ne < Erased.size() && Erased[ne] <= t0)
+        WriteErased((int)ne++);
+      if(nc < Cycles.size() && Cycles[nc] <= t0)
+        {
+        //Data queued on the line is lost while the SSR is off.
+        ++nc;
+        Session = t0 + OffTime;
+        rt = RT_START;
+        Line.clear();
+        Head = 0;
+        Credit = 0;
+        while(NextMsg < Session)
+          NextMsg += 1/Rate;
+        WriteTCP(rt,Session);
+        NextTCP = Session + TCPInterval;
+        StartA2(rt/1000);
+        continue;
+        }
+      StartA2(rt/1000);
+      }
+
+    //Bytes received in this slot.
+    Generate(t1);
+    Credit += BytesPerSec*(t1 - t0);
+    size_t n = (size_t)Credit;
+    if(n > Line.length() - Head)
+      {
+      n = Line.length() - Head;
+      Credit = 0;                 //an idle line doesn't save up
+      }
+    else
+      Credit -= n;
+    if(n)
+      {
+      AddBlock(rt % 1000,Line.data() + Head,n);
+      Head += n;
+      DataBytes += n;
+      }
+    rt += 2;
+    }
+  WriteTCP(rt,Session + (rt - RT_START)/(1000*Scale));
+  fclose(fpo);
+
+  printf("%s: %.0f bytes, %lu A2 and %lu A3 packets (%lu damaged), %.0f data bytes\n",
+         opt->getArgv(0),Written,NumA2,NumA3,NumDamaged,DataBytes);
+  delete opt;
+  return(0);
+  }
@@ -0,0 +1,566 @@
+/*
+Copyright (c) 2026 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+
+//sttpbench: microbenchmarks of the sttp decode path, for tracking the
+//cost of each stage across versions.
+//
+//Each archive given is read into memory once, split into its packets and
+//subpackets, and every benchmark then runs over all of them, repeating
+//until --min-time has passed.  The archive decides the packet sizes, so
+//run it over archives like the ones in the field: ssrgen makes BRPT
+//(short text lines), MIP (36 byte binary packets) and saturated binary
+//(full 127 byte blocks) archives.
+//
+//  GetPacket         packets read from the archive file (file bytes)
+//  ValidateCksum     each packet (packet bytes)
+//  ParseTCP          each A3 packet (packet bytes)
+//  GetSubPackets     each A2 packet (packet bytes)
+//  GetTCPDiff_msec   each pair of neighbouring TCPs
+//  ScaledDT          each subpacket's run time against its TCPs
+//  GetSubPacketTime  each subpacket (data bytes)
+//  GetLineTimeStamp  each subpacket's time with the default -N format
+//  HexString         each subpacket (data bytes)
+//  WriteDMLine       each subpacket's -d line, to the null device
+//  LuaParse          each subpacket to a script that only counts bytes,
+//                    or to the --lua script
+//
+//Results are the best and median pass in ns per operation, and MB/s of
+//the bytes in brackets above at the best pass.  --json writes them for
+//scripts, and --compare reads an earlier --json file to show the change
+//against it, failing (exit 1) if any benchmark is more than --threshold
+//percent slower.
+//
+//  sttpbench --json v21.json mip.dat brpt.dat bin.dat
+//  sttpbench --compare v21.json --threshold 10 mip.dat brpt.dat bin.dat
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "anyoption.h"
+#include "luacompat.h"
+#include "sttp.h"
+
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+//Globals of sttp.cpp used by the functions under test
+extern std::string TFormat;
+extern bool SuppressMSec;
+extern std::string ArchFilePath;
+
+//One subpacket with the time information the decoder has for it
+typedef struct
+  {
+  unsigned long RT_sec;
+  unsigned short msec;
+  bool last;                  //last subpacket of its A2 packet
+  size_t tcp;                 //index of the TCP before it
+  tTCP time;                  //its interpolated time
+  std::string data;
+  std::string hex;
+  } tBenchSub;
+
+typedef struct
+  {
+  std::string name;
+  double ops;                 //operations in a pass
+  double bytes;               //bytes handled in a pass
+  double best;                //ns/op of the best pass
+  double median;              //ns/op of the median pass
+  } tResult;
+
+//The archive under test
+static std::string Path;
+static double FileBytes;
+static std::vector<std::string> Packets;  //all good packets
+static std::vector<std::string> A2s;
+static std::vector<std::string> A3s;
+static std::vector<tTCP> TCPs;
+static std::vector<tBenchSub> Subs;
+static lua_State *L = NULL;
+
+static double MinTime = 0.5;  //seconds per benchmark
+static volatile unsigned long Sink;
+
+//========================================================================
+//                            Load
+//========================================================================
+//Split the archive into the packets and subpackets the benchmarks use,
+//timing the subpackets as sttp does with TCP interpolation.
+static void Load(const char *path)
+  {
+  Path = path;
+  Packets.clear();
+  A2s.clear();
+  A3s.clear();
+  TCPs.clear();
+  Subs.clear();
+  FILE *fp = fopen(path,"rb");
+  if(!fp)
+    ExitError(1,"Unable to open input file %s\n",path);
+  unsigned long loc;
+  std::vector<tSubPacket> subs;
+  for(;;)
+    {
+    std::string pkt = GetPacket(fp,&loc);
+    if(pkt.empty())
+      break;
+    Packets.push_back(pkt);
+    if(((unsigned char)pkt[1]) == 0xA3)
+      {
+      A3s.push_back(pkt);
+      TCPs.push_back(ParseTCP(pkt));
+      }
+    else if(((unsigned char)pkt[1]) == 0xA2 && !TCPs.empty())
+      {
+      A2s.push_back(pkt);
+      unsigned long RT_sec;
+      size_t n = GetSubPackets(pkt,&RT_sec,subs);
+      for(size_t k=0; k<n; ++k)
+        {
+        tBenchSub s;
+        s.RT_sec = RT_sec;
+        s.msec = subs[k].msec;
+        s.last = (k == n-1);
+        s.tcp = TCPs.size() - 1;
+        s.data = subs[k].data;
+        s.hex = HexString(s.data);
+        Subs.push_back(s);
+        }
+      }
+    }
+  FileBytes = ftell(fp);
+  fclose(fp);
+
+  //Time the subpackets between each TCP and the next.
+  for(size_t i=0; i<Subs.size(); ++i)
+    {
+    tBenchSub &s = Subs[i];
+    tTCP &next = TCPs[s.tcp+1 < TCPs.size() ? s.tcp+1 : s.tcp];
+    s.time = GetSubPacketTime(TCPs[s.tcp],next,s.RT_sec,s.msec);
+    }
+  }
+
+//The next TCP of subpacket s, or its own TCP after the last one.
+static tTCP &NextTCP(tBenchSub &s)
+  {
+  return(TCPs[s.tcp+1 < TCPs.size() ? s.tcp+1 : s.tcp]);
+  }
+
+//Passes over n items repeat them to at least 1000 operations, so the
+//clock isn't timing itself.
+static size_t Reps(size_t n)
+  {
+  return(n >= 1000 ? 1 : 1000/(n ? n : 1) + 1);
+  }
+
+//========================================================================
+//                          Benchmarks
+//========================================================================
+//Each does one pass, returning the operations done and adding up the
+//bytes handled.
+static double BenchGetPacket(double *bytes)
+  {
+  FILE *fp = fopen(Path.c_str(),"rb");
+  unsigned long loc;
+  double ops = 0;
+  for(;;)
+    {
+    std::string pkt = GetPacket(fp,&loc);
+    if(pkt.empty())
+      break;
+    ++ops;
+    }
+  fclose(fp);
+  *bytes = FileBytes;
+  return(ops);
+  }
+
+static double BenchValidateCksum(double *bytes)
+  {
+  unsigned long good = 0;
+  for(size_t i=0; i<Packets.size(); ++i)
+    {
+    good += ValidateCksum(Packets[i]);
+    *bytes += Packets[i].length();
+    }
+  Sink = good;
+  return(Packets.size());
+  }
+
+static double BenchParseTCP(double *bytes)
+  {
+  unsigned long sum = 0;
+  size_t r = Reps(A3s.size());
+  for(size_t k=0; k<r; ++k)
+    for(size_t i=0; i<A3s.size(); ++i)
+      {
+      sum += ParseTCP(A3s[i]).RT;
+      *bytes += A3s[i].length();
+      }
+  Sink = sum;
+  return((double)r*A3s.size());
+  }
+
+static double BenchGetSubPackets(double *bytes)
+  {
+  std::vector<tSubPacket> subs;
+  unsigned long RT_sec, n = 0;
+  for(size_t i=0; i<A2s.size(); ++i)
+    {
+    n += GetSubPackets(A2s[i],&RT_sec,subs);
+    *bytes += A2s[i].length();
+    }
+  Sink = n;
+  return(A2s.size());
+  }
+
+static double BenchGetTCPDiff(double *)
+  {
+  unsigned long sum = 0;
+  size_t r = Reps(TCPs.size() - 1);
+  for(size_t k=0; k<r; ++k)
+    for(size_t i=1; i<TCPs.size(); ++i)
+      sum += GetTCPDiff_msec(TCPs[i],TCPs[i-1]);
+  Sink = sum;
+  return((double)r*(TCPs.size() - 1));
+  }
+
+static double BenchScaledDT(double *)
+  {
+  unsigned long sum = 0;
+  for(size_t i=0; i<Subs.size(); ++i)
+    {
+    tBenchSub &s = Subs[i];
+    sum += ScaledDT(s.RT_sec*1000 + s.msec,TCPs[s.tcp],NextTCP(s));
+    }
+  Sink = sum;
+  return(Subs.size());
+  }
+
+static double BenchGetSubPacketTime(double *bytes)
+  {
+  unsigned long sum = 0;
+  for(size_t i=0; i<Subs.size(); ++i)
+    {
+    tBenchSub &s = Subs[i];
+    sum += GetSubPacketTime(TCPs[s.tcp],NextTCP(s),s.RT_sec,s.msec).msec;
+    *bytes += s.data.length();
+    }
+  Sink = sum;
+  return(Subs.size());
+  }
+
+static double BenchGetLineTimeStamp(double *bytes)
+  {
+  unsigned long sum = 0;
+  for(size_t i=0; i<Subs.size(); ++i)
+    {
+    sum += GetLineTimeStamp(Subs[i].time,TFormat,SuppressMSec).length();
+    *bytes += Subs[i].data.length();
+    }
+  Sink = sum;
+  return(Subs.size());
+  }
+
+static double BenchHexString(double *bytes)
+  {
+  unsigned long sum = 0;
+  for(size_t i=0; i<Subs.size(); ++i)
+    {
+    sum += HexString(Subs[i].data).length();
+    *bytes += Subs[i].data.length();
+    }
+  Sink = sum;
+  return(Subs.size());
+  }
+
+static FILE *fpnull = NULL;
+
+static double BenchWriteDMLine(double *bytes)
+  {
+  double ops = 0;
+  for(size_t i=0; i<Subs.size(); ++i)
+    {
+    tBenchSub &s = Subs[i];
+    //WriteDMLine formats into a 600 byte buffer.
+    if(s.hex.length() > 500)
+      continue;
+    unsigned short count = s.data.length();
+    WriteDMLine(fpnull,NULL,"%lu%03hu %hu %s",s.RT_sec,s.msec,count,s.hex.c_str());
+    *bytes += count;
+    ++ops;
+    }
+  return(ops);
+  }
+
+static double BenchLuaParse(double *bytes)
+  {
+  for(size_t i=0; i<Subs.size(); ++i)
+    {
+    tBenchSub &s = Subs[i];
+    std::string ts = GetLineTimeStamp(s.time,TFormat,SuppressMSec);
+    LuaParse(L,s.data,s.RT_sec+s.msec/1000.0L,ts);
+    if(s.last)
+      LuaPacketEnd(L);
+    *bytes += s.data.length();
+    }
+  LuaFlush(L);
+  return(Subs.size());
+  }
+
+//========================================================================
+//                             Run
+//========================================================================
+//Time passes of fn until MinTime has passed, at least 3 of them.
+static tResult Run(const char *name, double (*fn)(double *))
+  {
+  typedef std::chrono::steady_clock clk;
+  tResult r;
+  r.name = name;
+  r.bytes = 0;
+  r.ops = fn(&r.bytes);       //warm up
+  std::vector<double> ns;
+  double total = 0;
+  while(ns.size() < 3 || total < MinTime)
+    {
+    double bytes = 0;
+    clk::time_point t0 = clk::now();
+    double ops = fn(&bytes);
+    double dt = std::chrono::duration<double>(clk::now() - t0).count();
+    total += dt;
+    ns.push_back(ops ? dt*1e9/ops : 0);
+    }
+  std::sort(ns.begin(),ns.end());
+  r.best = ns[0];
+  r.median = ns[ns.size()/2];
+  return(r);
+  }
+
+static double MBps(tResult &r)
+  {
+  if(r.bytes == 0 || r.best == 0)
+    return(0);
+  return(r.bytes/(r.ops*r.best*1e-9)/1e6);
+  }
+
+//========================================================================
+//                         Baseline file
+//========================================================================
+//Best ns/op of "<archive>/<benchmark>" from a --json file.  The file is
+//read back line by line, as written by WriteJSON.
+static std::map<std::string,double> Base;
+
+static void ReadBase(const char *fname)
+  {
+  FILE *fp = fopen(fname,"rt");
+  if(!fp)
+    ExitError(1,"Unable to open baseline file %s\n",fname);
+  char line[512], name[128];
+  std::string archive;
+  double ns;
+  while(fgets(line,sizeof(line),fp))
+    {
+    if(sscanf(line," {\"archive\": \"%127[^\"]\"",name) == 1)
+      archive = name;
+    else if(sscanf(line," {\"name\": \"%127[^\"]\", %*[^,], \"ns_per_op\": %lf",name,&ns) == 2)
+      Base[archive + "/" + name] = ns;
+    }
+  fclose(fp);
+  }
+
+static void WriteJSON(FILE *fp, std::vector<std::string> &archives, std::vector<double> &sizes,
+                      std::vector<std::vector<tResult> > &results)
+  {
+  fprintf(fp,"[\n");
+  for(size_t a=0; a<archives.size(); ++a)
+    {
+    fprintf(fp,"  {\"archive\": \"%s\", \"bytes\": %.0f, \"results\": [\n",archives[a].c_str(),sizes[a]);
+    for(size_t i=0; i<results[a].size(); ++i)
+      {
+      tResult &r = results[a][i];
+      fprintf(fp,"    {\"name\": \"%s\", \"ops\": %.0f, \"ns_per_op\": %.2f, "
+                 "\"ns_per_op_median\": %.2f, \"mb_per_s\": %.2f}%s\n",
+              r.name.c_str(),r.ops,r.best,r.median,MBps(r),
+              (i+1 < results[a].size()) ? "," : "");
+      }
+    fprintf(fp,"  ]}%s\n",(a+1 < archives.size()) ? "," : "");
+    }
+  fprintf(fp,"]\n");
+  }
+
+//========================================================================
+//                             main
+//========================================================================
+int main(int argc, char *argv[])
+  {
+  AnyOption *opt = new AnyOption();
+  opt->addUsage("usage: sttpbench [options] <archive> [<archive> ...]\n");
+  opt->addUsage("    Times the stages of the sttp decode path over each archive.\n");
+  opt->addUsage("    options:\n");
+  opt->addUsage("      --json <file>      Write the results as JSON to file\n");
+  opt->addUsage("      --compare <file>   Show the change against a --json file of an earlier run\n");
+  opt->addUsage("      --threshold P      With --compare, exit 1 if a benchmark is more than P percent slower\n");
+  opt->addUsage("      --min-time S       Seconds each benchmark runs for (default=0.5)\n");
+  opt->addUsage("      --lua <lua_file>   Script for LuaParse instead of one that only counts bytes\n");
+  opt->autoUsagePrint(true);
+  opt->setVerbose();
+  opt->setOption("json");
+  opt->setOption("compare");
+  opt->setOption("threshold");
+  opt->setOption("min-time");
+  opt->setOption("lua");
+  opt->processCommandArgs(argc,argv);
+  if(opt->getArgc() < 1)
+    {
+    opt->printUsage();
+    delete opt;
+    return(0);
+    }
+
+  double Threshold = 0;
+  if(opt->getValue("min-time") && (MinTime = atof(opt->getValue("min-time"))) <= 0)
+    ExitError(1,"Invalid --min-time\n");
+  if(opt->getValue("threshold"))
+    Threshold = atof(opt->getValue("threshold"));
+  if(opt->getValue("compare"))
+    ReadBase(opt->getValue("compare"));
+
+  //As sttp: UTC, default timestamp format.
+  putenv((char *)"TZ=UTC+0");
+  tzset();
+  TFormat = "%Y %m %d %H %M %S ";
+  SuppressMSec = false;
+
+  //The default script counts the bytes it's given, so LuaParse is the cost
+  //of the call.
+  std::string script;
+  if(opt->getValue("lua"))
+    script = opt->getValue("lua");
+  else
+    {
+    script = "sttpbench_count.lua";
+    FILE *fp = fopen(script.c_str(),"wt");
+    if(!fp)
+      ExitError(1,"Unable to write %s\n",script.c_str());
+    fprintf(fp,"n = 0\nfunction ParseData(runtime, timestamp, buf) n = n + #buf end\n");
+    fclose(fp);
+    }
+
+  fpnull = fopen(NULL_DEVICE,"wt");
+  std::vector<std::string> archives;
+  std::vector<double> sizes;
+  std::vector<std::vector<tResult> > results;
+  int slower = 0;
+  for(int a=0; a<opt->getArgc(); ++a)
+    {
+    Load(opt->getArgv(a));
+    ArchFilePath = opt->getArgv(a);
+    L = LuaSetup((char *)script.c_str());
+
+    std::vector<tResult> res;
+    res.push_back(Run("GetPacket",BenchGetPacket));
+    res.push_back(Run("ValidateCksum",BenchValidateCksum));
+    if(!A3s.empty())
+      res.push_back(Run("ParseTCP",BenchParseTCP));
+    if(!Subs.empty())
+      {
+      res.push_back(Run("GetSubPackets",BenchGetSubPackets));
+      if(TCPs.size() > 1)
+        res.push_back(Run("GetTCPDiff_msec",BenchGetTCPDiff));
+      res.push_back(Run("ScaledDT",BenchScaledDT));
+      res.push_back(Run("GetSubPacketTime",BenchGetSubPacketTime));
+      res.push_back(Run("GetLineTimeStamp",BenchGetLineTimeStamp));
+      res.push_back(Run("HexString",BenchHexString));
+      res.push_back(Run("WriteDMLine",BenchWriteDMLine));
+      res.push_back(Run("LuaParse",BenchLuaParse));
+      }
+    LuaClose(L);
+
+    //Report
+    std::string name = BaseFileName(opt->getArgv(a));
+    double data = 0;
+    for(size_t i=0; i<Subs.size(); ++i)
+      data += Subs[i].data.length();
+    printf("%s: %.0f bytes, %lu packets, %lu TCPs, %lu subpackets of %.1f bytes average\n",
+           name.c_str(),FileBytes,(unsigned long)Packets.size(),(unsigned long)TCPs.size(),
+           (unsigned long)Subs.size(),Subs.empty() ? 0 : data/Subs.size());
+    printf("  %-18s %10s %10s %10s %10s%s\n","benchmark","ops","ns/op","median","MB/s",
+           Base.empty() ? "" : "    change");
+    for(size_t i=0; i<res.size(); ++i)
+      {
+      tResult &r = res[i];
+      printf("  %-18s %10.0f %10.1f %10.1f",r.name.c_str(),r.ops,r.best,r.median);
+      if(r.bytes)
+        printf(" %10.1f",MBps(r));
+      else
+        printf(" %10s","-");
+      std::map<std::string,double>::iterator it = Base.find(name + "/" + r.name);
+      if(it != Base.end() && it->second > 0)
+        {
+        double pct = 100*(r.best - it->second)/it->second;
+        printf("  %+7.1f%%",pct);
+        if(Threshold > 0 && pct > Threshold)
+          {
+          printf(" SLOWER");
+          ++slower;
+          }
+        }
+      printf("\n");
+      }
+    archives.push_back(name);
+    sizes.push_back(FileBytes);
+    results.push_back(res);
+    }
+  fclose(fpnull);
+  if(!opt->getValue("lua"))
+    remove(script.c_str());
+
+  if(opt->getValue("json"))
+    {
+    FILE *fp = fopen(opt->getValue("json"),"wt");
+    if(!fp)
+      ExitError(1,"Unable to open output file %s\n",opt->getValue("json"));
+    WriteJSON(fp,archives,sizes,results);
+    fclose(fp);
+    }
+  delete opt;
+  if(slower)
+    {
+    fprintf(stderr,"%d benchmark%s more than %.1f%% slower than the baseline\n",
+            slower,slower > 1 ? "s" : "",Threshold);
+    return(1);
+    }
+  return(0);
+  }
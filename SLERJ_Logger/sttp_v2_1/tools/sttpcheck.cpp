@@ -0,0 +1,666 @@
+/*
+Copyright (c) 2026 Slerj, LLC
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+
+//sttpcheck: end to end regression check of sttp.  Runs sttp over archives
+//with the options of each check in a checks file, compares every output
+//file byte for byte with its reference, and times each run against the
+//timings of a baseline, so a faster sttp can be shown to give the same
+//output in less time and memory.
+//
+//The checks file (checks.txt) has lines of
+//
+//  generate <file> <ssrgen options>
+//  check <name> <archive> <outputs> <sttp options>
+//  newcheck <name> <archive> <outputs> <sttp options>
+//
+//generate makes an archive in the work directory with ssrgen.  A check
+//copies its archive into the work directory, unless it was generated
+//there, and runs sttp in that directory, so outputs given as bare names
+//and those Lua scripts write next to the archive end up there.  outputs
+//is a comma separated list of the files the run writes, each optionally
+//=<reference file>; the reference of the others is <refs>/<name>/<file>.
+//Paths in the checks file are relative to it, and $D in the sttp options
+//is its directory.  Double quotes group words with spaces.  A newcheck is
+//a check of options the baseline sttp doesn't have, so its references are
+//recorded with an sttp that has them and it isn't timed.
+//
+//  sttpcheck --record --sttp ..\sttp_v21.exe
+//      runs the baseline sttp, keeping its outputs and timings in refs
+//  sttpcheck --record-new
+//      keeps the outputs of ..\sttp.exe for the newchecks
+//  sttpcheck
+//      checks ..\sttp.exe against them
+//
+//A check fails if an output differs from its reference, sttp fails, or it
+//takes more than --threshold percent longer or more memory than the
+//baseline.
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <direct.h>
+#define EXE ".exe"
+#else
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#define EXE ""
+#endif
+#include "anyoption.h"
+
+typedef struct
+  {
+  std::string name;
+  std::string archive;                //path of the archive
+  std::vector<std::string> outputs;   //files sttp writes in the work directory
+  std::vector<std::string> refs;      //reference file of each output
+  std::vector<std::string> args;      //sttp options
+  bool isnew;                         //a newcheck
+  } tCheck;
+
+typedef struct
+  {
+  double wall;                        //seconds
+  double peak;                        //peak memory in MB
+  } tTiming;
+
+//Options
+static std::string Sttp = "../sttp" EXE;
+static std::string SsrGen = "ssrgen" EXE;
+static std::string SpecDir;           //directory of the checks file
+static std::string WorkDir = "sttpcheck_work";
+static std::string RefDir;            //default <SpecDir>refs
+static bool Record = false;
+static bool RecordNew = false;
+static bool IgnoreCR = false;
+static int Runs = 3;
+static double Threshold = 20;
+
+static void Fatal(const char *fmt, const char *arg)
+  {
+  fprintf(stderr,fmt,arg);
+  exit(2);
+  }
+
+//========================================================================
+//                             Paths
+//========================================================================
+static bool IsAbsolute(const std::string &p)
+  {
+  return(!p.empty() && (p[0] == '/' || p[0] == '\\' || (p.length() > 1 && p[1] == ':')));
+  }
+
+//p made absolute against the current directory.
+static std::string Absolute(const std::string &p)
+  {
+  if(IsAbsolute(p))
+    return(p);
+  char cwd[4096];
+  if(!getcwd(cwd,sizeof(cwd)))
+    Fatal("Unable to get the current directory%s\n","");
+  return(std::string(cwd) + "/" + p);
+  }
+
+//Directory part of p, with its trailing separator.
+static std::string DirName(const std::string &p)
+  {
+  size_t k = p.find_last_of("/\\");
+  return(k == std::string::npos ? std::string("") : p.substr(0,k+1));
+  }
+
+static std::string BaseName(const std::string &p)
+  {
+  size_t k = p.find_last_of("/\\");
+  return(k == std::string::npos ? p : p.substr(k+1));
+  }
+
+static bool Exists(const std::string &p)
+  {
+  struct stat st;
+  return(stat(p.c_str(),&st) == 0);
+  }
+
+static double FileSize(const std::string &p)
+  {
+  struct stat st;
+  return(stat(p.c_str(),&st) ? 0 : (double)st.st_size);
+  }
+
+static void MakeDir(const std::string &p)
+  {
+#ifdef _WIN32
+  _mkdir(p.c_str());
+#else
+  mkdir(p.c_str(),0777);
+#endif
+  }
+
+static bool CopyTo(const std::string &from, const std::string &to)
+  {
+  FILE *fi = fopen(from.c_str(),"rb");
+  if(!fi)
+    return(false);
+  FILE *fo = fopen(to.c_str(),"wb");
+  if(!fo)
+    {
+    fclose(fi);
+    return(false);
+    }
+  std::vector<char> buf(1024*1024);
+  size_t n;
+  while((n = fread(&buf[0],1,buf.size(),fi)) > 0)
+    fwrite(&buf[0],1,n,fo);
+  fclose(fi);
+  return(fclose(fo) == 0);
+  }
+
+//========================================================================
+//                              Run
+//========================================================================
+#ifdef _WIN32
+//Quotes an argument for the Windows command line parser.
+static std::string Quote(const std::string &s)
+  {
+  if(!s.empty() && s.find_first_of(" \t\"") == std::string::npos)
+    return(s);
+  std::string q = "\"";
+  size_t bs = 0;
+  for(size_t i=0; i<s.length(); ++i)
+    {
+    if(s[i] == '\\')
+      {
+      ++bs;
+      continue;
+      }
+    q.append(s[i] == '"' ? 2*bs+1 : bs,'\\');
+    bs = 0;
+    q.push_back(s[i]);
+    }
+  q.append(2*bs,'\\');
+  q.push_back('"');
+  return(q);
+  }
+#endif
+
+//Runs exe with args in directory dir, its output going to log.  Returns
+//the exit code, -1 if it couldn't be started, with the wall time and the
+//peak memory of the process.
+static int Run(const std::string &exe, const std::vector<std::string> &args,
+               const std::string &dir, const std::string &log, tTiming *t)
+  {
+  typedef std::chrono::steady_clock clk;
+  t->wall = t->peak = 0;
+#ifdef _WIN32
+  std::string cmd = Quote(exe);
+  for(size_t i=0; i<args.size(); ++i)
+    cmd += " " + Quote(args[i]);
+  std::vector<char> cl(cmd.begin(),cmd.end());
+  cl.push_back(0);
+  SECURITY_ATTRIBUTES sa = {sizeof(sa),NULL,TRUE};
+  HANDLE hlog = CreateFileA(log.c_str(),GENERIC_WRITE,FILE_SHARE_READ,&sa,
+                            CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+  STARTUPINFOA si;
+  memset(&si,0,sizeof(si));
+  si.cb = sizeof(si);
+  si.dwFlags = STARTF_USESTDHANDLES;
+  si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+  si.hStdOutput = si.hStdError = hlog;
+  PROCESS_INFORMATION pi;
+  clk::time_point t0 = clk::now();
+  if(!CreateProcessA(NULL,&cl[0],NULL,NULL,TRUE,0,NULL,dir.c_str(),&si,&pi))
+    {
+    CloseHandle(hlog);
+    return(-1);
+    }
+  WaitForSingleObject(pi.hProcess,INFINITE);
+  t->wall = std::chrono::duration<double>(clk::now() - t0).count();
+  PROCESS_MEMORY_COUNTERS pmc;
+  if(GetProcessMemoryInfo(pi.hProcess,&pmc,sizeof(pmc)))
+    t->peak = pmc.PeakWorkingSetSize/1048576.0;
+  DWORD code = 0;
+  GetExitCodeProcess(pi.hProcess,&code);
+  CloseHandle(pi.hThread);
+  CloseHandle(pi.hProcess);
+  CloseHandle(hlog);
+  return((int)code);
+#else
+  clk::time_point t0 = clk::now();
+  pid_t pid = fork();
+  if(pid < 0)
+    return(-1);
+  if(pid == 0)
+    {
+    int fd = open(log.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0666);
+    if(fd >= 0)
+      {
+      dup2(fd,1);
+      dup2(fd,2);
+      close(fd);
+      }
+    if(chdir(dir.c_str()))
+      _exit(127);
+    std::vector<char *> argv;
+    argv.push_back((char *)exe.c_str());
+    for(size_t i=0; i<args.size(); ++i)
+      argv.push_back((char *)args[i].c_str());
+    argv.push_back(NULL);
+    execv(exe.c_str(),&argv[0]);
+    _exit(127);
+    }
+  int status;
+  struct rusage ru;
+  if(wait4(pid,&status,0,&ru) < 0)
+    return(-1);
+  t->wall = std::chrono::duration<double>(clk::now() - t0).count();
+  t->peak = ru.ru_maxrss/1024.0;      //KB on Linux
+  if(!WIFEXITED(status))
+    return(-1);
+  if(WEXITSTATUS(status) == 127)
+    return(-1);
+  return(WEXITSTATUS(status));
+#endif
+  }
+
+//========================================================================
+//                            Compare
+//========================================================================
+//Buffered reading of a file, optionally leaving out carriage returns.
+typedef struct
+  {
+  FILE *fp;
+  std::vector<char> buf;
+  size_t pos, len;
+  } tReader;
+
+static int NextByte(tReader &r)
+  {
+  for(;;)
+    {
+    if(r.pos == r.len)
+      {
+      r.len = fread(&r.buf[0],1,r.buf.size(),r.fp);
+      r.pos = 0;
+      if(r.len == 0)
+        return(EOF);
+      }
+    int c = (unsigned char)r.buf[r.pos++];
+    if(!(IgnoreCR && c == '\r'))
+      return(c);
+    }
+  }
+
+//Compares output a with reference b.  Returns an empty string if they are
+//the same, otherwise where they first differ.
+static std::string Compare(const std::string &a, const std::string &b)
+  {
+  tReader ra, rb;
+  ra.fp = fopen(a.c_str(),"rb");
+  if(!ra.fp)
+    return("not written");
+  rb.fp = fopen(b.c_str(),"rb");
+  if(!rb.fp)
+    {
+    fclose(ra.fp);
+    return("no reference " + b);
+    }
+  ra.buf.resize(1024*1024);
+  rb.buf.resize(1024*1024);
+  ra.pos = ra.len = rb.pos = rb.len = 0;
+  double offset = 0, line = 1;
+  std::string diff;
+  for(;;)
+    {
+    int ca = NextByte(ra), cb = NextByte(rb);
+    if(ca != cb)
+      {
+      char msg[200];
+      if(ca == EOF || cb == EOF)
+        sprintf(msg,"%s is shorter, from byte %.0f (line %.0f)",
+                ca == EOF ? "output" : "reference",offset,line);
+      else
+        sprintf(msg,"differs at byte %.0f (line %.0f)",offset,line);
+      diff = msg;
+      break;
+      }
+    if(ca == EOF)
+      break;
+    ++offset;
+    if(ca == '\n')
+      ++line;
+    }
+  fclose(ra.fp);
+  fclose(rb.fp);
+  return(diff);
+  }
+
+//========================================================================
+//                          Checks file
+//========================================================================
+//Splits a line into words, double quotes grouping words with spaces.
+static std::vector<std::string> Words(const char *s)
+  {
+  std::vector<std::string> w;
+  while(*s)
+    {
+    while(*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')
+      ++s;
+    if(!*s)
+      break;
+    std::string word;
+    bool quoted = false;
+    while(*s && (quoted || !(*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')))
+      {
+      if(*s == '"')
+        quoted = !quoted;
+      else
+        word.push_back(*s);
+      ++s;
+      }
+    w.push_back(word);
+    }
+  return(w);
+  }
+
+static std::string Resolve(const std::string &p)
+  {
+  return(IsAbsolute(p) ? p : SpecDir + p);
+  }
+
+//Reads the checks file, generating the archives it asks for.
+static void ReadChecks(const char *fname, std::vector<tCheck> &checks)
+  {
+  FILE *fp = fopen(fname,"rt");
+  if(!fp)
+    Fatal("Unable to open checks file %s\n",fname);
+  char line[2048];
+  int n = 0;
+  while(fgets(line,sizeof(line),fp))
+    {
+    ++n;
+    std::vector<std::string> w = Words(line);
+    if(w.empty() || w[0][0] == '#')
+      continue;
+    if(w[0] == "generate" && w.size() >= 2)
+      {
+      std::string out = WorkDir + w[1];
+      std::vector<std::string> args(w.begin()+2,w.end());
+      args.push_back(out);
+      tTiming t;
+      printf("generating %s\n",w[1].c_str());
+      fflush(stdout);
+      if(Run(SsrGen,args,WorkDir,WorkDir + w[1] + ".log",&t) != 0)
+        Fatal("Unable to generate %s (see its .log)\n",out.c_str());
+      }
+    else if((w[0] == "check" || w[0] == "newcheck") && w.size() >= 4)
+      {
+      tCheck c;
+      c.name = w[1];
+      c.isnew = (w[0] == "newcheck");
+      c.archive = Exists(WorkDir + w[2]) ? WorkDir + w[2] : Resolve(w[2]);
+      std::string o = w[3] + ",";
+      size_t p = 0, k;
+      while((k = o.find(',',p)) != std::string::npos)
+        {
+        std::string f = o.substr(p,k-p);
+        p = k+1;
+        size_t e = f.find('=');
+        if(f.empty())
+          continue;
+        else if(e == std::string::npos)
+          {
+          c.outputs.push_back(f);
+          c.refs.push_back(RefDir + c.name + "/" + f);
+          }
+        else
+          {
+          c.outputs.push_back(f.substr(0,e));
+          c.refs.push_back(Resolve(f.substr(e+1)));
+          }
+        }
+      for(size_t i=4; i<w.size(); ++i)
+        {
+        std::string a = w[i];
+        size_t d = a.find("$D/");
+        if(d != std::string::npos)
+          a.replace(d,3,SpecDir);
+        c.args.push_back(a);
+        }
+      checks.push_back(c);
+      }
+    else
+      {
+      char msg[64];
+      sprintf(msg,"%s line %d",fname,n);
+      Fatal("Invalid line in %s\n",msg);
+      }
+    }
+  fclose(fp);
+  }
+
+//Baseline timings, <refs>/timings.txt: name, wall seconds, peak MB.
+static std::map<std::string,tTiming> ReadTimings()
+  {
+  std::map<std::string,tTiming> m;
+  FILE *fp = fopen((RefDir + "timings.txt").c_str(),"rt");
+  if(!fp)
+    return(m);
+  char name[256];
+  tTiming t;
+  while(fscanf(fp,"%255s %lf %lf",name,&t.wall,&t.peak) == 3)
+    m[name] = t;
+  fclose(fp);
+  return(m);
+  }
+
+//========================================================================
+//                             main
+//========================================================================
+int main(int argc, char *argv[])
+  {
+  AnyOption *opt = new AnyOption();
+  opt->addUsage("usage: sttpcheck [options] [<checks_file>]\n");
+  opt->addUsage("    Runs sttp over the checks in checks_file (default=checks.txt) and compares its\n");
+  opt->addUsage("    outputs, time and memory with the references.\n");
+  opt->addUsage("    options:\n");
+  opt->addUsage("      --sttp <exe>       sttp to check (default=../sttp" EXE ")\n");
+  opt->addUsage("      --ssrgen <exe>     Archive generator (default=ssrgen" EXE ")\n");
+  opt->addUsage("      --refs <dir>       Reference outputs and timings (default=refs next to the checks file)\n");
+  opt->addUsage("      --work <dir>       Directory for archives and outputs (default=sttpcheck_work)\n");
+  opt->addUsage("      --record           Keep the outputs and timings of this sttp as the references\n");
+  opt->addUsage("      --record-new       Keep the outputs of this sttp as the references of the newchecks\n");
+  opt->addUsage("      --runs N           Run each check N times, timing the fastest (default=3)\n");
+  opt->addUsage("      --threshold P      Fail checks more than P percent slower or bigger than the baseline (default=20)\n");
+  opt->addUsage("      --ignore-cr        Compare outputs leaving out carriage returns, for builds with LF text files\n");
+  opt->autoUsagePrint(true);
+  opt->setVerbose();
+  opt->setOption("sttp");
+  opt->setOption("ssrgen");
+  opt->setOption("refs");
+  opt->setOption("work");
+  opt->setOption("runs");
+  opt->setOption("threshold");
+  opt->setFlag("record");
+  opt->setFlag("record-new");
+  opt->setFlag("ignore-cr");
+  opt->processCommandArgs(argc,argv);
+  if(opt->getArgc() > 1)
+    {
+    opt->printUsage();
+    delete opt;
+    return(0);
+    }
+  std::string spec = opt->getArgc() ? opt->getArgv(0) : "checks.txt";
+  SpecDir = DirName(Absolute(spec));
+  RefDir = SpecDir + "refs";
+  if(opt->getValue("sttp")) Sttp = opt->getValue("sttp");
+  if(opt->getValue("ssrgen")) SsrGen = opt->getValue("ssrgen");
+  if(opt->getValue("refs")) RefDir = opt->getValue("refs");
+  if(opt->getValue("work")) WorkDir = opt->getValue("work");
+  if(opt->getValue("runs") && (Runs = atoi(opt->getValue("runs"))) < 1)
+    Fatal("Invalid --runs%s\n","");
+  if(opt->getValue("threshold"))
+    Threshold = atof(opt->getValue("threshold"));
+  Record = opt->getFlag("record");
+  RecordNew = opt->getFlag("record-new");
+  if(Record && RecordNew)
+    Fatal("Use one of --record and --record-new%s\n","");
+  IgnoreCR = opt->getFlag("ignore-cr");
+
+  //The checks run in the work directory, so everything is made absolute.
+  Sttp = Absolute(Sttp);
+  SsrGen = Absolute(SsrGen);
+  RefDir = Absolute(RefDir) + "/";
+  WorkDir = Absolute(WorkDir) + "/";
+  MakeDir(WorkDir);
+  if(!Exists(Sttp))
+    Fatal("%s not found\n",Sttp.c_str());
+
+  std::vector<tCheck> checks;
+  ReadChecks(spec.c_str(),checks);
+  std::map<std::string,tTiming> base;
+  if(Record || RecordNew)
+    MakeDir(RefDir);
+  else
+    base = ReadTimings();
+
+  printf("  %-20s %-6s %9s %9s %9s %9s %9s\n","check","result","wall(s)","peak(MB)","MB/s",
+         base.empty() ? "" : "time","");
+  if(!base.empty())
+    printf("  %-20s %-6s %9s %9s %9s %9s %9s\n","","","","","","vs base","peak");
+  std::vector<std::string> failures;
+  std::map<std::string,tTiming> timings;
+  std::map<std::string,bool> copied;
+  size_t ran = 0;
+  for(size_t i=0; i<checks.size(); ++i)
+    {
+    //The baseline doesn't have the options of the newchecks.
+    tCheck &c = checks[i];
+    if((Record && c.isnew) || (RecordNew && !c.isnew))
+      continue;
+    ++ran;
+    std::string archive = WorkDir + BaseName(c.archive);
+    if(archive != c.archive && !copied[archive])
+      {
+      if(!CopyTo(c.archive,archive))
+        Fatal("Unable to copy %s to the work directory\n",c.archive.c_str());
+      copied[archive] = true;
+      }
+
+    //The fastest of the runs, with outputs of the last.
+    tTiming best;
+    std::string why;
+    std::vector<std::string> args = c.args;
+    args.push_back(BaseName(archive));
+    for(int r=0; r<Runs && why.empty(); ++r)
+      {
+      for(size_t k=0; k<c.outputs.size(); ++k)
+        remove((WorkDir + c.outputs[k]).c_str());
+      tTiming t;
+      int rc = Run(Sttp,args,WorkDir,WorkDir + c.name + ".log",&t);
+      if(rc < 0)
+        why = "sttp could not be run";
+      else if(rc)
+        {
+        char msg[100];
+        sprintf(msg,"sttp exited with %d, see %s.log",rc,c.name.c_str());
+        why = msg;
+        }
+      if(r == 0 || t.wall < best.wall)
+        best.wall = t.wall;
+      if(r == 0 || t.peak > best.peak)
+        best.peak = t.peak;
+      }
+
+    //Outputs against their references.  Recording keeps the outputs as
+    //the references, except those given in the checks file.
+    for(size_t k=0; k<c.outputs.size() && why.empty(); ++k)
+      {
+      std::string out = WorkDir + c.outputs[k];
+      if((Record || RecordNew) && c.refs[k] == RefDir + c.name + "/" + c.outputs[k])
+        {
+        MakeDir(RefDir + c.name);
+        if(!CopyTo(out,c.refs[k]))
+          why = c.outputs[k] + " not written";
+        continue;
+        }
+      std::string d = Compare(out,c.refs[k]);
+      if(!d.empty() && c.isnew && !Exists(c.refs[k]))
+        d += " (sttpcheck --record-new)";
+      if(!d.empty())
+        why = c.outputs[k] + ": " + d;
+      }
+
+    //Time and memory against the baseline, leaving out differences too
+    //small to measure.
+    double mbps = FileSize(archive)/1e6/(best.wall > 0 ? best.wall : 1e-9);
+    char dt[32] = "", dp[32] = "";
+    std::map<std::string,tTiming>::iterator b = base.find(c.name);
+    if(why.empty() && b != base.end())
+      {
+      tTiming &bt = b->second;
+      sprintf(dt,"%+.1f%%",bt.wall > 0 ? 100*(best.wall - bt.wall)/bt.wall : 0);
+      sprintf(dp,"%+.1f%%",bt.peak > 0 ? 100*(best.peak - bt.peak)/bt.peak : 0);
+      if(best.wall > bt.wall*(1 + Threshold/100) + 0.02)
+        why = std::string("time ") + dt + " over the baseline";
+      else if(best.peak > bt.peak*(1 + Threshold/100) + 1)
+        why = std::string("peak memory ") + dp + " over the baseline";
+      }
+    timings[c.name] = best;
+
+    printf("  %-20s %-6s %9.3f %9.1f %9.1f %9s %9s\n",c.name.c_str(),why.empty() ? "ok" : "FAIL",
+           best.wall,best.peak,mbps,dt,dp);
+    fflush(stdout);
+    if(!why.empty())
+      failures.push_back(c.name + ": " + why);
+    }
+
+  if(Record)
+    {
+    FILE *fp = fopen((RefDir + "timings.txt").c_str(),"wt");
+    if(!fp)
+      Fatal("Unable to write %stimings.txt\n",RefDir.c_str());
+    std::map<std::string,tTiming>::iterator it;
+    for(it = timings.begin(); it != timings.end(); ++it)
+      fprintf(fp,"%s %.4f %.2f\n",it->first.c_str(),it->second.wall,it->second.peak);
+    fclose(fp);
+    }
+  if(Record || RecordNew)
+    printf("References recorded in %s\n",RefDir.c_str());
+  for(size_t i=0; i<failures.size(); ++i)
+    printf("FAIL %s\n",failures[i].c_str());
+  printf("%lu of %lu checks passed\n",(unsigned long)(ran - failures.size()),
+         (unsigned long)ran);
+  delete opt;
+  return(failures.empty() ? 0 : 1);
+  }